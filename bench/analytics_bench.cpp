@@ -0,0 +1,105 @@
+// Steps per second playing the way batch mode does (a playthrough per
+// thread, every question answered at once) with analytics off, counting
+// into a shard per thread (Analytics), and, for comparison, counting into
+// one array of atomics that every thread shares. Run on 1 thread and more,
+// so contention shows as the rate per thread falling. The shared array
+// counts arrivals only, less than the shards do.
+// Usage: analytics_bench [steps per thread] [max threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "playthrough.h"
+#include "analytics.h"
+
+namespace {
+
+// Questions of three choices between runs of dialogue, looping back to the start.
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "The corridor goes on.";
+		if (i % 3 == 0) {
+			dial.IsDialogue = false;
+			for (size_t k = 1; k <= 3; ++k) {
+				dial.Choices[(i + k * 7) % nodes] = "Go on";
+			}
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+	// 0 would end the story.
+	for (auto &[id, dial] : story) {
+		if (dial->IsDialogue && dial->NextID == 0) EditNode(story, id).NextID = 1;
+		if (!dial->IsDialogue && dial->Choices.count(0)) {
+			Dialogue &edited = EditNode(story, id);
+			edited.Choices[1] = edited.Choices[0];
+			edited.Choices.erase(0);
+			edited.TotalChoices = edited.Choices.size();
+		}
+	}
+	return story;
+}
+
+enum Mode { Off, Sharded, Shared };
+const char *const modes[] = {"off", "sharded", "shared atomics"};
+
+// Steps per second on each thread, on average.
+double Run(const CompiledStory &story, Mode mode, size_t threads, size_t steps) {
+	Analytics analytics(story);
+	std::unique_ptr<std::atomic<uint64_t>[]> shared(new std::atomic<uint64_t>[story.Size()]());
+
+	auto play = [&](size_t seed) {
+		if (mode == Sharded) analytics.Attach();
+		std::mt19937 random(seed);
+		Playthrough playthrough = Play(story, seed);
+		for (size_t step = 0; step < steps; ++step) {
+			const CompiledStory::Node &node = story[playthrough.Current().node];
+			size_t choice = node.automatic ? 0 : story.ChoicesBegin(node)[random() % node.choiceCount].id;
+			// Going back now and then keeps the history from growing without end.
+			const Turn &turn = step % 64 == 63 ? playthrough.Back(63) : playthrough.Choose(choice);
+			if (mode == Shared) shared[turn.node].fetch_add(1, std::memory_order_relaxed);
+		}
+		Analytics::Detach();
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> running;
+	for (size_t i = 0; i < threads; ++i) {
+		running.emplace_back(play, i + 1);
+	}
+	for (auto &thread : running) {
+		thread.join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return steps / seconds;
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t steps = argc > 1 ? atol(argv[1]) : 5000000;
+	size_t most = argc > 2 ? atol(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+	CompiledStory story(Generate(3000));
+	printf("%zu steps per thread, %zu nodes\n", steps, story.Size());
+	for (size_t threads = 1; threads <= most; threads *= 2) {
+		for (Mode mode : {Off, Sharded, Shared}) {
+			printf("%2zu threads, %-15s %7.1f M steps/s per thread\n", threads, modes[mode], Run(story, mode, threads, steps) / 1e6);
+		}
+	}
+	return 0;
+}
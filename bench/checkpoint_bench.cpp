@@ -0,0 +1,174 @@
+// Checkpoints every step of many playthroughs into one save file, from a
+// few threads at once, then restores every slot and checks it plays on.
+// Usage: checkpoint_bench [-j threads] [-n sessions per thread]
+//                         [-d lazy|interval|always] [steps per thread] savefile
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "playthrough.h"
+#include "savefile.h"
+
+namespace {
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "Lorem ipsum dolor sit amet";
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = i % 101 == 100 ? 0 : (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Timing {
+	double encode = 0;
+	std::vector<float> checkpoints;
+	size_t bytes = 0;
+};
+
+void Run(const CompiledStory &story, SaveFile &saves, size_t first, size_t sessions, size_t steps, Timing &timing) {
+	std::mt19937 random(first);
+	std::vector<Playthrough> plays;
+	for (size_t i = 0; i < sessions; ++i) {
+		plays.push_back(Play(story));
+	}
+
+	std::string record;
+	timing.checkpoints.reserve(steps);
+	for (size_t step = 0; step < steps; ++step) {
+		size_t slot = step % sessions;
+		Playthrough &play = plays[slot];
+		const CompiledStory::Node &node = story[play.Current().node];
+
+		size_t choice = 0;
+		if (!node.isDialogue) {
+			choice = story.ChoicesBegin(node)[random() % node.choiceCount].id;
+		}
+		if (play.Choose(choice).result == StepResult::TheEnd) {
+			play = Play(story);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		EncodeSession(story, play.State(), record);
+		timing.encode += Since(start);
+		timing.bytes += record.size();
+
+		start = std::chrono::steady_clock::now();
+		saves.Checkpoint(first + slot, record);
+		timing.checkpoints.push_back(Since(start));
+	}
+}
+
+}
+
+int main(int argc, char **argv) {
+	int threads = 4;
+	size_t sessions = 1000;
+	size_t steps = 200000;
+	SaveFile::Durability durability = SaveFile::Interval;
+	int arg = 1;
+
+	for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+		if (strcmp(argv[arg], "-j") == 0) {
+			threads = std::max(1, atoi(argv[arg + 1]));
+		} else if (strcmp(argv[arg], "-n") == 0) {
+			sessions = std::max(1, atoi(argv[arg + 1]));
+		} else if (strcmp(argv[arg], "-d") == 0) {
+			durability = strcmp(argv[arg + 1], "lazy") == 0 ? SaveFile::Lazy
+				: strcmp(argv[arg + 1], "always") == 0 ? SaveFile::Always : SaveFile::Interval;
+		} else {
+			break;
+		}
+	}
+	if (argc - arg == 2) {
+		steps = atol(argv[arg++]);
+	}
+	if (argc - arg != 1) {
+		fprintf(stderr, "Usage: %s [-j threads] [-n sessions] [-d lazy|interval|always] [steps] savefile\n", argv[0]);
+		return 2;
+	}
+
+	Story source = Generate(10000);
+	CompiledStory story(source);
+	unlink(argv[arg]);
+
+	std::vector<Timing> timings(threads);
+	auto start = std::chrono::steady_clock::now();
+	size_t fileSize;
+	{
+		SaveFile saves(argv[arg], durability);
+		std::vector<std::thread> running;
+		for (int i = 0; i < threads; ++i) {
+			running.emplace_back(Run, std::cref(story), std::ref(saves), i * sessions, sessions, steps, std::ref(timings[i]));
+		}
+		for (auto &thread : running) {
+			thread.join();
+		}
+		fileSize = saves.Size();
+	}
+	double total = Since(start);
+
+	std::vector<float> checkpoints;
+	double encode = 0;
+	size_t bytes = 0;
+	for (Timing &timing : timings) {
+		checkpoints.insert(checkpoints.end(), timing.checkpoints.begin(), timing.checkpoints.end());
+		encode += timing.encode;
+		bytes += timing.bytes;
+	}
+	std::sort(checkpoints.begin(), checkpoints.end());
+	size_t count = checkpoints.size();
+	double sum = 0;
+	for (float time : checkpoints) sum += time;
+
+	printf("%zu checkpoints from %d threads in %.2f s: %.0f/s, %.1f bytes each\n",
+		count, threads, total / 1e6, count / (total / 1e6), double(bytes) / count);
+	printf("encode     %.3f us\n", encode / count);
+	printf("checkpoint %.3f us mean, %.3f us p50, %.3f us p99\n",
+		sum / count, checkpoints[count / 2], checkpoints[count * 99 / 100]);
+
+	// Opening again scans the file and drops the overwritten records.
+	start = std::chrono::steady_clock::now();
+	SaveFile saves(argv[arg], SaveFile::Lazy);
+	printf("reopen     %.1f ms, %zu slots, %.1f MB appended, %.1f MB after compaction\n",
+		Since(start) / 1e3, saves.Slots(), fileSize / 1e6, saves.Size() / 1e6);
+
+	std::string record;
+	size_t restored = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t slot = 0; slot < threads * sessions; ++slot) {
+		Session session;
+		if (saves.Restore(slot, record) && DecodeSession(story, record, session)) {
+			Playthrough play = Play(story, std::move(session));
+			restored += play.Choose(0).result != StepResult::MissingNode;
+		}
+	}
+	printf("restore    %.3f us per slot, %zu of %zu restored\n",
+		Since(start) / (threads * sessions), restored, threads * sessions);
+}
@@ -0,0 +1,113 @@
+// Many timed sessions on one thread: every player is idle, so each question
+// runs out and takes its default, which leads to the next timed question.
+// The thread waits in epoll on one Deadlines; reports how late deadlines
+// were acted on, how often the thread woke, and the CPU it used against
+// the time it ran, with the timer going off for each deadline and at most
+// once per resolution.
+// Usage: deadline_bench [sessions] [seconds] [resolution in microseconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "playthrough.h"
+#include "deadlines.h"
+
+namespace {
+
+// A ring of questions with time limits from 0.2 to 1 s.
+Story Generate(size_t nodes) {
+	Story story;
+	std::mt19937 random(5);
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.IsDialogue = false;
+		dial.Text = "Decide.";
+		dial.Choices[(i + 1) % nodes] = "Left";
+		dial.Choices[(i + 2) % nodes] = "Right";
+		dial.TotalChoices = dial.Choices.size();
+		dial.TimeLimit = 0.2 + (random() % 801) / 1000.0;
+		dial.DefaultChoice = (i + 1) % nodes;
+	}
+	return story;
+}
+
+double CpuSeconds() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? atol(argv[1]) : 100000;
+	double seconds = argc > 2 ? atof(argv[2]) : 3;
+	int64_t resolution = argc > 3 ? atol(argv[3]) * 1000 : 1000000;
+
+	CompiledStory story(Generate(997));
+	Deadlines deadlines(resolution);
+	std::vector<Playthrough> sessions;
+	std::vector<int64_t> due(count);
+	sessions.reserve(count);
+	// Spread over the nodes, so deadlines do not all fall together.
+	std::mt19937 random(7);
+	for (size_t i = 0; i < count; ++i) {
+		Session session;
+		StartSession(story, session);
+		session.node = random() % story.Size();
+		sessions.push_back(Play(story, std::move(session)));
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const Turn &turn = sessions[i].Current();
+		due[i] = Deadlines::In(story[turn.node].timeLimit);
+		deadlines.Add(i, turn.arrival, due[i]);
+	}
+
+	int epollFd = epoll_create1(0);
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, deadlines.Fd(), &event);
+
+	std::vector<int64_t> late;
+	size_t wakeups = 0;
+	double cpu = CpuSeconds();
+	int64_t start = Deadlines::Now(), end = start + int64_t(seconds * 1e9);
+	while (Deadlines::Now() < end) {
+		epoll_event events[1];
+		if (epoll_wait(epollFd, events, 1, 100) <= 0) {
+			continue;
+		}
+		++wakeups;
+		deadlines.Expire([&](uint64_t key, uint64_t arrival) {
+			Playthrough &play = sessions[key];
+			if (play.Current().arrival != arrival) {
+				return;
+			}
+			late.push_back(Deadlines::Now() - due[key]);
+			const Turn &turn = play.Choose(story[play.Current().node].defaultChoice);
+			due[key] = Deadlines::In(story[turn.node].timeLimit);
+			deadlines.Add(key, turn.arrival, due[key]);
+		});
+	}
+	double wall = (Deadlines::Now() - start) / 1e9;
+	cpu = CpuSeconds() - cpu;
+
+	std::sort(late.begin(), late.end());
+	auto at = [&](double q) { return late.empty() ? 0.0 : late[size_t(q * (late.size() - 1))] / 1e3; };
+	printf("%zu sessions, resolution %.3f ms: %zu deadlines in %.2f s, %zu wakeups (%.1f per wakeup)\n",
+		count, resolution / 1e6, late.size(), wall, wakeups, double(late.size()) / std::max<size_t>(wakeups, 1));
+	printf("late by: median %.1f us, 99%% %.1f us, 99.9%% %.1f us, max %.1f us\n", at(0.5), at(0.99), at(0.999), at(1));
+	printf("cpu: %.3f s of %.2f s (%.1f%%), %.2f us per deadline\n", cpu, wall, 100 * cpu / wall, cpu * 1e6 / std::max<size_t>(late.size(), 1));
+	close(epollFd);
+	return 0;
+}
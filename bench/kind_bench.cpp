@@ -0,0 +1,124 @@
+// Steps through stories made of one kind of node each, the built-in kinds
+// next to plugin kinds doing the same work through the C interface, to show
+// what going through the kind table and a plugin costs. With a plugin
+// given, also through its "dice 7" nodes.
+// Usage: kind_bench [steps] [plugin.so]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <string>
+
+#include "story.h"
+#include "compiled.h"
+#include "nodekinds.h"
+#include "session.h"
+
+namespace {
+
+uint32_t First(void *, const StoryNodeCall *) {
+	return 0;
+}
+
+// What a random node of even weights does.
+uint32_t Even(void *, const StoryNodeCall *call) {
+	return ((call->random >> 32) * call->choice_count) >> 32;
+}
+
+// A ring of nodes, all of the kind given, each leading to the next two; node
+// 0 only starts it, as NextID 0 would end the story.
+Story Generate(size_t nodes, bool dialogue, bool random, const std::string &kind) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "Lorem ipsum dolor sit amet";
+		dial.IsDialogue = dialogue;
+		dial.IsRandom = random;
+		dial.Kind = kind;
+		if (dialogue) {
+			dial.NextID = 1 + i % (nodes - 1);
+		} else {
+			dial.Choices[1 + i % (nodes - 1)] = "Go on";
+			dial.Choices[1 + (i + 1) % (nodes - 1)] = "Skip one";
+			dial.TotalChoices = dial.Choices.size();
+		}
+	}
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Started over now and then, as the history only grows.
+double Round(const CompiledStory &story, size_t steps) {
+	Session session;
+	StartSession(story, session, 42);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < steps; ++i) {
+		if (i % 100000 == 0) {
+			StartSession(story, session, 42);
+		}
+		const CompiledStory::Node &node = story[session.node];
+		if (Step(story, session, node.automatic ? 0 : story.ChoicesBegin(node)->id) != StepResult::Moved) {
+			fprintf(stderr, "Stuck at node %zu\n", node.id);
+			exit(1);
+		}
+	}
+	return Since(start) / steps;
+}
+
+// The best of a few rounds, as a step takes only tens of nanoseconds.
+double Play(const CompiledStory &story, size_t steps) {
+	double best = HUGE_VAL;
+	for (int round = 0; round < 5; ++round) {
+		best = std::min(best, Round(story, steps));
+	}
+	return best;
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t steps = argc > 1 ? atol(argv[1]) : 10000000;
+	const size_t nodes = 1000;
+
+	try {
+		NodeKinds kinds;
+		kinds.Add({"first", First, nullptr});
+		kinds.Add({"even", Even, nullptr});
+		if (argc > 2) {
+			kinds.Load(argv[2]);
+		}
+
+		struct {
+			const char *name;
+			bool dialogue, random;
+			const char *kind;
+		} runs[] = {
+			{"dialogue", true, false, ""},
+			{"question, first choice", false, false, ""},
+			{"plugin, first choice", false, false, "first"},
+			{"random, even weights", false, true, ""},
+			{"plugin, even odds", false, false, "even"},
+			{"plugin from library, dice 7", false, false, "dice 7"},
+		};
+		for (auto &run : runs) {
+			if (run.kind == std::string("dice 7") && argc <= 2) {
+				continue;
+			}
+			Story source = Generate(nodes, run.dialogue, run.random, run.kind);
+			CompiledStory story(source, &kinds);
+			printf("%-30s %.1f ns per step\n", run.name, Play(story, steps));
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+// Hosts a story in 12 languages two ways: a compiled copy of the story per
+// language, and one story with a mapped string table per language (see
+// Languages). Sessions in random languages then play a while, switching
+// language now and then; resident memory is measured after each.
+// Usage: language_bench [nodes] [sessions]
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "languages.h"
+#include "session.h"
+
+namespace {
+
+const char *const codes[] = {"en", "fr", "de", "es", "it", "pt", "nl", "pl", "sv", "ja", "ko", "zh"};
+const size_t LanguageCount = sizeof(codes) / sizeof(codes[0]);
+
+// Every fourth node a question of three choices, the others dialogue; the
+// text differs in length by language.
+Story Generate(size_t nodes, size_t language) {
+	std::mt19937 random(7);
+	std::string words = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. ";
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = std::string(codes[language]) + ": ";
+		for (size_t n = 2 + random() % 3 + language % 3; n > 0; --n) dial.Text += words;
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = std::string(codes[language]) + ": go on";
+			dial.Choices[(i + 1 + random() % 50) % nodes] = std::string(codes[language]) + ": take the long way round";
+			dial.Choices[(i + 1 + random() % 500) % nodes] = std::string(codes[language]) + ": turn back";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = i + 1 < nodes ? i + 1 : 1;
+		}
+	}
+	return story;
+}
+
+double Resident() {
+	malloc_trim(0);
+	long pages = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+		fclose(statm);
+	}
+	return resident * double(sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+// Sessions in random languages, each switching once along the way; what
+// they render goes nowhere. Returns the nodes reached.
+size_t Play(const CompiledStory &story, size_t sessions, size_t steps, std::vector<const StringTable *> &tables) {
+	std::mt19937 random(42);
+	std::string out;
+	std::vector<bool> reached(story.Size());
+	for (size_t i = 0; i < sessions; ++i) {
+		Session session;
+		StartSession(story, session);
+		const StringTable *language = tables[random() % tables.size()];
+		for (size_t step = 0; step < steps; ++step) {
+			if (step == steps / 2) {
+				language = tables[random() % tables.size()];
+			}
+			out.clear();
+			out += story.Json(session.node, language);
+			reached[session.node] = true;
+			const CompiledStory::Node &node = story[session.node];
+			Step(story, session, node.isDialogue ? 0 : story.ChoicesBegin(node)[random() % node.choiceCount].id);
+		}
+	}
+	size_t count = 0;
+	for (bool node : reached) count += node;
+	return count;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t nodes = argc > 1 ? atol(argv[1]) : 20000;
+	size_t sessions = argc > 2 ? atol(argv[2]) : 1000;
+	const size_t steps = 40;
+	std::string base = "/tmp/language_bench";
+
+	double start = Resident();
+	{
+		std::vector<std::unique_ptr<CompiledStory>> copies;
+		for (size_t language = 0; language < LanguageCount; ++language) {
+			copies.push_back(std::make_unique<CompiledStory>(Generate(nodes, language)));
+		}
+		double built = Resident();
+		std::vector<const StringTable *> own = {nullptr};
+		for (size_t language = 0; language < LanguageCount; ++language) {
+			Play(*copies[language], sessions / LanguageCount, steps, own);
+		}
+		printf("12 copies:           %7.1f MB built, %7.1f MB after play\n", built - start, Resident() - start);
+	}
+
+	// The tables are written first, as a build would.
+	CompiledStory story(Generate(nodes, 0));
+	for (size_t language = 1; language < LanguageCount; ++language) {
+		StringTable::Storage strings;
+		size_t untranslated;
+		story.Translate(Generate(nodes, language), strings, untranslated);
+		SaveStrings(base + "." + codes[language] + ".strings", story, strings);
+	}
+
+	start = Resident();
+	CompiledStory shared(Generate(nodes, 0));
+	double graph = Resident() - start;
+	{
+		Languages languages(shared, base);
+		std::vector<const StringTable *> tables = {nullptr};
+		for (size_t language = 1; language < LanguageCount; ++language) {
+			tables.push_back(languages.Find(codes[language]));
+		}
+		double mapped = Resident() - start;
+		size_t reached = Play(shared, sessions, steps, tables);
+		printf("1 story + 11 tables: %7.1f MB built (%.1f story, %.1f tables), %7.1f MB after play, %zu of %zu nodes reached\n",
+			mapped, graph, mapped - graph, Resident() - start, reached, nodes);
+
+		// Switching is only another pointer.
+		std::string out;
+		size_t renders = 10000000;
+		auto begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < renders; ++i) {
+			out.clear();
+			out += shared.Json(i % 64, tables[0]);
+		}
+		double same = Since(begin) / renders;
+		begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < renders; ++i) {
+			out.clear();
+			out += shared.Json(i % 64, tables[i % LanguageCount]);
+		}
+		printf("render: %.1f ns in one language, %.1f ns switching on every node\n", same, Since(begin) / renders);
+	}
+
+	for (size_t language = 1; language < LanguageCount; ++language) {
+		unlink((base + "." + codes[language] + ".strings").c_str());
+	}
+	return 0;
+}
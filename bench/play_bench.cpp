@@ -0,0 +1,115 @@
+// Drives many playthrough coroutines from one thread, round robin, making
+// random choices and starting over at the end of the story.
+// Usage: play_bench [sessions] [steps]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "playthrough.h"
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+}
+
+void *operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "Lorem ipsum dolor sit amet";
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			// Every so often the story ends and the session starts over.
+			dial.NextID = i % 101 == 100 ? 0 : (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t sessions = argc > 1 ? atol(argv[1]) : 50000;
+	size_t steps = argc > 2 ? atol(argv[2]) : 10000000;
+
+	Story source = Generate(10000);
+	CompiledStory story(source);
+	std::mt19937 random(42);
+
+	size_t before = allocations;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<Playthrough> plays;
+	plays.reserve(sessions);
+	for (size_t i = 0; i < sessions; ++i) {
+		plays.push_back(Play(story));
+	}
+	printf("%zu sessions started: %.1f ns and %.2f allocations each\n",
+		sessions, Since(start) / sessions, double(allocations - before) / sessions);
+
+	before = allocations;
+	start = std::chrono::steady_clock::now();
+	size_t restarts = 0;
+	for (size_t step = 0; step < steps; ++step) {
+		Playthrough &play = plays[step % sessions];
+		const CompiledStory::Node &node = story[play.Current().node];
+
+		size_t choice = 0;
+		if (!node.isDialogue) {
+			choice = story.ChoicesBegin(node)[random() % node.choiceCount].id;
+		}
+		if (play.Choose(choice).result == StepResult::TheEnd) {
+			play = Play(story);
+			++restarts;
+		}
+	}
+	printf("%zu steps: %.1f ns and %.4f allocations each, %zu restarts\n",
+		steps, Since(start) / steps, double(allocations - before) / steps, restarts);
+
+	// Completion of every session, as the progress requests count it.
+	start = std::chrono::steady_clock::now();
+	size_t visited = 0;
+	Bitset seen(story.Size());
+	for (const Playthrough &play : plays) {
+		visited += play.State().visited.Count();
+		seen |= play.State().visited;
+	}
+	printf("progress: %.1f ns per session, %.1f nodes visited on average, %zu by any\n",
+		Since(start) / sessions, double(visited) / sessions, seen.Count());
+}
@@ -0,0 +1,104 @@
+// Draws from a random node with many weighted outcomes, through the alias
+// table and through whole steps of a session, next to a walk over the
+// running sum of the weights, and checks the draws follow the weights.
+// Usage: random_bench [outcomes] [draws]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "session.h"
+
+namespace {
+
+// Node 0 draws one of the outcomes, each of which leads back to it.
+Story Generate(size_t outcomes, std::vector<double> &weights) {
+	std::mt19937 random(42);
+	Story story;
+	Dialogue &branch = EditNode(story, 0);
+	branch.ID = 0;
+	branch.IsDialogue = false;
+	branch.IsRandom = true;
+	branch.Text = "Something happens";
+	for (size_t i = 1; i <= outcomes; ++i) {
+		double weight = 1 + random() % 1000;
+		branch.Choices[i] = "Outcome " + std::to_string(i);
+		branch.Weights[i] = weight;
+		weights.push_back(weight);
+
+		// Loops back through a choice, as NextID 0 would end the story.
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.IsDialogue = false;
+		dial.Text = "It happened";
+		dial.Choices[0] = "Again";
+		dial.TotalChoices = 1;
+	}
+	branch.TotalChoices = branch.Choices.size();
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t outcomes = argc > 1 ? atol(argv[1]) : 500;
+	size_t draws = argc > 2 ? atol(argv[2]) : 10000000;
+
+	std::vector<double> weights;
+	Story source = Generate(outcomes, weights);
+	CompiledStory story(source);
+	const CompiledStory::Node &branch = story[story.Start()];
+
+	std::mt19937_64 random(7);
+	std::vector<size_t> counts(outcomes);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < draws; ++i) {
+		++counts[story.Sample(branch, random()) - branch.firstChoice];
+	}
+	printf("alias table: %.1f ns per draw of %zu outcomes\n", Since(start) / draws, outcomes);
+
+	// The largest gap between what came up and what the weights say, in
+	// standard deviations of a binomial count.
+	double total = 0;
+	for (double weight : weights) total += weight;
+	double worst = 0;
+	for (size_t i = 0; i < outcomes; ++i) {
+		double p = weights[i] / total;
+		worst = std::max(worst, fabs(counts[i] - p * draws) / sqrt(draws * p * (1 - p)));
+	}
+	printf("worst outcome %.2f standard deviations off its weight\n", worst);
+
+	std::vector<double> running(outcomes);
+	std::partial_sum(weights.begin(), weights.end(), running.begin());
+	size_t sum = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < draws; ++i) {
+		double at = (random() >> 11) * 0x1.0p-53 * total;
+		sum += std::upper_bound(running.begin(), running.end(), at) - running.begin();
+	}
+	printf("binary search over running sums: %.1f ns per draw (%zu)\n", Since(start) / draws, sum % 10);
+
+	// Two steps per draw: the random node, then back to it.
+	Session session;
+	StartSession(story, session, 7);
+	size_t steps = std::min<size_t>(draws, 1000000);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < steps; ++i) {
+		Step(story, session, 0);
+		Step(story, session, 0);
+	}
+	printf("session step through the random node and back: %.1f ns\n", Since(start) / steps);
+	return 0;
+}
@@ -0,0 +1,166 @@
+// Measures sending a node per step of a playthrough: formatting it into a
+// fresh string as the engine used to, against writing its pre-rendered
+// fragments. Both write to /dev/null, one write per step.
+// Usage: render_bench [steps] [text bytes per node]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "output.h"
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+}
+
+void *operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+
+Story Generate(size_t nodes, size_t textSize) {
+	Story story;
+	std::string text;
+	for (size_t i = 0; i < textSize; ++i) {
+		text += "Lorem ipsum \"dolor\" sit amet,\n"[i % 31];
+	}
+
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = text;
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+// What the engine used to do for each node it sent.
+std::string FormatConsole(const CompiledStory &story, uint32_t position) {
+	const CompiledStory::Node &node = story[position];
+	std::string out = std::string(node.text) + "\n";
+	for (auto choice = story.ChoicesBegin(node); choice != story.ChoicesEnd(node); ++choice) {
+		out += std::to_string(choice->id) + " -> " + std::string(choice->text) + "\n";
+	}
+	return out;
+}
+
+std::string Escape(std::string_view text) {
+	std::string out = "\"";
+	for (char c : text) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		default: out += c; break;
+		}
+	}
+	return out + "\"";
+}
+
+std::string FormatJson(const CompiledStory &story, uint32_t position) {
+	const CompiledStory::Node &node = story[position];
+	std::string out = "{\"ID\":" + std::to_string(node.id) + ",\"Text\":" + Escape(node.text);
+	if (node.isDialogue) {
+		if (node.next == CompiledStory::End) out += ",\"End\":true";
+	} else {
+		out += ",\"Choices\":[";
+		for (auto choice = story.ChoicesBegin(node); choice != story.ChoicesEnd(node); ++choice) {
+			if (choice != story.ChoicesBegin(node)) out += ',';
+			out += "{\"NextID\":" + std::to_string(choice->id) + ",\"Text\":" + Escape(choice->text) + "}";
+		}
+		out += ']';
+	}
+	return out + "}\n";
+}
+
+void Report(const char *name, std::chrono::steady_clock::time_point start, size_t allocated, size_t steps) {
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	printf("%-20s %8.1f ns/step %8.2f allocations/step\n", name, ns / steps, (double)allocated / steps);
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t steps = argc > 1 ? atol(argv[1]) : 1000000;
+	size_t textSize = argc > 2 ? atol(argv[2]) : 200;
+
+	Story source = Generate(10000, textSize);
+	CompiledStory story(source);
+
+	std::vector<uint32_t> walk;
+	walk.reserve(steps);
+	std::mt19937 random(42);
+	for (size_t i = 0; i < steps; ++i) {
+		walk.push_back(random() % story.Size());
+	}
+
+	int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	auto measure = [&](const char *name, auto send) {
+		size_t before = allocations;
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t node : walk) {
+			send(node);
+		}
+		Report(name, start, allocations - before, steps);
+	};
+
+	measure("console formatted", [&](uint32_t node) {
+		std::string out = FormatConsole(story, node);
+		ssize_t written = write(fd, out.data(), out.size());
+		(void)written;
+	});
+
+	OutputQueue out;
+	measure("console fragments", [&](uint32_t node) {
+		out.Reference(story.ConsoleText(node));
+		out.Reference(story.ConsoleChoices(node));
+		out.Flush(fd);
+	});
+
+	measure("json formatted", [&](uint32_t node) {
+		std::string out = FormatJson(story, node);
+		ssize_t written = write(fd, out.data(), out.size());
+		(void)written;
+	});
+
+	measure("json fragments", [&](uint32_t node) {
+		out.Reference(story.Json(node));
+		out.Text() += '\n';
+		out.Flush(fd);
+	});
+
+	close(fd);
+}
@@ -0,0 +1,86 @@
+// Plays one long session, then jumps back random distances and plays on
+// from there, each time starting a new branch that shares what came before.
+// Usage: rewind_bench [steps] [rewinds]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+
+#include "story.h"
+#include "compiled.h"
+#include "session.h"
+
+namespace {
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "Lorem ipsum dolor sit amet";
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Random choices; the story never ends.
+void Play(const CompiledStory &story, Session &session, size_t steps, std::mt19937 &random) {
+	for (size_t i = 0; i < steps; ++i) {
+		const CompiledStory::Node &node = story[session.node];
+		size_t choice = node.isDialogue ? 0 : story.ChoicesBegin(node)[random() % node.choiceCount].id;
+		Step(story, session, choice);
+	}
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t steps = argc > 1 ? atol(argv[1]) : 10000;
+	size_t rewinds = argc > 2 ? atol(argv[2]) : 1000;
+
+	Story source = Generate(10000);
+	CompiledStory story(source);
+	std::mt19937 random(42);
+
+	Session session;
+	StartSession(story, session);
+	auto start = std::chrono::steady_clock::now();
+	Play(story, session, steps, random);
+	printf("%zu steps: %.1f ns each, history %zu bytes, %.1f bytes per step\n",
+		steps, Since(start) / steps, session.history.Bytes(), double(session.history.Bytes()) / steps);
+
+	double back = 0;
+	size_t replayed = 0;
+	for (size_t i = 0; i < rewinds; ++i) {
+		size_t distance = 1 + random() % session.history.Depth();
+		start = std::chrono::steady_clock::now();
+		StepResult result = StepBack(session, distance);
+		back += Since(start);
+		if (result != StepResult::Moved) {
+			fprintf(stderr, "Cannot go back %zu steps\n", distance);
+			return 1;
+		}
+
+		// Back to the same depth down another branch.
+		Play(story, session, distance, random);
+		replayed += distance;
+	}
+	printf("%zu rewinds of %.0f steps on average: %.1f ns each\n", rewinds, double(replayed) / rewinds, back / rewinds);
+	printf("%zu entries on every branch, %.1f MB\n", session.history.Entries(), session.history.Bytes() / 1e6);
+}
@@ -0,0 +1,96 @@
+// Measures SaveStory() throughput on a generated story.
+// Usage: save_bench [nodes] [text bytes per node]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+
+#include "story.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+Story Generate(size_t nodes, size_t textSize) {
+	Story story;
+	std::string text;
+	for (size_t i = 0; i < textSize; ++i) {
+		text += "Lorem ipsum \"dolor\" sit amet,\n"[i % 31];
+	}
+
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = text;
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+// What SaveStory used to do: build the whole document, then dump it.
+void SaveDom(const std::string &filename, const Story &story) {
+	json data = json::array();
+	for (auto &[id, node] : story) {
+		json element;
+		element["ID"] = node->ID;
+		element["Text"] = node->Text;
+		element["IsDialogue"] = node->IsDialogue;
+		if (node->IsDialogue) {
+			element["NextID"] = node->NextID;
+		} else {
+			size_t j = 0;
+			element["TotalChoices"] = node->Choices.size();
+			for (auto &[nextID, text] : node->Choices) {
+				element["Choices"][std::to_string(j)]["NextID"] = nextID;
+				element["Choices"][std::to_string(j)]["Text"] = text;
+				++j;
+			}
+		}
+		data.push_back(std::move(element));
+	}
+
+	std::ofstream outputFile(filename);
+	outputFile << std::setw(4) << data << std::endl;
+}
+
+template<typename F>
+void Run(const char *name, const std::string &filename, F save) {
+	auto start = std::chrono::steady_clock::now();
+	save();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	double megabytes = file.tellg() / (1024.0 * 1024.0);
+
+	printf("%-10s %8.1f MB %8.3f s %8.1f MB/s\n", name, megabytes, seconds, megabytes / seconds);
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t nodes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+	size_t textSize = argc > 2 ? strtoull(argv[2], nullptr, 10) : 256;
+	std::string filename = "save_bench.json";
+
+	Story story = Generate(nodes, textSize);
+
+	Run("dom", filename, [&]() { SaveDom(filename, story); });
+	Run("pretty", filename, [&]() { SaveStory(filename, story, nullptr, true); });
+	Run("compact", filename, [&]() { SaveStory(filename, story, nullptr, false); });
+
+	remove(filename.c_str());
+}
@@ -0,0 +1,327 @@
+// Load generator for story_engine -s or -p: keeps the given number of
+// sessions playing through random choices, restarting those that reach the
+// end. The sessions of a connection all have a request in flight, so over
+// HTTP sessions / connections is the pipelining depth.
+// Usage: story_load [-c connections] [-n sessions] [-d seconds] <socket | port> [story.json]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Player {
+	size_t session = 0;
+	bool started = false;
+	Clock::time_point sent;
+};
+
+struct Connection {
+	int fd;
+	std::vector<Player> players;
+	// Requests are answered in order, so this says whose answer comes next.
+	std::deque<uint32_t> waiting;
+	std::string in;
+	std::string out;
+};
+
+class Load {
+public:
+	Load(const CompiledStory &story) : story(story), random(42) {}
+
+	// A target made of digits is a local HTTP port, anything else a socket path.
+	void Connect(const std::string &target, size_t connections, size_t sessions) {
+		http = target.find_first_not_of("0123456789") == std::string::npos;
+
+		sockaddr_un unixAddress = {};
+		unixAddress.sun_family = AF_UNIX;
+		strncpy(unixAddress.sun_path, target.c_str(), sizeof(unixAddress.sun_path) - 1);
+		sockaddr_in tcpAddress = {};
+		tcpAddress.sin_family = AF_INET;
+		tcpAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (http) tcpAddress.sin_port = htons(atoi(target.c_str()));
+
+		sockaddr *address = http ? (sockaddr *)&tcpAddress : (sockaddr *)&unixAddress;
+		socklen_t addressSize = http ? sizeof(tcpAddress) : sizeof(unixAddress);
+
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		for (size_t i = 0; i < connections; ++i) {
+			Connection conn;
+			conn.fd = socket(address->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (conn.fd < 0 || connect(conn.fd, address, addressSize) < 0) {
+				throw std::runtime_error("Cannot connect to " + target + ": " + strerror(errno));
+			}
+			int on = 1;
+			if (http) setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			conn.players.resize(sessions / connections + (i < sessions % connections));
+			conns.push_back(std::move(conn));
+		}
+
+		for (size_t i = 0; i < conns.size(); ++i) {
+			epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.u64 = i;
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].fd, &event);
+
+			for (uint32_t player = 0; player < conns[i].players.size(); ++player) {
+				Send(conns[i], player, Start());
+			}
+			Flush(conns[i]);
+		}
+	}
+
+	// Runs until every session has started, then for the given time.
+	void Run(double seconds) {
+		size_t sessions = 0;
+		for (auto &conn : conns) sessions += conn.players.size();
+
+		auto started = Clock::now();
+		while (established < sessions) {
+			Poll();
+		}
+		fprintf(stderr, "%zu sessions over %zu connections started in %.2f s\n",
+			sessions, conns.size(), std::chrono::duration<double>(Clock::now() - started).count());
+
+		measuring = true;
+		started = Clock::now();
+		auto end = started + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+		while (Clock::now() < end) {
+			Poll();
+		}
+		double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&](double p) {
+			return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, size_t(latencies.size() * p))];
+		};
+		printf("%zu requests in %.2f s: %.0f requests/s, %zu errors\n",
+			latencies.size(), elapsed, latencies.size() / elapsed, errors);
+		printf("latency p50 %.3f ms, p99 %.3f ms\n", percentile(0.5), percentile(0.99));
+	}
+
+private:
+	void Send(Connection &conn, uint32_t player, const std::string &request) {
+		conn.out += request;
+		conn.waiting.push_back(player);
+		conn.players[player].sent = Clock::now();
+	}
+
+	void Flush(Connection &conn) {
+		size_t sent = 0;
+		while (sent < conn.out.size()) {
+			ssize_t n = send(conn.fd, conn.out.data() + sent, conn.out.size() - sent, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				throw std::runtime_error(std::string("Cannot send: ") + strerror(errno));
+			}
+			sent += n;
+		}
+		conn.out.clear();
+	}
+
+	void Poll() {
+		epoll_event events[64];
+		int n = epoll_wait(epollFd, events, 64, 100);
+		for (int i = 0; i < n; ++i) {
+			Connection &conn = conns[events[i].data.u64];
+
+			char buffer[1 << 16];
+			ssize_t got = recv(conn.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+			if (got <= 0) {
+				if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+				throw std::runtime_error("Server closed the connection");
+			}
+			conn.in.append(buffer, got);
+
+			size_t start = 0;
+			size_t size;
+			while ((size = Complete(conn.in, start))) {
+				Answered(conn, std::string_view(conn.in).substr(start, size));
+				start += size;
+			}
+			conn.in.erase(0, start);
+			Flush(conn);
+		}
+	}
+
+	// Size of the answer starting at in[start], 0 until it is all there.
+	size_t Complete(const std::string &in, size_t start) {
+		if (!http) {
+			size_t end = in.find('\n', start);
+			return end == std::string::npos ? 0 : end + 1 - start;
+		}
+
+		size_t headEnd = in.find("\r\n\r\n", start);
+		if (headEnd == std::string::npos) {
+			return 0;
+		}
+		size_t length = 0;
+		size_t header = in.find("Content-Length: ", start);
+		if (header < headEnd) {
+			length = strtoull(in.c_str() + header + 16, nullptr, 10);
+		}
+		size_t size = headEnd + 4 + length - start;
+		return in.size() - start >= size ? size : 0;
+	}
+
+	void Answered(Connection &conn, std::string_view answer) {
+		uint32_t index = conn.waiting.front();
+		conn.waiting.pop_front();
+		Player &player = conn.players[index];
+
+		if (measuring) {
+			latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - player.sent).count());
+		}
+
+		// What the answer says, in either protocol: a node, an ended
+		// session, or an error.
+		std::string_view node;
+		bool ended = false;
+		if (http) {
+			int status = atoi(answer.data() + 9);
+			size_t location = answer.find("Location: /sessions/");
+			if (location != std::string_view::npos) {
+				player.session = strtoull(answer.data() + location + 20, nullptr, 10);
+			}
+			if (status < 300) node = answer.substr(answer.find("\r\n\r\n") + 4);
+			ended = status == 204;
+		} else {
+			char *rest;
+			size_t session = strtoull(answer.data(), &rest, 10);
+			if (*rest == ' ') {
+				node = answer.substr(rest + 1 - answer.data());
+				if (node[0] == '{') player.session = session;
+				ended = node.substr(0, 3) == "BYE";
+				if (node[0] != '{') node = {};
+			}
+		}
+
+		std::string request;
+		if (node.substr(0, 6) == "{\"ID\":") {
+			if (!player.started) {
+				player.started = true;
+				++established;
+			}
+			request = Next(strtoull(node.data() + 6, nullptr, 10), player.session);
+		} else if (ended) {
+			request = Start();
+		} else {
+			++errors;
+			request = End(player.session);
+		}
+		Send(conn, index, request);
+	}
+
+	std::string Start() {
+		return http ? "POST /sessions HTTP/1.1\r\n\r\n" : "N\n";
+	}
+
+	std::string Choose(size_t session, const CompiledStory::Choice *choice) {
+		if (http) {
+			std::string path = "POST /sessions/" + std::to_string(session) + "/next";
+			if (choice) path += "/" + std::to_string(choice->id);
+			return path + " HTTP/1.1\r\n\r\n";
+		}
+		std::string line = "C " + std::to_string(session);
+		if (choice) line += " " + std::to_string(choice->id);
+		return line + "\n";
+	}
+
+	std::string End(size_t session) {
+		if (http) {
+			return "DELETE /sessions/" + std::to_string(session) + " HTTP/1.1\r\n\r\n";
+		}
+		return "Q " + std::to_string(session) + "\n";
+	}
+
+	// The request that plays on from node id, or ends the session there.
+	std::string Next(size_t id, size_t session) {
+		uint32_t position = story.Find(id);
+		if (position == CompiledStory::Missing) {
+			return End(session);
+		}
+
+		const CompiledStory::Node &node = story[position];
+		if (node.isDialogue) {
+			return node.next == CompiledStory::End ? End(session) : Choose(session, nullptr);
+		}
+		if (node.choiceCount == 0) {
+			return End(session);
+		}
+		return Choose(session, story.ChoicesBegin(node) + random() % node.choiceCount);
+	}
+
+	const CompiledStory &story;
+	std::mt19937 random;
+	bool http = false;
+	int epollFd = -1;
+	std::vector<Connection> conns;
+	size_t established = 0;
+	bool measuring = false;
+	size_t errors = 0;
+	std::vector<double> latencies;
+};
+
+}
+
+int main(int argc, char **argv) {
+	size_t connections = 64;
+	size_t sessions = 100000;
+	double seconds = 10;
+	int arg = 1;
+
+	for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+		if (strcmp(argv[arg], "-c") == 0) {
+			connections = std::max(1, atoi(argv[arg + 1]));
+		} else if (strcmp(argv[arg], "-n") == 0) {
+			sessions = std::max(1, atoi(argv[arg + 1]));
+		} else if (strcmp(argv[arg], "-d") == 0) {
+			seconds = atof(argv[arg + 1]);
+		} else {
+			break;
+		}
+	}
+	if (arg >= argc || argc - arg > 2 || argv[arg][0] == '-') {
+		fprintf(stderr, "Usage: %s [-c connections] [-n sessions] [-d seconds] <socket | port> [story.json]\n", argv[0]);
+		return 2;
+	}
+
+	std::string target = argv[arg];
+	std::string filename = arg + 1 < argc ? argv[arg + 1] : "story.json";
+
+	try {
+		Story source;
+		LoadStory(filename, source);
+		CompiledStory story(source);
+		source.clear();
+
+		Load load(story);
+		load.Connect(target, std::min(connections, sessions), sessions);
+		load.Run(seconds);
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,127 @@
+// Renders nodes with {variable} in their text for a session, counting heap
+// allocations, next to a find-and-replace on each render for comparison.
+// Exits with 1 if rendering into a buffer that has room allocates at all.
+// Usage: template_bench [renders]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include "story.h"
+#include "compiled.h"
+#include "session.h"
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+}
+
+void *operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "Day {day}, and the road goes on. You have {gold} gold and {arrows} arrows left, "
+			"{companions} companions, and a long way to go before night.";
+		dial.Effect = "day += 1; gold += 7; arrows -= 1";
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on ({gold} gold)";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.Choices[(i + 13) % nodes] = "Pay the ferryman {fare}";
+			dial.Conditions[(i + 13) % nodes] = "gold >= 10";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// What rendering would cost without segments: the text copied, and every
+// placeholder found and replaced, each time.
+void Replace(const CompiledStory &story, uint32_t node, const int64_t *registers, std::string &out) {
+	std::string text(story.ConsoleText(node));
+	const Script &script = story.Scripts();
+	for (size_t slot = 0; slot < script.Variables(); ++slot) {
+		std::string placeholder = "{" + script.VariableName(slot) + "}";
+		std::string value = std::to_string(registers[slot]);
+		for (size_t at = text.find(placeholder); at != std::string::npos; at = text.find(placeholder, at + value.size())) {
+			text.replace(at, placeholder.size(), value);
+		}
+	}
+	out += text;
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t renders = argc > 1 ? atol(argv[1]) : 1000000;
+
+	Story source = Generate(10000);
+	CompiledStory story(source);
+	Session session;
+	StartSession(story, session);
+	for (int i = 0; i < 50; ++i) {
+		Step(story, session, story.ChoicesBegin(story[session.node])->id);
+	}
+
+	std::string out;
+	out.reserve(4096);
+	size_t bytes = 0;
+	size_t before = allocations.load();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < renders; ++i) {
+		uint32_t node = i % story.Size();
+		out.clear();
+		story.OfferedJson(node, session.registers.data(), out);
+		story.OfferedConsoleText(node, session.registers.data(), out);
+		bytes += out.size();
+	}
+	double total = Since(start);
+	size_t allocated = allocations.load() - before;
+	printf("segments: %.0f ns per node (JSON and text), %.2f ns per byte, %zu allocations\n",
+		total / renders, total / bytes, allocated);
+
+	before = allocations.load();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < renders; ++i) {
+		out.clear();
+		Replace(story, i % story.Size(), session.registers.data(), out);
+	}
+	total = Since(start);
+	printf("find and replace: %.0f ns per node (text only), %.1f allocations per render\n",
+		total / renders, double(allocations.load() - before) / renders);
+
+	printf("sample: %s", out.c_str());
+	return allocated == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+// Bytes sent per step playing a story on a terminal: the console, which
+// writes each node's text and choices as lines that scroll, against the
+// raw-mode front end (PlayInTerminal()), which sends only what changed on
+// its screen, and against that front end drawing every frame whole. On
+// questions the player moves down a choice or two before taking one.
+// Usage: terminal_bench [steps] [rows] [columns]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "session.h"
+#include "screen.h"
+#include "terminal.h"
+#include "wrap.h"
+
+namespace {
+
+const char *const texts[] = {
+	"The rain had not stopped for three days, and the river was rising faster than anyone in the village "
+	"had seen. Old Maren stood at the bridge with her lantern and counted the carts as they crossed.",
+	"Le café était déjà fermé quand Élodie arriva, trempée, devant la vitrine. « Encore raté », dit-elle.",
+	"雨は三日も降り続き、川は村の誰も見たことがないほどの速さで増水していた。老婆マーレンは橋のたもとに立っていた。",
+	"The first plank gave way.",
+};
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = texts[i % 4];
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Follow the carts across what is left of the bridge";
+			dial.Choices[(i + 5) % nodes] = "Wait for the rain to stop";
+			dial.Choices[(i + 9) % nodes] = "荷車を追って橋を渡る";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+	return story;
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t steps = argc > 1 ? atol(argv[1]) : 20000;
+	size_t rows = argc > 2 ? atol(argv[2]) : 24;
+	size_t columns = argc > 3 ? atol(argv[3]) : 80;
+
+	CompiledStory story(Generate(400));
+	ConsoleLayout layout(story);
+	Screen screen(rows, columns), whole(rows, columns);
+	Session session;
+	StartSession(story, session);
+	std::mt19937 random(3);
+
+	std::string out, block;
+	std::vector<OfferedChoice> offered;
+	// Bytes for frames showing a node, and for those moving the selection.
+	size_t console = 0, diff[2] = {}, redrawn[2] = {}, moves = 0;
+	auto frame = [&](uint32_t node, size_t selected, bool move) {
+		DrawNode(screen, story, layout, node, session.registers.data(), offered, selected);
+		out.clear();
+		screen.Render(out);
+		diff[move] += out.size();
+		whole.Resize(rows, columns);
+		DrawNode(whole, story, layout, node, session.registers.data(), offered, selected);
+		out.clear();
+		whole.Render(out);
+		redrawn[move] += out.size();
+		moves += move;
+	};
+
+	for (size_t step = 0; step < steps; ++step) {
+		uint32_t node = session.node;
+		console += story.ConsoleText(node).size() + story.ConsoleChoices(node).size();
+		FindOffered(story, node, session.registers.data(), nullptr, block, offered);
+
+		size_t selected = 0;
+		frame(node, selected, false);
+		size_t choice = 0;
+		if (!offered.empty()) {
+			for (size_t down = random() % offered.size(); down > 0; --down) {
+				frame(node, ++selected, true);
+			}
+			choice = offered[selected].id;
+		}
+		Step(story, session, choice);
+	}
+
+	printf("%zu steps, %zu selection moves, %zux%zu\n", steps, moves, columns, rows);
+	printf("console:                %6.1f bytes/step\n", double(console) / steps);
+	printf("terminal, changes only: %6.1f bytes/step (%.1f per node, %.1f per move)\n",
+		double(diff[0] + diff[1]) / steps, double(diff[0]) / steps, double(diff[1]) / moves);
+	printf("terminal, whole frames: %6.1f bytes/step (%.1f per node, %.1f per move)\n",
+		double(redrawn[0] + redrawn[1]) / steps, double(redrawn[0]) / steps, double(redrawn[1]) / moves);
+	return 0;
+}
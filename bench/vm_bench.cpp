@@ -0,0 +1,113 @@
+// Plays a story where every node changes variables and every choice has a
+// condition, timing the effects, the menus worked out from the conditions,
+// and the script code on its own.
+// Usage: vm_bench [steps]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+
+#include "story.h"
+#include "compiled.h"
+#include "session.h"
+
+namespace {
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = "Lorem ipsum dolor sit amet";
+		dial.Effect = i % 2 ? "gold += 3; steps += 1" : "steps += 1; tired = steps % 5 == 0";
+
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Go on";
+			dial.Choices[(i + 7) % nodes] = "Take the long way round";
+			dial.Choices[(i + 13) % nodes] = "Pay the ferryman";
+			dial.Conditions[(i + 7) % nodes] = "!tired || steps < 100";
+			dial.Conditions[(i + 13) % nodes] = "gold >= 10 && (steps % 3 != 0 || gold > 1000)";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+
+	return story;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t steps = argc > 1 ? atol(argv[1]) : 1000000;
+
+	Story source = Generate(10000);
+	CompiledStory story(source);
+	const Script &script = story.Scripts();
+	printf("%zu variables, %zu registers, %zu instructions\n", script.Variables(), script.Registers(), script.Instructions());
+
+	// Steps, each running the arrival effect, and at every question the
+	// menu as the server sends it.
+	Session session;
+	StartSession(story, session);
+	std::mt19937 random(42);
+	std::string menu;
+	size_t menus = 0, offered = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < steps; ++i) {
+		const CompiledStory::Node &node = story[session.node];
+		size_t choice = 0;
+		if (!node.isDialogue) {
+			menu.clear();
+			story.OfferedJson(session.node, session.registers.data(), menu);
+			++menus;
+			// The first choice is always offered.
+			const CompiledStory::Choice *pick = story.ChoicesBegin(node) + random() % node.choiceCount;
+			choice = story.Offered(*pick, session.registers.data()) ? pick->id : story.ChoicesBegin(node)->id;
+			offered += choice != story.ChoicesBegin(node)->id;
+		}
+		Step(story, session, choice);
+	}
+	double total = Since(start);
+	printf("%zu steps with %zu menus: %.0f ns per step, %s = %lld\n", steps, menus, total / steps, script.VariableName(0).c_str(), (long long)session.registers[0]);
+	printf("%zu conditional choices taken\n", offered);
+
+	// Undoing all of it a step at a time.
+	start = std::chrono::steady_clock::now();
+	size_t back = 0;
+	while (StepBack(session) == StepResult::Moved) ++back;
+	printf("%zu steps back, undoing effects: %.0f ns per step\n", back, Since(start) / back);
+
+	// The conditions of one question on their own.
+	const CompiledStory::Node &question = story[3];
+	std::vector<int64_t> registers(script.Registers());
+	size_t runs = 0, instructions = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < steps; ++i) {
+		for (size_t v = 0; v < script.Variables(); ++v) {
+			registers[v] = (i + v) % 50;
+		}
+		for (const CompiledStory::Choice *choice = story.ChoicesBegin(question); choice != story.ChoicesEnd(question); ++choice) {
+			if (choice->condition != Script::None) {
+				runs += script.Run(choice->condition, registers.data()) != 0;
+			}
+		}
+	}
+	total = Since(start);
+	// Compile the two conditions again to count what they could run, as
+	// && and || skip some of it.
+	Script counted;
+	counted.CompileCondition("!tired || steps < 100");
+	counted.CompileCondition("gold >= 10 && (steps % 3 != 0 || gold > 1000)");
+	instructions = counted.Instructions() * steps;
+	printf("menu conditions: %.1f ns per menu, at least %.2f ns per instruction (%zu true)\n", total / steps, total / instructions, runs);
+	return 0;
+}
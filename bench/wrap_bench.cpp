@@ -0,0 +1,119 @@
+// Wraps the console text of a story of English, accented and Japanese
+// nodes to a terminal width: finding the line breaks once when the story
+// is loaded (ConsoleLayout), then scanning them on each render, next to
+// finding them anew on each render. In characters per second.
+// Usage: wrap_bench [nodes] [width]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "wrap.h"
+
+namespace {
+
+const char *const texts[] = {
+	"The rain had not stopped for three days, and the river was rising faster than anyone in the village "
+	"had seen. Old Maren stood at the bridge with her lantern (the last one that still worked) and counted "
+	"the carts as they crossed — twelve, thirteen, fourteen — before the first plank gave way.",
+	"Le café était déjà fermé quand Élodie arriva, trempée, devant la vitrine. « Encore raté », dit-elle, "
+	"en essuyant ses lunettes ; derrière le comptoir, le vieux Noël rangeait les tasses une à une.",
+	"雨は三日も降り続き、川は村の誰も見たことがないほどの速さで増水していた。老婆マーレンは最後のランタンを手に"
+	"橋のたもとに立ち、渡っていく荷車を数えていた。「十二、十三、十四……」と数えたところで、最初の板が外れた。",
+};
+
+Story Generate(size_t nodes) {
+	Story story;
+	for (size_t i = 0; i < nodes; ++i) {
+		Dialogue &dial = EditNode(story, i);
+		dial.ID = i;
+		dial.Text = texts[i % 3];
+		if (i % 4 == 3) {
+			dial.IsDialogue = false;
+			dial.Choices[(i + 1) % nodes] = "Follow the carts across what is left of the bridge";
+			dial.Choices[(i + 7) % nodes] = "荷車を追って橋を渡る";
+			dial.TotalChoices = dial.Choices.size();
+		} else {
+			dial.IsDialogue = true;
+			dial.NextID = (i + 1) % nodes;
+		}
+	}
+	return story;
+}
+
+size_t Characters(std::string_view text) {
+	size_t count = 0;
+	for (unsigned char c : text) {
+		count += (c & 0xC0) != 0x80;
+	}
+	return count;
+}
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+	size_t nodes = argc > 1 ? atol(argv[1]) : 30000;
+	size_t width = argc > 2 ? atol(argv[2]) : 80;
+	const int rounds = 5;
+
+	CompiledStory story(Generate(nodes));
+	size_t characters = 0, bytes = 0;
+	for (uint32_t node = 0; node < story.Size(); ++node) {
+		characters += Characters(story.ConsoleText(node)) + Characters(story.ConsoleChoices(node));
+		bytes += story.ConsoleText(node).size() + story.ConsoleChoices(node).size();
+	}
+
+	double build = 1e9;
+	std::unique_ptr<ConsoleLayout> layout;
+	for (int round = 0; round < rounds; ++round) {
+		auto start = std::chrono::steady_clock::now();
+		layout = std::make_unique<ConsoleLayout>(story);
+		build = std::min(build, Since(start));
+	}
+
+	std::string out;
+	std::vector<int64_t> registers(story.Registers() + 1);
+	double wrap = 1e9;
+	for (int round = 0; round < rounds; ++round) {
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t node = 0; node < story.Size(); ++node) {
+			out.clear();
+			layout->Text(node, registers.data(), width, out);
+			layout->Choices(node, registers.data(), width, out);
+		}
+		wrap = std::min(wrap, Since(start));
+	}
+
+	std::vector<LineBreak> breaks;
+	double each = 1e9;
+	for (int round = 0; round < rounds; ++round) {
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t node = 0; node < story.Size(); ++node) {
+			out.clear();
+			for (std::string_view text : {story.ConsoleText(node), story.ConsoleChoices(node)}) {
+				breaks.clear();
+				FindBreaks(text, breaks);
+				WrapText(text, breaks.data(), breaks.data() + breaks.size(), width, out);
+			}
+		}
+		each = std::min(each, Since(start));
+	}
+
+	printf("%zu nodes, %.1f M characters (%.1f MB), %zu columns; breaks take %.1f MB\n",
+		nodes, characters / 1e6, bytes / 1e6, width, layout->Bytes() / 1e6);
+	printf("finding breaks at load:      %7.1f M characters/s\n", characters / build / 1e6);
+	printf("wrapping from found breaks:  %7.1f M characters/s\n", characters / wrap / 1e6);
+	printf("finding breaks every render: %7.1f M characters/s\n", characters / each / 1e6);
+	return 0;
+}
@@ -0,0 +1,291 @@
+#include "graph.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+const size_t NoParent = SIZE_MAX;
+
+int Bit(StoryGraph::Problem problem) {
+	return problem == StoryGraph::Dangling ? 0 : problem == StoryGraph::Unreachable ? 1 : 2;
+}
+
+}
+
+std::vector<size_t> Targets(const Dialogue &dial) {
+	std::vector<size_t> targets;
+
+	if (dial.IsDialogue) {
+		if (dial.NextID != 0) {
+			targets.push_back(dial.NextID);
+		}
+	} else {
+		for (auto &[nextID, text] : dial.Choices) {
+			targets.push_back(nextID);
+		}
+	}
+
+	return targets;
+}
+
+void StoryGraph::Build(const Story &story) {
+	nodes.clear();
+	nodes.reserve(story.size());
+	std::fill(std::begin(counts), std::end(counts), 0);
+
+	// Only ever adds nodes and edges, so every node is attached at most once.
+	for (auto &[id, node] : story) {
+		Update(id, node.get());
+	}
+}
+
+void StoryGraph::Update(size_t id, const Dialogue *dial) {
+	std::vector<size_t> targets;
+	if (dial) {
+		targets = Targets(*dial);
+		std::sort(targets.begin(), targets.end());
+	}
+
+	Node &node = nodes[id];
+	std::vector<size_t> old = std::move(node.out);
+	bool existed = node.exists;
+	node.out = targets;
+	node.exists = dial != nullptr;
+	node.question = dial && !dial->IsDialogue;
+
+	std::vector<size_t> removed, added;
+	std::set_difference(old.begin(), old.end(), targets.begin(), targets.end(), std::back_inserter(removed));
+	std::set_difference(targets.begin(), targets.end(), old.begin(), old.end(), std::back_inserter(added));
+
+	std::vector<size_t> lost;
+	for (size_t target : removed) {
+		Node &to = nodes[target];
+		to.in.erase(std::find(to.in.begin(), to.in.end(), id));
+		if (to.reachable && to.parent == id) {
+			lost.push_back(target);
+		}
+		if (!to.exists && to.in.empty() && target != id) {
+			nodes.erase(target);
+		}
+	}
+	for (size_t target : added) {
+		nodes[target].in.push_back(id);
+	}
+
+	Node &self = nodes[id];
+	if (existed != self.exists) {
+		if (!self.exists && self.reachable) {
+			lost.push_back(id);
+		}
+
+		// Whatever leads here just started or stopped dangling.
+		for (size_t from : self.in) {
+			Refresh(from);
+		}
+	}
+
+	for (size_t target : lost) {
+		if (!Reparent(target, nodes[target].depth)) {
+			Detach(target);
+		}
+	}
+
+	if (self.exists && !self.reachable) {
+		if (id == 0) {
+			Attach(id, NoParent);
+		} else {
+			for (size_t from : self.in) {
+				if (Reachable(from)) {
+					Attach(id, from);
+					break;
+				}
+			}
+		}
+	}
+	if (self.reachable) {
+		for (size_t target : added) {
+			if (Exists(target) && !Reachable(target)) {
+				Attach(target, id);
+			}
+		}
+	}
+
+	Refresh(id);
+	if (!self.exists && self.in.empty()) {
+		nodes.erase(id);
+	}
+}
+
+unsigned StoryGraph::Problems(size_t id) const {
+	auto it = nodes.find(id);
+	return it != nodes.end() ? it->second.problems : 0;
+}
+
+size_t StoryGraph::Count(Problem problem) const {
+	return counts[Bit(problem)];
+}
+
+const std::vector<size_t> &StoryGraph::Incoming(size_t id) const {
+	static const std::vector<size_t> none;
+	auto it = nodes.find(id);
+	return it != nodes.end() ? it->second.in : none;
+}
+
+const std::vector<size_t> &StoryGraph::Outgoing(size_t id) const {
+	static const std::vector<size_t> none;
+	auto it = nodes.find(id);
+	return it != nodes.end() ? it->second.out : none;
+}
+
+std::vector<std::pair<size_t, size_t>> StoryGraph::Predecessors(size_t id, size_t maxDistance) const {
+	std::vector<std::pair<size_t, size_t>> found;
+	std::unordered_set<size_t> seen = {id};
+
+	std::vector<size_t> level = {id};
+	for (size_t distance = 1; distance <= maxDistance && !level.empty(); ++distance) {
+		std::vector<size_t> next;
+		for (size_t to : level) {
+			for (size_t from : Incoming(to)) {
+				if (seen.insert(from).second) {
+					found.emplace_back(from, distance);
+					next.push_back(from);
+				}
+			}
+		}
+		level.swap(next);
+	}
+
+	return found;
+}
+
+bool StoryGraph::Exists(size_t id) const {
+	auto it = nodes.find(id);
+	return it != nodes.end() && it->second.exists;
+}
+
+bool StoryGraph::Reachable(size_t id) const {
+	auto it = nodes.find(id);
+	return it != nodes.end() && it->second.reachable;
+}
+
+// Marks id reachable through parent, and everything it newly reaches.
+void StoryGraph::Attach(size_t id, size_t parent) {
+	std::vector<size_t> queue = {id};
+	Node &first = nodes[id];
+	first.reachable = true;
+	first.parent = parent;
+	first.depth = parent == NoParent ? 0 : nodes[parent].depth + 1;
+
+	for (size_t i = 0; i < queue.size(); ++i) {
+		size_t from = queue[i];
+		Refresh(from);
+
+		for (size_t target : nodes[from].out) {
+			Node &to = nodes[target];
+			if (to.exists && !to.reachable) {
+				to.reachable = true;
+				to.parent = from;
+				to.depth = nodes[from].depth + 1;
+				queue.push_back(target);
+			}
+		}
+	}
+}
+
+// Gives id another parent from below the given depth, if it has one. Such a
+// node cannot be below id in the tree, since depth grows along tree edges.
+bool StoryGraph::Reparent(size_t id, size_t below) {
+	Node &node = nodes[id];
+	if (!node.exists) {
+		return false;
+	}
+
+	for (size_t from : node.in) {
+		auto it = nodes.find(from);
+		if (it != nodes.end() && it->second.reachable && it->second.depth < below) {
+			node.parent = from;
+			return true;
+		}
+	}
+	return false;
+}
+
+// id lost the edge that made it reachable: unmark its subtree, then attach
+// again whatever in it is still reachable some other way. Branches that can
+// hang from a node above id are moved there instead of being walked.
+void StoryGraph::Detach(size_t id) {
+	Node &first = nodes[id];
+	if (!first.reachable) {
+		return;
+	}
+	first.reachable = false;
+	size_t below = first.depth;
+
+	std::vector<size_t> subtree = {id};
+	for (size_t i = 0; i < subtree.size(); ++i) {
+		size_t from = subtree[i];
+		for (size_t target : nodes[from].out) {
+			Node &to = nodes[target];
+			if (to.reachable && to.parent == from && !Reparent(target, below)) {
+				to.reachable = false;
+				subtree.push_back(target);
+			}
+		}
+	}
+
+	for (size_t target : subtree) {
+		Node &node = nodes[target];
+		if (node.reachable || !node.exists) {
+			continue;
+		}
+
+		if (target == 0) {
+			Attach(target, NoParent);
+			continue;
+		}
+		for (size_t from : node.in) {
+			if (Reachable(from)) {
+				Attach(target, from);
+				break;
+			}
+		}
+	}
+
+	for (size_t target : subtree) {
+		Refresh(target);
+	}
+}
+
+void StoryGraph::Refresh(size_t id) {
+	auto it = nodes.find(id);
+	if (it == nodes.end()) {
+		return;
+	}
+	Node &node = it->second;
+
+	uint8_t problems = 0;
+	if (node.exists) {
+		for (size_t target : node.out) {
+			if (!Exists(target)) {
+				problems |= Dangling;
+				break;
+			}
+		}
+		if (!node.reachable) {
+			problems |= Unreachable;
+		}
+		if (node.question && node.out.empty()) {
+			problems |= DeadEnd;
+		}
+	}
+
+	for (Problem problem : {Dangling, Unreachable, DeadEnd}) {
+		if ((problems & problem) && !(node.problems & problem)) {
+			++counts[Bit(problem)];
+		} else if (!(problems & problem) && (node.problems & problem)) {
+			--counts[Bit(problem)];
+		}
+	}
+	node.problems = problems;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "story.h"
+
+// Edges of the story graph in both directions, plus the problems a writer
+// should know about, all kept up to date one edit at a time.
+//
+// A dialogue node leads to its NextID (0 ends the story), a question to
+// each of its choices. Reachability from node 0 is kept as a spanning tree
+// whose depth grows along every tree edge. When a node loses its tree edge,
+// only the part of its subtree that cannot be hung from a node higher up is
+// walked, and only through the incoming edges of that part.
+class StoryGraph {
+public:
+	enum Problem {
+		Dangling = 1,     // leads to a node that does not exist
+		Unreachable = 2,  // cannot be reached from node 0
+		DeadEnd = 4,      // a question without answers
+	};
+
+	void Build(const Story &story);
+	// Node id was edited or created, or removed if dial is null.
+	void Update(size_t id, const Dialogue *dial);
+
+	unsigned Problems(size_t id) const;
+	size_t Count(Problem problem) const;
+
+	// Nodes leading to id, one entry per node, in no particular order.
+	const std::vector<size_t> &Incoming(size_t id) const;
+	// Where id leads, sorted.
+	const std::vector<size_t> &Outgoing(size_t id) const;
+	// Every node that can lead to id within maxDistance steps, nearest
+	// first, paired with its distance. Costs the in-degree of what it visits.
+	std::vector<std::pair<size_t, size_t>> Predecessors(size_t id, size_t maxDistance = SIZE_MAX) const;
+
+private:
+	struct Node {
+		std::vector<size_t> out;
+		std::vector<size_t> in;
+		size_t parent = 0;
+		size_t depth = 0;
+		bool exists = false;
+		bool question = false;
+		bool reachable = false;
+		uint8_t problems = 0;
+	};
+
+	bool Exists(size_t id) const;
+	bool Reachable(size_t id) const;
+	void Attach(size_t id, size_t parent);
+	bool Reparent(size_t id, size_t below);
+	void Detach(size_t id);
+	void Refresh(size_t id);
+
+	std::unordered_map<size_t, Node> nodes;
+	size_t counts[3] = {};
+};
+
+// The nodes that dial leads to, in the order the engine offers them.
+std::vector<size_t> Targets(const Dialogue &dial);
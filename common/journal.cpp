@@ -0,0 +1,242 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+void AppendFile(const std::string &from, const std::string &to) {
+	int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+	if (in < 0) {
+		throw std::runtime_error("Cannot open " + from + ": " + strerror(errno));
+	}
+
+	FileWriter out(to, FileWriter::Append);
+	char buffer[1 << 16];
+	ssize_t n;
+	while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+		out.Write(buffer, n);
+	}
+	close(in);
+
+	if (n < 0) {
+		throw std::runtime_error("Cannot read " + from + ": " + strerror(errno));
+	}
+	out.Sync();
+}
+
+// Cuts off a record left incomplete by a crash, so new records do not get
+// glued onto it.
+void TrimTornRecord(const std::string &filename) {
+	int fd = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+
+	off_t end = lseek(fd, 0, SEEK_END);
+	char buffer[1 << 16];
+	while (end > 0) {
+		off_t start = end > (off_t)sizeof(buffer) ? end - sizeof(buffer) : 0;
+		ssize_t n = pread(fd, buffer, end - start, start);
+		if (n != end - start) {
+			break;
+		}
+
+		const char *eol = (const char *)memrchr(buffer, '\n', n);
+		if (eol) {
+			end = start + (eol - buffer) + 1;
+			break;
+		}
+		end = start;
+	}
+
+	if (end != lseek(fd, 0, SEEK_END)) {
+		ftruncate(fd, end);
+	}
+	close(fd);
+}
+
+size_t ReplayFile(const std::string &filename, Story &story) {
+	std::ifstream inputFile(filename, std::ios::binary);
+	if (!inputFile) {
+		return 0;
+	}
+
+	std::string data((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
+	size_t records = 0;
+
+	const char *p = data.data();
+	const char *end = p + data.size();
+	while (p < end) {
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if (!eol) {
+			// Torn write, the edit never completed.
+			break;
+		}
+
+		if (p[0] == 'P' && p[1] == ' ') {
+			auto dial = std::make_shared<Dialogue>();
+			try {
+				ParseDialogue(p + 2, eol, *dial);
+			} catch (std::exception &) {
+				break;
+			}
+			story[dial->ID] = std::move(dial);
+		} else if (p[0] == 'E' && p[1] == ' ') {
+			story.erase(strtoull(p + 2, nullptr, 10));
+		} else {
+			break;
+		}
+
+		++records;
+		p = eol + 1;
+	}
+
+	return records;
+}
+
+}
+
+Journal::~Journal() {
+	Close();
+}
+
+void Journal::Open(const std::string &storyFile) {
+	Close();
+
+	filename = storyFile + ".journal";
+	oldFilename = filename + ".old";
+	stopping = false;
+	error.clear();
+
+	TrimTornRecord(filename);
+	out = std::make_unique<FileWriter>(filename, FileWriter::Append, 1 << 16);
+	size = out->Written();
+
+	writer = std::thread(&Journal::Run, this);
+}
+
+void Journal::Close() {
+	if (!IsOpen()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+	out.reset();
+}
+
+void Journal::Put(std::shared_ptr<const Dialogue> dial) {
+	Push({Entry::Put, std::move(dial), 0});
+}
+
+void Journal::Erase(size_t id) {
+	Push({Entry::Erase, nullptr, id});
+}
+
+void Journal::Rotate() {
+	Push({Entry::Rotate, nullptr, 0});
+	size = 0;
+}
+
+void Journal::DropRotated() {
+	Push({Entry::DropRotated, nullptr, 0});
+}
+
+std::string Journal::Error() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return error;
+}
+
+void Journal::Push(Entry entry) {
+	if (!IsOpen()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(entry));
+	}
+	wake.notify_one();
+}
+
+void Journal::Run() {
+	std::vector<Entry> batch;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			batch.swap(queue);
+		}
+
+		try {
+			for (auto &entry : batch) {
+				Apply(entry);
+			}
+			out->Sync();
+			size = out->Written();
+		} catch (std::exception &e) {
+			std::lock_guard<std::mutex> lock(mutex);
+			error = e.what();
+			queue.clear();
+			return;
+		}
+
+		// Releases the nodes, so the UI can edit them in place again.
+		batch.clear();
+	}
+}
+
+void Journal::Apply(Entry &entry) {
+	switch (entry.op) {
+	case Entry::Put:
+		out->Write("P ", 2);
+		WriteDialogue(*out, *entry.dial);
+		out->Put('\n');
+		break;
+	case Entry::Erase:
+		out->Write("E ", 2);
+		out->Number(entry.id);
+		out->Put('\n');
+		break;
+	case Entry::Rotate:
+		out->Sync();
+		out.reset();
+
+		// An old journal is still around if the last save failed: it is not
+		// covered by any save yet, so keep it and add to it.
+		if (access(oldFilename.c_str(), F_OK) == 0) {
+			AppendFile(filename, oldFilename);
+			unlink(filename.c_str());
+		} else if (rename(filename.c_str(), oldFilename.c_str()) != 0) {
+			throw std::runtime_error("Cannot rename " + filename + ": " + strerror(errno));
+		}
+
+		out = std::make_unique<FileWriter>(filename, FileWriter::Append, 1 << 16);
+		break;
+	case Entry::DropRotated:
+		unlink(oldFilename.c_str());
+		break;
+	}
+}
+
+size_t ReplayJournal(const std::string &storyFile, Story &story) {
+	std::string filename = storyFile + ".journal";
+	return ReplayFile(filename + ".old", story) + ReplayFile(filename, story);
+}
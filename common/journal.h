@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "story.h"
+#include "writer.h"
+
+// Append-only log of edits made since the last full save, kept in
+// <story>.journal. Every record holds the whole new state of one node (or
+// its removal), so replaying a record twice is harmless.
+//
+// Records are queued by the UI thread and written by a background thread,
+// which syncs once per batch (group commit): everything queued while the
+// previous batch was syncing goes out with the next one.
+//
+// A full save goes together with Rotate(): records up to that point move to
+// <story>.journal.old, which DropRotated() deletes once the save is on disk.
+// Until then a crash still recovers through the old journal.
+class Journal {
+public:
+	~Journal();
+
+	void Open(const std::string &storyFile);
+	void Close();
+	bool IsOpen() const { return writer.joinable(); }
+
+	void Put(std::shared_ptr<const Dialogue> dial);
+	void Erase(size_t id);
+	void Rotate();
+	void DropRotated();
+
+	// Bytes in the current journal file, roughly the cost of replaying it.
+	size_t Size() const { return size; }
+	// Set if writing failed; journaling stops then.
+	std::string Error();
+
+private:
+	struct Entry {
+		enum Op { Put, Erase, Rotate, DropRotated } op;
+		std::shared_ptr<const Dialogue> dial;
+		size_t id;
+	};
+
+	void Push(Entry entry);
+	void Run();
+	void Apply(Entry &entry);
+
+	std::string filename;
+	std::string oldFilename;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<Entry> queue;
+	bool stopping = false;
+	std::string error;
+
+	// Only used by the writer thread.
+	std::unique_ptr<FileWriter> out;
+
+	std::atomic<size_t> size{0};
+};
+
+// Applies <story>.journal.old and then <story>.journal on top of a story
+// loaded from storyFile. A torn record at the end (a crash mid-write) is
+// ignored. Returns the number of records applied.
+size_t ReplayJournal(const std::string &storyFile, Story &story);
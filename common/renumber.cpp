@@ -0,0 +1,182 @@
+#include "renumber.h"
+#include "writer.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+const size_t None = SIZE_MAX;
+
+// Old ID to position, open addressing with linear probing: one or two cache
+// misses per lookup where a binary search over millions of IDs takes twenty.
+class PositionTable {
+public:
+	explicit PositionTable(const std::vector<size_t> &ids) {
+		size_t capacity = 16;
+		while (capacity < ids.size() * 2) capacity *= 2;
+		slots.assign(capacity, {None, None});
+		mask = capacity - 1;
+
+		for (size_t i = 0; i < ids.size(); ++i) {
+			size_t slot = Hash(ids[i]);
+			while (slots[slot].first != None) slot = (slot + 1) & mask;
+			slots[slot] = {ids[i], i};
+		}
+	}
+
+	size_t Find(size_t id) const {
+		for (size_t slot = Hash(id);; slot = (slot + 1) & mask) {
+			if (slots[slot].first == id) return slots[slot].second;
+			if (slots[slot].first == None) return None;
+		}
+	}
+
+private:
+	size_t Hash(size_t id) const {
+		return (id * 0x9e3779b97f4a7c15ull >> 20) & mask;
+	}
+
+	std::vector<std::pair<size_t, size_t>> slots;
+	size_t mask;
+};
+
+}
+
+IdMap RenumberStory(Story &story) {
+	size_t n = story.size();
+
+	// The map's own nodes are taken out and put back under their new key,
+	// nothing is freed or allocated again. The map is sorted, so are the old IDs.
+	std::vector<size_t> oldIDs;
+	std::vector<Story::node_type> nodes;
+	oldIDs.reserve(n);
+	nodes.reserve(n);
+	while (!story.empty()) {
+		oldIDs.push_back(story.begin()->first);
+		nodes.push_back(story.extract(story.begin()));
+	}
+
+	// Every link resolved to a position once, in memory order, so the walk
+	// below runs over flat arrays instead of chasing nodes around the heap.
+	PositionTable positions(oldIDs);
+	std::vector<size_t> offsets(n + 1);
+	std::vector<size_t> targets;
+	targets.reserve(n * 2);
+	for (size_t i = 0; i < n; ++i) {
+		offsets[i] = targets.size();
+		const Dialogue &dial = *nodes[i].mapped();
+		if (dial.IsDialogue) {
+			// 0 ends the story rather than pointing at the first node.
+			if (dial.NextID != 0) targets.push_back(positions.Find(dial.NextID));
+		} else {
+			for (auto &[nextID, text] : dial.Choices) {
+				targets.push_back(positions.Find(nextID));
+			}
+		}
+	}
+	offsets[n] = targets.size();
+
+	std::vector<size_t> newIDs(n, None);
+	std::vector<size_t> order;
+	order.reserve(n);
+	auto visit = [&](size_t i) {
+		if (i != None && newIDs[i] == None) {
+			newIDs[i] = order.size();
+			order.push_back(i);
+		}
+	};
+
+	visit(positions.Find(0));
+	for (size_t k = 0; k < order.size(); ++k) {
+		size_t i = order[k];
+		for (size_t e = offsets[i]; e < offsets[i + 1]; ++e) {
+			visit(targets[e]);
+		}
+	}
+	for (size_t i = 0; i < n; ++i) {
+		visit(i);
+	}
+
+	std::unordered_map<size_t, size_t> dangling;
+	auto remap = [&](size_t e, size_t id) {
+		if (targets[e] != None) {
+			return newIDs[targets[e]];
+		}
+		return dangling.emplace(id, n + dangling.size()).first->second;
+	};
+
+	for (size_t i = 0; i < n; ++i) {
+		std::shared_ptr<Dialogue> &node = nodes[i].mapped();
+		if (node.use_count() > 1) {
+			node = std::make_shared<Dialogue>(*node);
+		}
+
+		Dialogue &dial = *node;
+		size_t e = offsets[i];
+		dial.ID = newIDs[i];
+		if (dial.IsDialogue) {
+			if (dial.NextID != 0) dial.NextID = remap(e, dial.NextID);
+		} else {
+			// Moves the map nodes over instead of copying the text.
+			std::map<size_t, std::string> choices, conditions;
+			std::map<size_t, double> weights;
+			size_t defaultChoice = dial.DefaultChoice;
+			while (!dial.Choices.empty()) {
+				auto choice = dial.Choices.extract(dial.Choices.begin());
+				size_t newID = remap(e++, choice.key());
+				if (choice.key() == dial.DefaultChoice) defaultChoice = newID;
+				auto condition = dial.Conditions.find(choice.key());
+				if (condition != dial.Conditions.end()) {
+					auto moved = dial.Conditions.extract(condition);
+					moved.key() = newID;
+					conditions.insert(std::move(moved));
+				}
+				auto weight = dial.Weights.find(choice.key());
+				if (weight != dial.Weights.end()) {
+					auto moved = dial.Weights.extract(weight);
+					moved.key() = newID;
+					weights.insert(std::move(moved));
+				}
+				choice.key() = newID;
+				choices.insert(std::move(choice));
+			}
+			dial.Choices.swap(choices);
+			dial.Conditions.swap(conditions);
+			dial.Weights.swap(weights);
+			dial.DefaultChoice = defaultChoice;
+		}
+	}
+
+	// New IDs are handed out in order, so every insert goes at the end of the map.
+	for (size_t k = 0; k < n; ++k) {
+		Story::node_type &node = nodes[order[k]];
+		node.key() = k;
+		story.insert(story.end(), std::move(node));
+	}
+
+	IdMap ids;
+	ids.reserve(n + dangling.size());
+	for (size_t i = 0; i < n; ++i) {
+		ids.emplace_back(oldIDs[i], newIDs[i]);
+	}
+	for (auto &[oldID, newID] : dangling) {
+		ids.emplace_back(oldID, newID);
+	}
+	std::sort(ids.begin() + n, ids.end());
+	std::inplace_merge(ids.begin(), ids.begin() + n, ids.end());
+	return ids;
+}
+
+void SaveIdMap(const std::string &filename, const IdMap &ids) {
+	FileWriter out(filename);
+
+	for (auto [oldID, newID] : ids) {
+		out.Number(oldID);
+		out.Put(' ');
+		out.Number(newID);
+		out.Put('\n');
+	}
+
+	out.Commit();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "story.h"
+
+typedef std::vector<std::pair<size_t, size_t>> IdMap;
+
+// Renumbers the nodes of story to 0..n-1 in breadth-first order from node 0,
+// so nodes played one after another end up next to each other; nodes that
+// cannot be reached follow in their old order. Every NextID and choice is
+// rewritten on the way. Targets that do not exist stay dangling, numbered
+// from n on. Returns old → new ID for nodes and dangling targets, sorted by
+// old ID.
+IdMap RenumberStory(Story &story);
+
+// One "old new" pair per line, for migrating saves and analytics.
+void SaveIdMap(const std::string &filename, const IdMap &ids);
@@ -0,0 +1,402 @@
+#include "search.h"
+#include "writer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+namespace {
+
+const char IndexMagic[4] = {'S', 'T', 'I', 'X'};
+const uint32_t IndexVersion = 1;
+
+inline unsigned char Fold(unsigned char c) {
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+void AddTrigrams(const std::string &text, std::vector<uint32_t> &trigrams) {
+	if (text.size() < 3) {
+		return;
+	}
+
+	uint32_t key = Fold(text[0]) << 8 | Fold(text[1]);
+	for (size_t i = 2; i < text.size(); ++i) {
+		key = (key << 8 | Fold(text[i])) & 0xffffff;
+		trigrams.push_back(key);
+	}
+}
+
+void PutVarint(std::string &out, uint32_t value) {
+	while (value >= 0x80) {
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+uint32_t GetVarint(const char *&p) {
+	uint32_t value = 0;
+	for (int shift = 0;; shift += 7) {
+		unsigned char c = *p++;
+		value |= (uint32_t)(c & 0x7f) << shift;
+		if (c < 0x80) return value;
+	}
+}
+
+std::vector<uint32_t> Decode(const std::string &bytes) {
+	std::vector<uint32_t> slots;
+	const char *p = bytes.data();
+	const char *end = p + bytes.size();
+	uint32_t slot = 0;
+	while (p < end) {
+		slot += GetVarint(p);
+		slots.push_back(slot);
+	}
+	return slots;
+}
+
+bool ContainsFolded(const std::string &text, const std::string &word) {
+	return std::search(text.begin(), text.end(), word.begin(), word.end(), [](char a, char b) {
+		return Fold(a) == (unsigned char)b;
+	}) != text.end();
+}
+
+std::vector<std::string> SplitQuery(const std::string &query) {
+	std::vector<std::string> words;
+	std::string word;
+	bool quoted = false;
+
+	for (char c : query) {
+		if (c == '"') {
+			quoted = !quoted;
+		} else if (!quoted && (c == ' ' || c == '\t' || c == '\n')) {
+			if (!word.empty()) words.push_back(word);
+			word.clear();
+		} else {
+			word.push_back(Fold(c));
+		}
+	}
+	if (!word.empty()) words.push_back(word);
+
+	return words;
+}
+
+void Hash(uint64_t &hash, const void *data, size_t size) {
+	const unsigned char *p = (const unsigned char *)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	}
+}
+
+template<typename T>
+bool Read(const char *&p, const char *end, T &value) {
+	if ((size_t)(end - p) < sizeof(T)) return false;
+	memcpy(&value, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+
+}
+
+void SearchIndex::AddSlot(uint32_t slot, const Dialogue &dial, PostingMap &postings) {
+	auto add = [&](const std::string &text) {
+		if (text.size() < 3) {
+			return;
+		}
+
+		uint32_t key = Fold(text[0]) << 8 | Fold(text[1]);
+		for (size_t i = 2; i < text.size(); ++i) {
+			key = (key << 8 | Fold(text[i])) & 0xffffff;
+
+			// Slots only ever grow, so a repeat within this node is always the last entry.
+			Postings &list = postings[key];
+			if (list.last == slot && !list.bytes.empty()) {
+				continue;
+			}
+			PutVarint(list.bytes, slot - list.last);
+			list.last = slot;
+		}
+	};
+
+	add(dial.Text);
+	for (auto &[nextID, text] : dial.Choices) {
+		add(text);
+	}
+}
+
+void SearchIndex::Build(const Story &story) {
+	slotID.clear();
+	slotID.reserve(story.size());
+	idSlot.clear();
+	idSlot.reserve(story.size());
+	postings.clear();
+
+	std::vector<const Dialogue *> nodes;
+	nodes.reserve(story.size());
+	for (auto &[id, node] : story) {
+		idSlot[id] = slotID.size();
+		slotID.push_back(id);
+		nodes.push_back(node.get());
+	}
+	slotLive.assign(slotID.size(), true);
+	live = slotID.size();
+	retired = 0;
+
+	// Each thread indexes a contiguous range of slots, so its lists can
+	// simply be appended to those of the threads before it.
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, nodes.size() / 256 + 1);
+	std::vector<PostingMap> parts(threads);
+	std::vector<std::thread> workers;
+
+	for (size_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			size_t begin = nodes.size() * t / threads;
+			size_t end = nodes.size() * (t + 1) / threads;
+			for (size_t slot = begin; slot < end; ++slot) {
+				AddSlot(slot, *nodes[slot], parts[t]);
+			}
+		});
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
+	for (auto &part : parts) {
+		for (auto &[key, list] : part) {
+			auto [it, added] = postings.try_emplace(key);
+			if (added) {
+				it->second = std::move(list);
+				continue;
+			}
+
+			// The first delta of a part is relative to 0, rebase it.
+			Postings &into = it->second;
+			const char *p = list.bytes.data();
+			uint32_t first = GetVarint(p);
+			PutVarint(into.bytes, first - into.last);
+			into.bytes.append(p, list.bytes.data() + list.bytes.size() - p);
+			into.last = list.last;
+		}
+		part.clear();
+	}
+}
+
+void SearchIndex::Update(size_t id, const Dialogue *dial) {
+	auto it = idSlot.find(id);
+	if (it != idSlot.end()) {
+		slotLive[it->second] = false;
+		--live;
+		++retired;
+		idSlot.erase(it);
+	}
+
+	if (dial) {
+		uint32_t slot = slotID.size();
+		slotID.push_back(id);
+		slotLive.push_back(true);
+		idSlot[id] = slot;
+		++live;
+		AddSlot(slot, *dial, postings);
+	}
+}
+
+std::vector<uint32_t> SearchIndex::Candidates(const std::vector<std::string> &words) const {
+	std::vector<uint32_t> trigrams;
+	for (auto &word : words) {
+		AddTrigrams(word, trigrams);
+	}
+	std::sort(trigrams.begin(), trigrams.end());
+	trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+	std::vector<uint32_t> candidates;
+	if (trigrams.empty()) {
+		// Nothing long enough to look up, every node is a candidate.
+		for (uint32_t slot = 0; slot < slotID.size(); ++slot) {
+			if (slotLive[slot]) candidates.push_back(slot);
+		}
+		return candidates;
+	}
+
+	std::vector<const Postings *> lists;
+	for (uint32_t key : trigrams) {
+		auto it = postings.find(key);
+		if (it == postings.end()) {
+			return candidates;
+		}
+		lists.push_back(&it->second);
+	}
+
+	// Start from the rarest trigram so the intersection shrinks quickly.
+	std::sort(lists.begin(), lists.end(), [](const Postings *a, const Postings *b) {
+		return a->bytes.size() < b->bytes.size();
+	});
+
+	candidates = Decode(lists[0]->bytes);
+	for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+		std::vector<uint32_t> other = Decode(lists[i]->bytes);
+		std::vector<uint32_t> both;
+		std::set_intersection(candidates.begin(), candidates.end(), other.begin(), other.end(), std::back_inserter(both));
+		candidates.swap(both);
+	}
+
+	candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [this](uint32_t slot) {
+		return !slotLive[slot];
+	}), candidates.end());
+	return candidates;
+}
+
+std::vector<size_t> SearchIndex::Search(const std::string &query, const Story &story) const {
+	std::vector<std::string> words = SplitQuery(query);
+	std::vector<size_t> found;
+
+	for (uint32_t slot : Candidates(words)) {
+		auto it = story.find(slotID[slot]);
+		if (it == story.end()) {
+			continue;
+		}
+
+		const Dialogue &dial = *it->second;
+		bool all = true;
+		for (auto &word : words) {
+			bool any = ContainsFolded(dial.Text, word);
+			for (auto c = dial.Choices.begin(); !any && c != dial.Choices.end(); ++c) {
+				any = ContainsFolded(c->second, word);
+			}
+			if (!any) {
+				all = false;
+				break;
+			}
+		}
+
+		if (all) {
+			found.push_back(slotID[slot]);
+		}
+	}
+
+	std::sort(found.begin(), found.end());
+	return found;
+}
+
+void SearchIndex::Save(const std::string &filename, uint64_t hash) const {
+	FileWriter out(filename);
+
+	uint64_t slots = slotID.size();
+	uint64_t keys = postings.size();
+	out.Write(IndexMagic, sizeof(IndexMagic));
+	out.Write((const char *)&IndexVersion, sizeof(IndexVersion));
+	out.Write((const char *)&hash, sizeof(hash));
+	out.Write((const char *)&slots, sizeof(slots));
+	out.Write((const char *)slotID.data(), slots * sizeof(size_t));
+	for (uint64_t slot = 0; slot < slots; ++slot) {
+		out.Put(slotLive[slot] ? 1 : 0);
+	}
+
+	out.Write((const char *)&keys, sizeof(keys));
+	for (auto &[key, list] : postings) {
+		uint64_t size = list.bytes.size();
+		out.Write((const char *)&key, sizeof(key));
+		out.Write((const char *)&list.last, sizeof(list.last));
+		out.Write((const char *)&size, sizeof(size));
+		out.Write(list.bytes);
+	}
+
+	out.Commit();
+}
+
+bool SearchIndex::Load(const std::string &filename, uint64_t hash) {
+	std::ifstream inputFile(filename, std::ios::binary);
+	if (!inputFile) {
+		return false;
+	}
+	std::string data((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
+
+	const char *p = data.data();
+	const char *end = p + data.size();
+
+	char magic[4];
+	uint32_t version;
+	uint64_t fileHash, slots, keys;
+	if (!Read(p, end, magic) || memcmp(magic, IndexMagic, sizeof(magic)) != 0 ||
+		!Read(p, end, version) || version != IndexVersion ||
+		!Read(p, end, fileHash) || fileHash != hash ||
+		!Read(p, end, slots) || (size_t)(end - p) < slots * (sizeof(size_t) + 1)) {
+		return false;
+	}
+
+	SearchIndex index;
+	index.slotID.resize(slots);
+	memcpy(index.slotID.data(), p, slots * sizeof(size_t));
+	p += slots * sizeof(size_t);
+	index.slotLive.resize(slots);
+	for (uint64_t slot = 0; slot < slots; ++slot) {
+		index.slotLive[slot] = *p++;
+		if (index.slotLive[slot]) {
+			index.idSlot[index.slotID[slot]] = slot;
+			++index.live;
+		} else {
+			++index.retired;
+		}
+	}
+
+	if (!Read(p, end, keys)) {
+		return false;
+	}
+	index.postings.reserve(keys);
+	for (uint64_t i = 0; i < keys; ++i) {
+		uint32_t key;
+		Postings list;
+		uint64_t size;
+		if (!Read(p, end, key) || !Read(p, end, list.last) || !Read(p, end, size) || (uint64_t)(end - p) < size) {
+			return false;
+		}
+		list.bytes.assign(p, size);
+		p += size;
+		index.postings[key] = std::move(list);
+	}
+
+	*this = std::move(index);
+	return true;
+}
+
+size_t SearchIndex::MemoryUsage() const {
+	size_t bytes = slotID.capacity() * sizeof(size_t) + slotLive.capacity() / 8;
+	bytes += idSlot.size() * (sizeof(size_t) + sizeof(uint32_t) + 2 * sizeof(void *));
+	for (auto &[key, list] : postings) {
+		bytes += sizeof(key) + sizeof(list) + 2 * sizeof(void *) + list.bytes.capacity();
+	}
+	return bytes;
+}
+
+uint64_t StoryTextHash(const Story &story) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (auto &[id, node] : story) {
+		Hash(hash, &id, sizeof(id));
+		Hash(hash, node->Text.data(), node->Text.size() + 1);
+		for (auto &[nextID, text] : node->Choices) {
+			Hash(hash, text.data(), text.size() + 1);
+		}
+	}
+
+	return hash;
+}
+
+void LoadOrBuildIndex(const std::string &storyFile, const Story &story, SearchIndex &index) {
+	std::string filename = storyFile + ".index";
+	uint64_t hash = StoryTextHash(story);
+
+	if (index.Load(filename, hash)) {
+		return;
+	}
+
+	index.Build(story);
+	try {
+		index.Save(filename, hash);
+	} catch (std::exception &) {
+		// Only a cache, the next load builds it again.
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "story.h"
+
+// Trigram index over node text and choice text, case insensitive for ASCII.
+//
+// Every node gets a slot, and each trigram keeps the sorted slots of the
+// nodes containing it, delta and varint encoded. Updating a node retires its
+// slot and appends a new one, so every change is an append; lookups skip
+// retired slots, and NeedsRebuild() asks for a Build() once they outnumber
+// the live ones. Candidates are always checked against the story, so the
+// index only has to never miss a node.
+class SearchIndex {
+public:
+	// Indexes the whole story, split over all cores.
+	void Build(const Story &story);
+	// Node id was edited or created, or removed if dial is null.
+	void Update(size_t id, const Dialogue *dial);
+	bool NeedsRebuild() const { return retired > 4096 && retired > live; }
+
+	// Nodes whose text or choices contain every whitespace separated word of
+	// query, a "quoted phrase" counting as one word. Sorted by ID.
+	std::vector<size_t> Search(const std::string &query, const Story &story) const;
+
+	// The file records StoryTextHash() of the indexed story; Load() fails if it
+	// does not match hash or the file is missing or damaged.
+	void Save(const std::string &filename, uint64_t hash) const;
+	bool Load(const std::string &filename, uint64_t hash);
+
+	size_t Nodes() const { return live; }
+	size_t MemoryUsage() const;
+
+private:
+	struct Postings {
+		std::string bytes;
+		uint32_t last = 0;
+	};
+	typedef std::unordered_map<uint32_t, Postings> PostingMap;
+
+	static void AddSlot(uint32_t slot, const Dialogue &dial, PostingMap &postings);
+	std::vector<uint32_t> Candidates(const std::vector<std::string> &words) const;
+
+	std::vector<size_t> slotID;
+	std::vector<bool> slotLive;
+	std::unordered_map<size_t, uint32_t> idSlot;
+	PostingMap postings;
+	size_t live = 0;
+	size_t retired = 0;
+};
+
+// Fingerprint of the text in a story, to tell whether a saved index still applies.
+uint64_t StoryTextHash(const Story &story);
+
+// Uses <storyFile>.index if it matches story, otherwise builds the index and
+// writes it there for next time.
+void LoadOrBuildIndex(const std::string &storyFile, const Story &story, SearchIndex &index);
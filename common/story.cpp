@@ -0,0 +1,241 @@
+#include "story.h"
+#include "writer.h"
+
+#include <string.h>
+
+#include <fstream>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+
+struct Cancelled {};
+
+void Indent(FileWriter &out, bool pretty, int depth) {
+	if (!pretty) return;
+
+	out.Put('\n');
+	for (int i = 0; i < depth; ++i) {
+		out.Write("    ", 4);
+	}
+}
+
+void Key(FileWriter &out, bool pretty, int depth, const char *key, bool first = false) {
+	if (!first) out.Put(',');
+	Indent(out, pretty, depth);
+
+	out.Put('"');
+	out.Write(key, strlen(key));
+	out.Put('"');
+	out.Put(':');
+	if (pretty) out.Put(' ');
+}
+
+void ReadDialogue(json &element, Dialogue &dial) {
+	dial.ID = element["ID"];
+	dial.Text = element["Text"];
+	if (element.contains("Effect")) {
+		dial.Effect = element["Effect"];
+	}
+
+	dial.IsRandom = element.value("IsRandom", false);
+	dial.Kind = element.value("Kind", "");
+
+	if(element["IsDialogue"]) {
+		dial.IsDialogue = true;
+		dial.NextID = element["NextID"];
+	} else {
+		dial.IsDialogue = false;
+		dial.TotalChoices = element["TotalChoices"];
+		dial.TimeLimit = element.value("TimeLimit", 0.0);
+		dial.DefaultChoice = element.value("DefaultChoice", size_t(0));
+		for(size_t j = 0; j < dial.TotalChoices; ++j) {
+			json &choice = element["Choices"][std::to_string(j)];
+			size_t nextID = choice["NextID"];
+			std::string text = choice["Text"];
+			dial.Choices[nextID] = text;
+			if (choice.contains("Condition")) {
+				dial.Conditions[nextID] = choice["Condition"];
+			}
+			if (choice.contains("Weight")) {
+				dial.Weights[nextID] = choice["Weight"];
+			}
+		}
+	}
+}
+
+}
+
+void ParseDialogue(const char *begin, const char *end, Dialogue &dial) {
+	json element = json::parse(begin, end);
+	ReadDialogue(element, dial);
+}
+
+bool LoadStory(const std::string &filename, Story &story, StoryProgress *progress) {
+	std::ifstream inputFile(filename);
+	if (!inputFile) {
+		throw std::runtime_error("Cannot open " + filename);
+	}
+
+	if (progress) {
+		inputFile.seekg(0, std::ios::end);
+		progress->Total = inputFile.tellg();
+		progress->Done = 0;
+		inputFile.seekg(0, std::ios::beg);
+	}
+
+	// Each top level element is converted as soon as it is parsed and then
+	// dropped, so the whole document is never held in memory at once.
+	size_t i = 0;
+	json::parser_callback_t callback = [&](int depth, json::parse_event_t event, json &parsed) {
+		if (depth != 1 || event != json::parse_event_t::object_end) {
+			return true;
+		}
+
+		auto dial = std::make_shared<Dialogue>();
+		ReadDialogue(parsed, *dial);
+		story[dial->ID] = std::move(dial);
+		++i;
+
+		if (progress && i % 1024 == 0) {
+			if (progress->Cancel) {
+				throw Cancelled();
+			}
+			progress->Done = inputFile.tellg();
+		}
+		return false;
+	};
+
+	try {
+		// Every element was dropped by the callback, only an empty array is left.
+		json rest = json::parse(inputFile, callback);
+	} catch (Cancelled &) {
+		return false;
+	}
+
+	if (progress) {
+		progress->Done = progress->Total.load();
+	}
+	return true;
+}
+
+void WriteDialogue(FileWriter &out, const Dialogue &dial, bool pretty, int depth) {
+	out.Put('{');
+
+	Key(out, pretty, depth + 1, "IsDialogue", true);
+	out.Write(dial.IsDialogue ? "true" : "false");
+	Key(out, pretty, depth + 1, "ID");
+	out.Number(dial.ID);
+	if (!dial.Effect.empty()) {
+		Key(out, pretty, depth + 1, "Effect");
+		out.JsonString(dial.Effect);
+	}
+
+	if (dial.IsDialogue) {
+		Key(out, pretty, depth + 1, "NextID");
+		out.Number(dial.NextID);
+		Key(out, pretty, depth + 1, "Text");
+		out.JsonString(dial.Text);
+	} else {
+		if (dial.IsRandom) {
+			Key(out, pretty, depth + 1, "IsRandom");
+			out.Write("true");
+		}
+		if (!dial.Kind.empty()) {
+			Key(out, pretty, depth + 1, "Kind");
+			out.JsonString(dial.Kind);
+		}
+		if (dial.TimeLimit > 0) {
+			Key(out, pretty, depth + 1, "TimeLimit");
+			out.Double(dial.TimeLimit);
+			Key(out, pretty, depth + 1, "DefaultChoice");
+			out.Number(dial.DefaultChoice);
+		}
+		Key(out, pretty, depth + 1, "Text");
+		out.JsonString(dial.Text);
+		Key(out, pretty, depth + 1, "TotalChoices");
+		out.Number(dial.Choices.size());
+		Key(out, pretty, depth + 1, "Choices");
+		out.Put('{');
+
+		size_t j = 0;
+		for (auto &[nextID, text] : dial.Choices) {
+			Key(out, pretty, depth + 2, std::to_string(j).c_str(), j == 0);
+			out.Put('{');
+			Key(out, pretty, depth + 3, "NextID", true);
+			out.Number(nextID);
+			Key(out, pretty, depth + 3, "Text");
+			out.JsonString(text);
+			auto condition = dial.Conditions.find(nextID);
+			if (condition != dial.Conditions.end() && !condition->second.empty()) {
+				Key(out, pretty, depth + 3, "Condition");
+				out.JsonString(condition->second);
+			}
+			auto weight = dial.Weights.find(nextID);
+			if (weight != dial.Weights.end()) {
+				Key(out, pretty, depth + 3, "Weight");
+				out.Double(weight->second);
+			}
+			Indent(out, pretty, depth + 2);
+			out.Put('}');
+			++j;
+		}
+
+		if (j > 0) Indent(out, pretty, depth + 1);
+		out.Put('}');
+	}
+
+	Indent(out, pretty, depth);
+	out.Put('}');
+}
+
+bool SaveStory(const std::string &filename, const Story &story, StoryProgress *progress, bool pretty) {
+	if (progress) {
+		progress->Total = story.size();
+		progress->Done = 0;
+	}
+
+	FileWriter out(filename);
+	size_t done = 0;
+
+	out.Put('[');
+	for (auto &[id, node] : story) {
+		if (done > 0) out.Put(',');
+		Indent(out, pretty, 1);
+		WriteDialogue(out, *node, pretty, 1);
+
+		++done;
+		if (progress && done % 1024 == 0) {
+			if (progress->Cancel) {
+				// The temporary file is thrown away, the old story stays intact.
+				return false;
+			}
+			progress->Done = done;
+		}
+	}
+	if (done > 0) Indent(out, pretty, 0);
+	out.Put(']');
+	out.Put('\n');
+
+	out.Commit();
+
+	if (progress) {
+		progress->Done = done;
+	}
+	return true;
+}
+
+Dialogue &EditNode(Story &story, size_t id) {
+	auto &node = story[id];
+
+	if (!node) {
+		node = std::make_shared<Dialogue>();
+	} else if (node.use_count() > 1) {
+		node = std::make_shared<Dialogue>(*node);
+	}
+
+	return *node;
+}
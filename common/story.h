@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+
+struct Dialogue {
+	bool IsDialogue;
+
+	size_t ID;
+	size_t NextID;
+
+	std::string Text;
+
+	size_t TotalChoices;
+	std::map<size_t, std::string> Choices;
+	// A question the story answers itself: one of the choices is drawn at
+	// random, each as likely as its weight (keyed like Choices, 1 if none)
+	// against the others.
+	bool IsRandom;
+	std::map<size_t, double> Weights;
+	// Or one a plugin answers (see the engine's storykind.h): the name of its
+	// kind, and what follows a space after it is handed to the plugin.
+	std::string Kind;
+	// A question with a time limit, in seconds (0 for none), takes the choice
+	// leading to DefaultChoice once it runs out without an answer.
+	double TimeLimit = 0;
+	size_t DefaultChoice = 0;
+
+	// Story state, in the engine's expression language: assignments run on
+	// arriving at the node, and conditions on choices, keyed like Choices,
+	// that must hold for the choice to be offered. Empty means none.
+	std::string Effect;
+	std::map<size_t, std::string> Conditions;
+};
+
+// Nodes are reference counted so that copying the map (a snapshot) shares
+// every node with the live story instead of duplicating its text.
+// Always go through EditNode() to modify a node.
+typedef std::map<size_t, std::shared_ptr<Dialogue>> Story;
+
+// Progress of a load or save, shared between a worker thread and the UI.
+struct StoryProgress {
+	std::atomic<size_t> Done{0};
+	std::atomic<size_t> Total{0};
+	std::atomic<bool> Cancel{false};
+};
+
+// Both return false if cancelled through progress->Cancel, and throw on I/O or parse errors.
+// LoadStory() adds to story, it does not clear it first. Nodes are keyed by their ID.
+// SaveStory() streams every node into a temporary file and renames it over
+// filename once complete; pretty selects indented or compact output.
+bool LoadStory(const std::string &filename, Story &story, StoryProgress *progress = nullptr);
+bool SaveStory(const std::string &filename, const Story &story, StoryProgress *progress = nullptr, bool pretty = true);
+
+// A single node in the same JSON form the story file uses.
+class FileWriter;
+void WriteDialogue(FileWriter &out, const Dialogue &dial, bool pretty = false, int depth = 0);
+void ParseDialogue(const char *begin, const char *end, Dialogue &dial);
+
+// Returns a node that is safe to modify, creating it if needed and
+// cloning it if a snapshot still shares it.
+Dialogue &EditNode(Story &story, size_t id);
@@ -0,0 +1,164 @@
+#include "writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+
+std::runtime_error Error(const std::string &what, const std::string &filename) {
+	return std::runtime_error(what + " " + filename + ": " + strerror(errno));
+}
+
+}
+
+FileWriter::FileWriter(const std::string &filename, Mode mode, size_t bufferSize)
+	: filename(filename), mode(mode), buffer(bufferSize) {
+	if (mode == Append) {
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			throw Error("Cannot open", filename);
+		}
+		written = lseek(fd, 0, SEEK_END);
+		return;
+	}
+
+	tempName = filename + ".tmp";
+	fd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		throw Error("Cannot create", tempName);
+	}
+}
+
+FileWriter::~FileWriter() {
+	if (mode == Append) {
+		// Whatever was not synced is lost, like on a crash.
+		close(fd);
+	} else if (!committed) {
+		close(fd);
+		unlink(tempName.c_str());
+	}
+}
+
+void FileWriter::Write(const char *data, size_t size) {
+	if (used + size > buffer.size()) {
+		Flush();
+
+		if (size > buffer.size()) {
+			// Too big to be worth copying, hand it to the kernel as is.
+			WriteAll(data, size);
+			written += size;
+			return;
+		}
+	}
+	memcpy(buffer.data() + used, data, size);
+	used += size;
+}
+
+void FileWriter::Number(size_t value) {
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	Write(digits, result.ptr - digits);
+}
+
+void FileWriter::Double(double value) {
+	char digits[32];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	Write(digits, result.ptr - digits);
+}
+
+void FileWriter::JsonString(const std::string &text) {
+	static const char hex[] = "0123456789abcdef";
+
+	Put('"');
+
+	// Copy runs of plain characters in one go, only escapes are written one by one.
+	const char *run = text.data();
+	const char *end = run + text.size();
+	for (const char *p = run; p != end; ++p) {
+		unsigned char c = *p;
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		Write(run, p - run);
+		run = p + 1;
+
+		Put('\\');
+		switch (c) {
+		case '"': Put('"'); break;
+		case '\\': Put('\\'); break;
+		case '\b': Put('b'); break;
+		case '\f': Put('f'); break;
+		case '\n': Put('n'); break;
+		case '\r': Put('r'); break;
+		case '\t': Put('t'); break;
+		default:
+			Write("u00", 3);
+			Put(hex[c >> 4]);
+			Put(hex[c & 0xf]);
+			break;
+		}
+	}
+	Write(run, end - run);
+
+	Put('"');
+}
+
+void FileWriter::Flush() {
+	WriteAll(buffer.data(), used);
+	written += used;
+	used = 0;
+}
+
+void FileWriter::WriteAll(const char *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			throw Error("Cannot write", mode == Append ? filename : tempName);
+		}
+		data += n;
+		size -= n;
+	}
+}
+
+void FileWriter::Sync() {
+	Flush();
+
+	if (fdatasync(fd) != 0) {
+		throw Error("Cannot sync", filename);
+	}
+}
+
+void FileWriter::Commit() {
+	Flush();
+
+	if (fsync(fd) != 0) {
+		throw Error("Cannot sync", tempName);
+	}
+	close(fd);
+	committed = true;
+
+	if (rename(tempName.c_str(), filename.c_str()) != 0) {
+		unlink(tempName.c_str());
+		throw Error("Cannot replace", filename);
+	}
+
+	// Make the rename itself durable.
+	std::string dir = ".";
+	size_t slash = filename.rfind('/');
+	if (slash != std::string::npos) {
+		dir = slash ? filename.substr(0, slash) : "/";
+	}
+	int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirFd >= 0) {
+		fsync(dirFd);
+		close(dirFd);
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Buffered file output. Errors throw std::runtime_error.
+//
+// Replace writes into a temporary file next to the target and Commit() renames
+// it over the target, so a crash or error never leaves a half written file;
+// the temporary file is discarded if the writer is destroyed uncommitted.
+// Append writes to the end of the target directly and Sync() makes it durable.
+class FileWriter {
+public:
+	enum Mode { Replace, Append };
+
+	explicit FileWriter(const std::string &filename, Mode mode = Replace, size_t bufferSize = 1 << 20);
+	~FileWriter();
+
+	void Write(const char *data, size_t size);
+	void Write(const std::string &text) { Write(text.data(), text.size()); }
+	void Put(char c) {
+		if (used == buffer.size()) Flush();
+		buffer[used++] = c;
+	}
+	void Number(size_t value);
+	// Shortest form that reads back as the same double.
+	void Double(double value);
+	// Writes text as a quoted JSON string.
+	void JsonString(const std::string &text);
+
+	void Flush();
+	void Commit();
+	void Sync();
+
+	// In Append mode this includes what the file held before.
+	size_t Written() const { return written + used; }
+
+private:
+	void WriteAll(const char *data, size_t size);
+
+	std::string filename;
+	std::string tempName;
+	Mode mode;
+	int fd;
+	std::vector<char> buffer;
+	size_t used = 0;
+	size_t written = 0;
+	bool committed = false;
+};
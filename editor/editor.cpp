@@ -15,91 +15,79 @@
 #include "imgui_impl_sdlrenderer2.h"
 #include "imgui_stdlib.h"
 
+#include <algorithm>
 #include <stdio.h>
-#include <fstream>
-#include <iostream>
+#include <sys/stat.h>
 
 #include <SDL2/SDL.h>
-#include <nlohmann/json.hpp>
 
-using json = nlohmann::json;
+#include "story.h"
+#include "job.h"
+#include "journal.h"
+#include "search.h"
+#include "graph.h"
+#include "renumber.h"
 
-struct Dialogue {
-	bool IsDialogue;
 
-	size_t ID;
-	size_t NextID;
-
-	std::string Text;
+#if !SDL_VERSION_ATLEAST(2,0,17)
+#error This backend requires SDL 2.0.17+ because of SDL_RenderGeometry() function
+#endif
 
-	size_t TotalChoices;
-	std::map<size_t, std::string> Choices;
+// The journal is compacted into a full save once it is bigger than this
+// and a quarter of the last save, so compaction stays proportional to editing.
+static const size_t JournalCompactSize = 8 << 20;
+
+// The "Edit Text" tab edits a copy of one node's text, grown as needed through
+// the imgui_stdlib resize callback. The copy is refreshed only when another node
+// is selected or the node is replaced underneath, and written back once the
+// edit is finished, so nothing proportional to the text happens per frame.
+struct TextEdit {
+	size_t id = SIZE_MAX;
+	std::weak_ptr<Dialogue> node;
+	std::string text;
+	bool dirty = false;
+	bool active = false;
 };
 
-void LoadStory(std::string filename, std::map<size_t, Dialogue> &story) {
-	std::ifstream inputFile(filename);
-
-	json data = json::parse(inputFile);
-
-	for (size_t i = 0;; ++i) {
-		auto element = data[i];
-
-		if (element == nullptr) break;
-
-		story[i].ID = element["ID"];
-		story[i].Text = element["Text"];
-
-		if(element["IsDialogue"]) {
-			story[i].IsDialogue = true;
-			story[i].NextID = element["NextID"];
-		} else {
-			story[i].IsDialogue = false;
-			story[i].TotalChoices = element["TotalChoices"];
-			for(size_t j = 0; j < story[i].TotalChoices; ++j) {
-				size_t nextID = element["Choices"][std::to_string(j)]["NextID"];
-				std::string text = element["Choices"][std::to_string(j)]["Text"];
-				story[i].Choices[nextID] = text;
-			}
-		}
-	}
+static const char *ProblemText(unsigned problems) {
+	if (problems & StoryGraph::Dangling) return "Leads to a missing node";
+	if (problems & StoryGraph::DeadEnd) return "Question without answers";
+	if (problems & StoryGraph::Unreachable) return "Cannot be reached from node 0";
+	return "";
 }
-					
-void SaveStory(std::string filename, std::map<size_t, Dialogue> &story) {
-	json data;
-
-	for (size_t i = 0; story.find(i) != story.end(); ++i) {
-		auto &element = data[i];
-
-		element["ID"] = story[i].ID;
-		element["Text"] = story[i].Text;
 
-		if(story[i].IsDialogue) {
-			element["IsDialogue"] = true;
-			element["NextID"] = story[i].NextID;
-		} else {
-			element["IsDialogue"] = false;
-			size_t j = 0;
-			element["TotalChoices"] = story[i].TotalChoices;
-			for (auto [nextID, text] : story[i].Choices) {
-				element["Choices"][std::to_string(j)]["NextID"] = nextID;
-				element["Choices"][std::to_string(j)]["Text"] = text;
-				++j;
-			}
-		}
+// Lists a node in the left pane, coloured by its worst problem.
+static void NodeSelectable(size_t id, size_t &selected, const StoryGraph &graph) {
+	unsigned problems = graph.Problems(id);
+	if (problems & (StoryGraph::Dangling | StoryGraph::DeadEnd)) {
+		ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.4f, 0.4f, 1.0f));
+	} else if (problems & StoryGraph::Unreachable) {
+		ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.8f, 0.3f, 1.0f));
 	}
 
-	std::ofstream outputFile(filename);
-	outputFile  << std::setw(4) << data << std::endl;
+	if (ImGui::Selectable(std::to_string(id).c_str(), selected == id)) {
+		selected = id;
+	}
 
+	if (problems) {
+		ImGui::PopStyleColor();
+		ImGui::SetItemTooltip("%s", ProblemText(problems));
+	}
 }
 
-
-#if !SDL_VERSION_ATLEAST(2,0,17)
-#error This backend requires SDL 2.0.17+ because of SDL_RenderGeometry() function
-#endif
+static size_t FileSize(const std::string &filename) {
+	struct stat st;
+	return stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+}
 
 // Main code
 int main(int argc, char **argv) {
+	std::string filename = "story.json";
+
+	if (argc == 2) {
+		filename = argv[1];
+	}
+
 	// Setup SDL
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0) {
 		printf("Error: %s\n", SDL_GetError());
@@ -139,7 +127,16 @@ int main(int argc, char **argv) {
 	ImGui_ImplSDLRenderer2_Init(renderer);
 
 	// Our state
-	std::map<size_t, Dialogue> story;
+	Story story;
+	StoryJob job;
+	Journal journal;
+	size_t savedSize = 0;
+	TextEdit textEdit;
+	SearchIndex index;
+	StoryGraph graph;
+	std::string filter;
+	std::vector<size_t> filtered;
+	bool filterStale = false;
 	bool createNodeWindow = false;
 	bool removeNodeWindow = false;
 	bool addAnswerWindow = false;
@@ -147,6 +144,30 @@ int main(int argc, char **argv) {
 	bool editNextIDWindow = false;
 	ImVec4 clearColor = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
+	// Everything that follows the story is told about each finished edit here.
+	auto committed = [&](size_t id) {
+		auto it = story.find(id);
+		if (it != story.end()) {
+			journal.Put(it->second);
+			index.Update(id, it->second.get());
+			graph.Update(id, it->second.get());
+		} else {
+			journal.Erase(id);
+			index.Update(id, nullptr);
+			graph.Update(id, nullptr);
+		}
+
+		if (index.NeedsRebuild()) {
+			index.Build(story);
+		}
+		filterStale = true;
+	};
+
+	if (FILE *file = fopen(filename.c_str(), "r")) {
+		fclose(file);
+		StartLoad(job, filename);
+	}
+
 	// Main loop
 	bool done = false;
 	while (!done) {
@@ -168,19 +189,48 @@ int main(int argc, char **argv) {
 			continue;
 		}
 
+		switch (PollJob(job, story, index, graph)) {
+		case StoryJob::Load:
+			filterStale = true;
+			// Pending text edits belonged to the story that was just replaced.
+			textEdit = TextEdit();
+			journal.Open(filename);
+			savedSize = FileSize(filename);
+			break;
+		case StoryJob::Save:
+			journal.DropRotated();
+			if (!journal.IsOpen()) {
+				journal.Open(filename);
+			}
+			savedSize = FileSize(filename);
+			break;
+		default:
+			break;
+		}
+
+		if (job.kind == StoryJob::None && journal.Size() > JournalCompactSize && journal.Size() > savedSize / 4) {
+			journal.Rotate();
+			StartSave(job, filename, story);
+		}
+
 		// Start the Dear ImGui frame
 		ImGui_ImplSDLRenderer2_NewFrame();
 		ImGui_ImplSDL2_NewFrame();
 		ImGui::NewFrame();
 
+		static size_t selected = 0;
 		ImGui::Begin("Workshop", &done, ImGuiWindowFlags_MenuBar);
 		if (ImGui::BeginMenuBar()) {
 			if (ImGui::BeginMenu("File")) {
-				if (ImGui::MenuItem("Open..", "Ctrl+O")) {
-					LoadStory("story.json", story);
+				bool idle = job.kind == StoryJob::None;
+				if (ImGui::MenuItem("Open..", "Ctrl+O", false, idle)) {
+					// Whatever is loaded replaces the current story, edits included.
+					journal.Close();
+					StartLoad(job, filename);
 				}
-				if (ImGui::MenuItem("Save", "Ctrl+S")) {
-					SaveStory("story.json", story);
+				if (ImGui::MenuItem("Save", "Ctrl+S", false, idle)) {
+					journal.Rotate();
+					StartSave(job, filename, story);
 				}
 				if (ImGui::MenuItem("Quit", "Ctrl+Q")) {
 					done = true;
@@ -194,18 +244,53 @@ int main(int argc, char **argv) {
 				if (ImGui::MenuItem("Remove Node", "Ctrl+D")) {
 					removeNodeWindow = true;
 				}
+				ImGui::Separator();
+				if (ImGui::MenuItem("Compact IDs", nullptr, false, job.kind == StoryJob::None)) {
+					IdMap ids = RenumberStory(story);
+					auto it = std::lower_bound(ids.begin(), ids.end(), std::make_pair(selected, size_t(0)));
+					selected = it != ids.end() && it->first == selected ? it->second : 0;
+					textEdit = TextEdit();
+					index.Build(story);
+					graph.Build(story);
+					filterStale = true;
+
+					// Every node moved, so the journal is no use; save the lot.
+					SaveIdMap(filename + ".idmap", ids);
+					journal.Rotate();
+					StartSave(job, filename, story);
+				}
 				ImGui::EndMenu();
 			}
 			ImGui::EndMenuBar();
 		}
 
-		static size_t selected = 0;
 		{
 			ImGui::BeginChild("left pane", ImVec2(150, 0), ImGuiChildFlags_Borders | ImGuiChildFlags_ResizeX);
 
-			for(auto [id, dial] : story) {
-				if (ImGui::Selectable(std::to_string(dial.ID).c_str(), selected == id)) {
-					selected = id;
+			ImGui::SetNextItemWidth(-FLT_MIN);
+			filterStale |= ImGui::InputTextWithHint("##filter", "Search", &filter);
+			if (filterStale && !filter.empty()) {
+				filtered = index.Search(filter, story);
+				filterStale = false;
+			}
+
+			size_t dangling = graph.Count(StoryGraph::Dangling) + graph.Count(StoryGraph::DeadEnd);
+			size_t unreachable = graph.Count(StoryGraph::Unreachable);
+			if (dangling || unreachable) {
+				ImGui::TextDisabled("%lu broken, %lu unreachable", dangling, unreachable);
+			}
+
+			if (filter.empty()) {
+				for(const auto &[id, dial] : story) {
+					NodeSelectable(id, selected, graph);
+				}
+			} else {
+				ImGuiListClipper clipper;
+				clipper.Begin(filtered.size());
+				while (clipper.Step()) {
+					for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+						NodeSelectable(filtered[i], selected, graph);
+					}
 				}
 			}
 
@@ -219,7 +304,9 @@ int main(int argc, char **argv) {
 			ImGui::Text("ID: %lu", selected);
 			ImGui::Separator();
 			if (ImGui::BeginTabBar("##Tabs", ImGuiTabBarFlags_None)) {
-				auto &dial = story[selected];
+				static const Dialogue none = {};
+				auto it = story.find(selected);
+				const Dialogue &dial = it != story.end() ? *it->second : none;
 				if (ImGui::BeginTabItem("Info")) {
 					if (dial.IsDialogue) {
 						ImGui::Text("Next ID: %lu", dial.NextID);
@@ -227,8 +314,67 @@ int main(int argc, char **argv) {
 						if (ImGui::Button("Edit Next ID")) {
 							editNextIDWindow = true;
 						}
-					} else {
-						ImGui::TextWrapped("Is a question");
+					} else if (it != story.end()) {
+						ImGui::TextWrapped(!dial.Kind.empty() ? "Is answered by a plugin" : dial.IsRandom ? "Is a random branch" : "Is a question");
+						bool random = dial.IsRandom;
+						if (ImGui::Checkbox("Drawn at random", &random)) {
+							EditNode(story, selected).IsRandom = random;
+							committed(selected);
+						}
+
+						static std::string kind;
+						static const Dialogue *kindOf = nullptr;
+						if (kindOf != &dial) {
+							kind = dial.Kind;
+							kindOf = &dial;
+						}
+						if (ImGui::InputTextWithHint("Kind", "answered by the player", &kind, ImGuiInputTextFlags_EnterReturnsTrue)) {
+							EditNode(story, selected).Kind = kind;
+							committed(selected);
+						}
+
+						// Seconds to answer in, 0 for no limit; then the default is taken.
+						double timeLimit = dial.TimeLimit;
+						if (ImGui::InputDouble("Time limit", &timeLimit, 1, 10, "%g s", ImGuiInputTextFlags_EnterReturnsTrue)) {
+							EditNode(story, selected).TimeLimit = std::max(timeLimit, 0.0);
+							committed(selected);
+						}
+						if (dial.TimeLimit > 0) {
+							auto current = dial.Choices.find(dial.DefaultChoice);
+							std::string preview = current != dial.Choices.end() ? std::to_string(current->first) + " -> " + current->second : "none";
+							size_t chosen = SIZE_MAX;
+							if (ImGui::BeginCombo("Default choice", preview.c_str())) {
+								for (auto &[id, text] : dial.Choices) {
+									std::string label = std::to_string(id) + " -> " + text;
+									if (ImGui::Selectable(label.c_str(), id == dial.DefaultChoice)) {
+										chosen = id;
+									}
+								}
+								ImGui::EndCombo();
+							}
+							if (chosen != SIZE_MAX) {
+								EditNode(story, selected).DefaultChoice = chosen;
+								committed(selected);
+							}
+						}
+					}
+
+					// Committed on Enter; a copy until then, refreshed when the node changes.
+					static std::string effect;
+					static const Dialogue *effectOf = nullptr;
+					if (effectOf != &dial) {
+						effect = dial.Effect;
+						effectOf = &dial;
+					}
+					if (ImGui::InputTextWithHint("Effect", "gold += 5; met_jack = 1", &effect, ImGuiInputTextFlags_EnterReturnsTrue) && it != story.end()) {
+						EditNode(story, selected).Effect = effect;
+						committed(selected);
+					}
+
+					for (unsigned problem : {StoryGraph::Dangling, StoryGraph::DeadEnd, StoryGraph::Unreachable}) {
+						if (graph.Problems(selected) & problem) {
+							ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", ProblemText(problem));
+						}
 					}
 
 					ImGui::EndTabItem();
@@ -238,17 +384,54 @@ int main(int argc, char **argv) {
 					ImGui::EndTabItem();
 				}
 				if (ImGui::BeginTabItem("Edit Text")) {
-					char buffer[1024 * 16];
-					strcpy(buffer, dial.Text.c_str());
-					if(ImGui::InputTextMultiline("Edit", buffer, IM_ARRAYSIZE(buffer), ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 16), ImGuiInputTextFlags_CtrlEnterForNewLine | ImGuiInputTextFlags_EnterReturnsTrue)) {
-						dial.Text = std::string(buffer);
+					if (!textEdit.dirty && (textEdit.id != selected || textEdit.node.lock().get() != &dial)) {
+						textEdit.id = selected;
+						textEdit.node = it != story.end() ? it->second : nullptr;
+						textEdit.text = dial.Text;
 					}
+
+					// A new ID per node, so ImGui drops its own copy of the previous node's text.
+					ImGui::PushID((int)textEdit.id);
+					if (ImGui::InputTextMultiline("Edit", &textEdit.text, ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 16), ImGuiInputTextFlags_CtrlEnterForNewLine | ImGuiInputTextFlags_EnterReturnsTrue)) {
+						textEdit.active = false;
+					} else {
+						textEdit.active = ImGui::IsItemActive();
+					}
+					textEdit.dirty |= ImGui::IsItemEdited();
+					ImGui::PopID();
+
 					ImGui::EndTabItem();
+				} else {
+					textEdit.active = false;
+				}
+
+				// Enter, leaving the field, switching node or tab all finish the edit.
+				if (textEdit.dirty && (!textEdit.active || textEdit.id != selected)) {
+					if (story.count(textEdit.id)) {
+						EditNode(story, textEdit.id).Text = textEdit.text;
+						committed(textEdit.id);
+						textEdit.node = story[textEdit.id];
+					}
+					textEdit.dirty = false;
 				}
 				if (!dial.IsDialogue) {
 					if (ImGui::BeginTabItem("Answers")) {
-						for(auto [id, text] : dial.Choices) {
-							ImGui::TextWrapped("%lu -> %s", id, text.c_str());
+						size_t number = 0;
+						for(const auto &[id, text] : dial.Choices) {
+							auto condition = dial.Conditions.find(id);
+							auto weight = dial.Weights.find(id);
+							if (!dial.Kind.empty()) {
+								// Plugins pick answers by their place.
+								ImGui::TextWrapped("%lu -> %s  (answer %zu)", id, text.c_str(), number++);
+							} else if (dial.IsRandom) {
+								ImGui::TextWrapped("%lu -> %s  (weight %g)", id, text.c_str(), weight != dial.Weights.end() ? weight->second : 1.0);
+							} else if (condition != dial.Conditions.end()) {
+								ImGui::TextWrapped("%lu -> %s  (if %s)", id, text.c_str(), condition->second.c_str());
+							} else if (dial.TimeLimit > 0 && id == dial.DefaultChoice) {
+								ImGui::TextWrapped("%lu -> %s  (after %g s)", id, text.c_str(), dial.TimeLimit);
+							} else {
+								ImGui::TextWrapped("%lu -> %s", id, text.c_str());
+							}
 						}
 
 						if (ImGui::Button("Add answer")) {
@@ -267,6 +450,24 @@ int main(int argc, char **argv) {
 				ImGui::EndTabBar();
 			}
 			ImGui::EndChild();
+
+			if (job.kind != StoryJob::None) {
+				size_t done = job.progress.Done;
+				size_t total = job.progress.Total;
+				float fraction = total ? (float)done / total : 0.0f;
+				float cancelWidth = ImGui::CalcTextSize("Cancel").x + ImGui::GetStyle().FramePadding.x * 2 + ImGui::GetStyle().ItemSpacing.x;
+
+				ImGui::ProgressBar(fraction, ImVec2(-cancelWidth, 0), job.kind == StoryJob::Load ? "Loading..." : "Saving...");
+				ImGui::SameLine();
+				if (ImGui::Button("Cancel")) {
+					job.progress.Cancel = true;
+				}
+			} else if (std::string error = journal.Error(); !error.empty()) {
+				ImGui::Text("Journal stopped: %s", error.c_str());
+			} else {
+				ImGui::TextUnformatted(job.status.c_str());
+			}
+
 			ImGui::EndGroup();
 		}
 
@@ -284,10 +485,31 @@ int main(int argc, char **argv) {
 			}
 			
 			ImGui::InputText("Answer", &data);
+			static std::string condition;
+			static double weight = 1;
+			auto it = story.find(selected);
+			bool random = it != story.end() && it->second->IsRandom;
+			if (random) {
+				ImGui::InputDouble("Weight", &weight);
+			} else {
+				ImGui::InputTextWithHint("Condition", "always offered", &condition);
+			}
 
 			if (ImGui::Button("Add Answer")) {
-				story[selected].Choices[id] = data;
-				story[selected].TotalChoices++;
+				Dialogue &dial = EditNode(story, selected);
+				dial.Choices[id] = data;
+				if (condition.empty() || random) {
+					dial.Conditions.erase(id);
+				} else {
+					dial.Conditions[id] = condition;
+				}
+				if (random && weight != 1) {
+					dial.Weights[id] = weight;
+				} else {
+					dial.Weights.erase(id);
+				}
+				dial.TotalChoices = dial.Choices.size();
+				committed(selected);
 				addAnswerWindow = false;
 			}
 			ImGui::SameLine();
@@ -309,8 +531,12 @@ int main(int argc, char **argv) {
 			}
 			
 			if (ImGui::Button("Remove Answer")) {
-				story[selected].Choices.erase(id);
-				story[selected].TotalChoices--;
+				Dialogue &dial = EditNode(story, selected);
+				dial.Choices.erase(id);
+				dial.Conditions.erase(id);
+				dial.Weights.erase(id);
+				dial.TotalChoices--;
+				committed(selected);
 				removeAnswerWindow = false;
 			}
 			ImGui::SameLine();
@@ -335,7 +561,8 @@ int main(int argc, char **argv) {
 			ImGui::Checkbox("Is dialogue?", &dialogue.IsDialogue);
 
 			if (ImGui::Button("Create Node")) {
-				story[dialogue.ID] = dialogue;
+				EditNode(story, dialogue.ID) = dialogue;
+				committed(dialogue.ID);
 				createNodeWindow = false;
 			}
 			ImGui::SameLine();
@@ -355,9 +582,67 @@ int main(int argc, char **argv) {
 			if(ImGui::InputText("ID", buffer, IM_ARRAYSIZE(buffer), 0)) {
 				id = atoi(buffer);
 			}
-			
+
+			// What to do with the nodes that lead to the removed one.
+			enum { Leave, Unlink, Redirect };
+			static int fix = Leave;
+			static size_t redirect;
+
+			const std::vector<size_t> &incoming = graph.Incoming(id);
+			if (!incoming.empty()) {
+				ImGui::Text("%lu nodes lead here:", incoming.size());
+				ImGui::BeginChild("incoming", ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * std::min<size_t>(incoming.size(), 6)), ImGuiChildFlags_Borders);
+				for (size_t from : incoming) {
+					if (ImGui::Selectable(std::to_string(from).c_str(), selected == from)) {
+						selected = from;
+					}
+				}
+				ImGui::EndChild();
+
+				ImGui::RadioButton("Leave them dangling", &fix, Leave);
+				ImGui::RadioButton("Remove the links", &fix, Unlink);
+				ImGui::RadioButton("Redirect them to", &fix, Redirect);
+				if (fix == Redirect) {
+					static char redirectBuffer[64] = {0};
+					ImGui::SameLine();
+					if (ImGui::InputText("##redirect", redirectBuffer, IM_ARRAYSIZE(redirectBuffer), 0)) {
+						redirect = atoi(redirectBuffer);
+					}
+				}
+			}
+
 			if (ImGui::Button("Remove Node")) {
+				if (fix != Leave) {
+					// Copied, the graph changes with every fixed node.
+					std::vector<size_t> sources = incoming;
+					for (size_t from : sources) {
+						if (from == id) continue;
+
+						Dialogue &dial = EditNode(story, from);
+						if (dial.IsDialogue) {
+							dial.NextID = fix == Redirect ? redirect : 0;
+						} else {
+							std::string text = dial.Choices[id];
+							std::string condition = dial.Conditions[id];
+							auto weight = dial.Weights.find(id);
+							double oldWeight = weight != dial.Weights.end() ? weight->second : 1;
+							dial.Choices.erase(id);
+							dial.Conditions.erase(id);
+							dial.Weights.erase(id);
+							if (fix == Redirect) {
+								dial.Choices.emplace(redirect, text);
+								if (!condition.empty()) dial.Conditions.emplace(redirect, condition);
+								if (oldWeight != 1) dial.Weights.emplace(redirect, oldWeight);
+								if (dial.DefaultChoice == id) dial.DefaultChoice = redirect;
+							}
+							dial.TotalChoices = dial.Choices.size();
+						}
+						committed(from);
+					}
+				}
+
 				story.erase(id);
+				committed(id);
 				removeNodeWindow = false;
 			}
 			ImGui::SameLine();
@@ -379,7 +664,8 @@ int main(int argc, char **argv) {
 			}
 			
 			if (ImGui::Button("Alter NextID")) {
-				story[selected].NextID = id;
+				EditNode(story, selected).NextID = id;
+				committed(selected);
 				editNextIDWindow = false;
 			}
 			ImGui::SameLine();
@@ -400,6 +686,9 @@ int main(int argc, char **argv) {
 	}
 
 	// Cleanup
+	WaitJob(job);
+	journal.Close();
+
 	ImGui_ImplSDLRenderer2_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext();
@@ -0,0 +1,100 @@
+#include "job.h"
+#include "journal.h"
+
+#include <exception>
+
+namespace {
+
+void Start(StoryJob &job, StoryJob::Kind kind, const std::string &filename) {
+	job.kind = kind;
+	job.filename = filename;
+	job.finished = false;
+	job.cancelled = false;
+	job.error.clear();
+	job.progress.Done = 0;
+	job.progress.Total = 0;
+	job.progress.Cancel = false;
+
+	job.worker = std::thread([&job]() {
+		try {
+			if (job.kind == StoryJob::Load) {
+				job.cancelled = !LoadStory(job.filename, job.story, &job.progress);
+				if (!job.cancelled) {
+					ReplayJournal(job.filename, job.story);
+					LoadOrBuildIndex(job.filename, job.story, job.index);
+					job.graph.Build(job.story);
+				}
+			} else {
+				job.cancelled = !SaveStory(job.filename, job.story, &job.progress);
+			}
+		} catch (std::exception &e) {
+			job.error = e.what();
+		}
+
+		// Drop our references here so the UI thread can edit nodes in place again.
+		if (job.kind == StoryJob::Save || job.cancelled || !job.error.empty()) {
+			job.story.clear();
+		}
+
+		job.finished = true;
+	});
+}
+
+}
+
+void StartLoad(StoryJob &job, const std::string &filename) {
+	job.story.clear();
+	Start(job, StoryJob::Load, filename);
+}
+
+void StartSave(StoryJob &job, const std::string &filename, const Story &story) {
+	// Copies pointers only: the nodes are shared until the UI edits one of them.
+	job.story = story;
+	Start(job, StoryJob::Save, filename);
+}
+
+StoryJob::Kind PollJob(StoryJob &job, Story &story, SearchIndex &index, StoryGraph &graph) {
+	if (job.kind == StoryJob::None || !job.finished) {
+		return StoryJob::None;
+	}
+
+	job.worker.join();
+
+	const char *what = job.kind == StoryJob::Load ? "Load" : "Save";
+	StoryJob::Kind succeeded = StoryJob::None;
+	if (!job.error.empty()) {
+		job.status = std::string(what) + " failed: " + job.error;
+	} else if (job.cancelled) {
+		job.status = std::string(what) + " cancelled";
+	} else {
+		job.status = std::string(job.kind == StoryJob::Load ? "Loaded " : "Saved ") + job.filename;
+		succeeded = job.kind;
+
+		if (job.kind == StoryJob::Load) {
+			story.swap(job.story);
+			index = std::move(job.index);
+			job.index = SearchIndex();
+			graph = std::move(job.graph);
+			job.graph = StoryGraph();
+
+			// Freeing a large story takes a while, keep it off the UI thread.
+			std::thread([old = std::move(job.story)]() mutable {
+				old.clear();
+			}).detach();
+			job.story = Story();
+		}
+	}
+
+	job.kind = StoryJob::None;
+	return succeeded;
+}
+
+void WaitJob(StoryJob &job) {
+	if (job.worker.joinable()) {
+		// A pending load is useless once we quit, a pending save is not.
+		if (job.kind == StoryJob::Load) {
+			job.progress.Cancel = true;
+		}
+		job.worker.join();
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "story.h"
+#include "search.h"
+#include "graph.h"
+
+// One background load or save at a time. The UI thread starts it and calls
+// PollJob() once per frame; the worker never touches the live story.
+// A load includes replaying the journal left by the last session and
+// loading or building the search index, and checking the graph.
+struct StoryJob {
+	enum Kind { None, Load, Save };
+
+	Kind kind = None;
+	std::string filename;
+	std::thread worker;
+	std::atomic<bool> finished{false};
+	StoryProgress progress;
+
+	// Load: the story being built, its index and graph. Save: the snapshot being written.
+	Story story;
+	SearchIndex index;
+	StoryGraph graph;
+
+	bool cancelled = false;
+	std::string error;
+	std::string status;
+};
+
+void StartLoad(StoryJob &job, const std::string &filename);
+void StartSave(StoryJob &job, const std::string &filename, const Story &story);
+
+// Swaps a finished load into story, index and graph. Returns the kind of job that
+// completed successfully this frame, None otherwise.
+StoryJob::Kind PollJob(StoryJob &job, Story &story, SearchIndex &index, StoryGraph &graph);
+
+// Called on exit: cancels a pending load, lets a pending save finish.
+void WaitJob(StoryJob &job);
@@ -0,0 +1,133 @@
+#include "analytics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdexcept>
+
+namespace {
+
+const uint8_t SnapshotVersion = 1;
+
+void PutVarint(std::string &out, uint64_t value) {
+	while (value >= 0x80) {
+		out += char(value | 0x80);
+		value >>= 7;
+	}
+	out += char(value);
+}
+
+}
+
+Analytics::Analytics(const CompiledStory &story) : story(story) {}
+
+Analytics::~Analytics() {
+	if (snapshots.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		snapshots.join();
+		try {
+			Save(snapshotPath);
+		} catch (std::runtime_error &e) {
+			fprintf(stderr, "%s\n", e.what());
+		}
+	}
+
+	for (auto &shard : shards) {
+		if (local == shard.get()) {
+			local = nullptr;
+		}
+	}
+}
+
+void Analytics::Attach() {
+	auto shard = std::make_unique<Shard>();
+	size_t count = story.Size() + story.ChoiceCount();
+	shard->counters.reset(new std::atomic<uint64_t>[count + 2 * Shard::Padding]());
+	shard->nodes = shard->counters.get() + Shard::Padding;
+	shard->choices = shard->nodes + story.Size();
+	local = shard.get();
+
+	std::lock_guard<std::mutex> guard(lock);
+	shards.push_back(std::move(shard));
+}
+
+void Analytics::Totals(std::vector<uint64_t> &nodes, std::vector<uint64_t> &choices) const {
+	nodes.assign(story.Size(), 0);
+	choices.assign(story.ChoiceCount(), 0);
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (const auto &shard : shards) {
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			nodes[i] += shard->nodes[i].load(std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < choices.size(); ++i) {
+			choices[i] += shard->choices[i].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void Analytics::Save(const std::string &path) const {
+	std::vector<uint64_t> nodes, choices;
+	Totals(nodes, choices);
+
+	std::string out;
+	out += char(SnapshotVersion);
+	uint64_t hash = story.Hash();
+	out.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
+	PutVarint(out, time(nullptr));
+
+	PutVarint(out, nodes.size());
+	size_t previous = 0;
+	for (uint32_t node = 0; node < nodes.size(); ++node) {
+		PutVarint(out, story[node].id - previous);
+		PutVarint(out, nodes[node]);
+		previous = story[node].id;
+	}
+
+	PutVarint(out, choices.size());
+	uint32_t from = 0;
+	for (uint32_t node = 0; node < nodes.size(); ++node) {
+		const CompiledStory::Node &at = story[node];
+		for (uint32_t choice = at.firstChoice; choice < at.firstChoice + at.choiceCount; ++choice) {
+			PutVarint(out, node - from);
+			PutVarint(out, story.ChoiceAt(choice).id);
+			PutVarint(out, choices[choice]);
+			from = node;
+		}
+	}
+
+	std::string temporary = path + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	bool written = file && fwrite(out.data(), 1, out.size(), file) == out.size();
+	if (file && fclose(file) != 0) {
+		written = false;
+	}
+	if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+		int error = errno;
+		remove(temporary.c_str());
+		throw std::runtime_error("Cannot write analytics to " + path + ": " + strerror(error));
+	}
+}
+
+void Analytics::SaveEvery(const std::string &path, std::chrono::seconds interval) {
+	snapshotPath = path;
+	snapshots = std::thread([this, interval] {
+		std::unique_lock<std::mutex> guard(lock);
+		while (!wake.wait_for(guard, interval, [&] { return stopping; })) {
+			// Totals() takes the lock itself, and attaching threads should not wait on the file.
+			guard.unlock();
+			try {
+				Save(snapshotPath);
+			} catch (std::runtime_error &e) {
+				fprintf(stderr, "%s\n", e.what());
+			}
+			guard.lock();
+		}
+	});
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compiled.h"
+
+// How often every node has been arrived at and every choice taken, by
+// position (see CompiledStory::ChoiceCount()), over all playthroughs on the
+// threads that count into it, going back excepted. Sessions count from
+// their start; restored ones from where they were restored.
+//
+// Each thread counts into a shard of its own that only it writes, with plain
+// increments (relaxed atomics, so a reader may look at any time), so counting
+// takes no lock and shares no cache line with another thread. Readers add up
+// the shards when they want the totals.
+class Analytics {
+public:
+	explicit Analytics(const CompiledStory &story);
+	// Takes the last snapshot, if snapshots are on. Threads still attached
+	// must no longer play.
+	~Analytics();
+
+	Analytics(const Analytics &) = delete;
+	Analytics &operator=(const Analytics &) = delete;
+
+	// Steps on the calling thread count into a shard of this from now on,
+	// until Detach().
+	void Attach();
+	static void Detach() { local = nullptr; }
+
+	// For Step() and StartSession(); nothing happens on threads not attached.
+	static void Arrived(uint32_t node) {
+		if (Shard *shard = local) shard->Add(shard->nodes[node]);
+	}
+	static void Taken(uint32_t choice) {
+		if (Shard *shard = local) shard->Add(shard->choices[choice]);
+	}
+
+	// The sums over every shard so far.
+	void Totals(std::vector<uint64_t> &nodes, std::vector<uint64_t> &choices) const;
+
+	// A snapshot of the totals, written whole into a temporary file and
+	// renamed over path; throws std::runtime_error if it cannot be:
+	//   u8 version, u64 story hash, varint Unix time,
+	//   varint node count, per node varint ID (less the one before), varint arrivals,
+	//   varint choice count, per choice varint node (less the one before, by
+	//   position), varint ID it leads to, varint times taken.
+	void Save(const std::string &path) const;
+	// Saves to path every interval on a thread of its own, and once more on
+	// destruction. Failed snapshots are skipped; the next one tries again.
+	void SaveEvery(const std::string &path, std::chrono::seconds interval);
+
+private:
+	struct Shard {
+		// A cache line of padding on either side keeps other threads' data off
+		// the lines at its ends.
+		static const size_t Padding = 64 / sizeof(uint64_t);
+		std::unique_ptr<std::atomic<uint64_t>[]> counters;
+		std::atomic<uint64_t> *nodes;
+		std::atomic<uint64_t> *choices;
+
+		// Only the owning thread writes, so no read-modify-write is needed.
+		static void Add(std::atomic<uint64_t> &counter) {
+			counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+	};
+
+	static inline thread_local Shard *local = nullptr;
+
+	const CompiledStory &story;
+	mutable std::mutex lock;
+	std::vector<std::unique_ptr<Shard>> shards;
+
+	std::string snapshotPath;
+	std::thread snapshots;
+	std::condition_variable wake;
+	bool stopping = false;
+};
@@ -0,0 +1,73 @@
+#include "bitset.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+size_t CountWords(const uint64_t *words, size_t count) {
+	size_t total = 0;
+	for (size_t i = 0; i < count; ++i) {
+		total += std::popcount(words[i]);
+	}
+	return total;
+}
+
+#if defined(__x86_64__)
+// Four words at a time: each nibble's count from a table lookup, summed
+// per 64-bit lane by vpsadbw.
+__attribute__((target("avx2")))
+size_t CountWordsAvx2(const uint64_t *words, size_t count) {
+	const __m256i lookup = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i sums = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+		__m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(block, nibble));
+		__m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble));
+		sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), sums);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + CountWords(words + i, count - i);
+}
+
+const bool HasAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+}
+
+size_t Bitset::Count() const {
+#if defined(__x86_64__)
+	if (HasAvx2) {
+		return CountWordsAvx2(words.data(), words.size());
+	}
+#endif
+	return CountWords(words.data(), words.size());
+}
+
+Bitset &Bitset::operator|=(const Bitset &other) {
+	size_t common = std::min(words.size(), other.words.size());
+	for (size_t i = 0; i < common; ++i) {
+		words[i] |= other.words[i];
+	}
+	return *this;
+}
+
+Bitset &Bitset::operator&=(const Bitset &other) {
+	size_t common = std::min(words.size(), other.words.size());
+	for (size_t i = 0; i < common; ++i) {
+		words[i] &= other.words[i];
+	}
+	std::fill(words.begin() + common, words.end(), 0);
+	return *this;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A fixed number of flags, one bit each, for things indexed by position in
+// the compiled story: nodes/8 bytes however many are set. Sets from the same
+// story can be combined, so many sessions fold into one for analytics.
+class Bitset {
+public:
+	Bitset() = default;
+	explicit Bitset(size_t bits) : words((bits + 63) / 64) {}
+
+	// Clears every bit as well.
+	void Resize(size_t bits) { words.assign((bits + 63) / 64, 0); }
+
+	void Set(size_t bit) { words[bit / 64] |= uint64_t(1) << (bit % 64); }
+	bool Test(size_t bit) const { return words[bit / 64] >> (bit % 64) & 1; }
+	// The bits set, with AVX2 where the CPU has it.
+	size_t Count() const;
+
+	// Both sets should be from the same story; bits past the shorter are
+	// taken as clear.
+	Bitset &operator|=(const Bitset &other);
+	Bitset &operator&=(const Bitset &other);
+
+	size_t Words() const { return words.size(); }
+	uint64_t *Data() { return words.data(); }
+	const uint64_t *Data() const { return words.data(); }
+
+private:
+	std::vector<uint64_t> words;
+};
@@ -0,0 +1,541 @@
+#include "compiled.h"
+#include "output.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+
+namespace {
+
+void AppendJsonString(std::string &out, std::string_view text) {
+	static const char hex[] = "0123456789abcdef";
+
+	out += '"';
+	const char *run = text.data();
+	const char *end = run + text.size();
+	for (const char *p = run; p != end; ++p) {
+		unsigned char c = *p;
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		out.append(run, p - run);
+		run = p + 1;
+
+		out += '\\';
+		switch (c) {
+		case '"': out += '"'; break;
+		case '\\': out += '\\'; break;
+		case '\b': out += 'b'; break;
+		case '\f': out += 'f'; break;
+		case '\n': out += 'n'; break;
+		case '\r': out += 'r'; break;
+		case '\t': out += 't'; break;
+		default:
+			out += "u00";
+			out += hex[c >> 4];
+			out += hex[c & 0xf];
+			break;
+		}
+	}
+	out.append(run, end - run);
+	out += '"';
+}
+
+void AppendJsonChoice(std::string &out, const CompiledStory::Choice &choice) {
+	out += "{\"NextID\":";
+	AppendNumber(out, choice.id);
+	out += ",\"Text\":";
+	AppendJsonString(out, choice.text);
+	out += '}';
+}
+
+// Returns the size of what comes before the first choice.
+size_t AppendJson(std::string &out, const CompiledStory::Choice *choices, const CompiledStory::Node &node) {
+	size_t start = out.size();
+	out += "{\"ID\":";
+	AppendNumber(out, node.id);
+	out += ",\"Text\":";
+	AppendJsonString(out, node.text);
+
+	size_t head = 0;
+	if (node.isDialogue) {
+		if (node.next == CompiledStory::End) {
+			out += ",\"End\":true";
+		}
+	} else if (!node.automatic) {
+		if (node.timeLimit) {
+			// Seconds, as the story gives them.
+			out += ",\"TimeLimit\":";
+			AppendNumber(out, node.timeLimit / 1000);
+			if (uint32_t fraction = node.timeLimit % 1000) {
+				out += '.';
+				out += char('0' + fraction / 100);
+				if (fraction % 100) out += char('0' + fraction / 10 % 10);
+				if (fraction % 10) out += char('0' + fraction % 10);
+			}
+			out += ",\"DefaultChoice\":";
+			AppendNumber(out, node.defaultChoice);
+		}
+		out += ",\"Choices\":[";
+		head = out.size() - start;
+		const CompiledStory::Choice *begin = choices + node.firstChoice;
+		for (const CompiledStory::Choice *choice = begin; choice != begin + node.choiceCount; ++choice) {
+			if (choice != begin) out += ',';
+			AppendJsonChoice(out, *choice);
+		}
+		out += ']';
+	}
+	out += '}';
+	return head;
+}
+
+void AppendConsoleChoice(std::string &out, const CompiledStory::Choice &choice) {
+	AppendNumber(out, choice.id);
+	out += " -> ";
+	out += choice.text;
+	out += '\n';
+}
+
+void AppendConsoleChoices(std::string &out, const CompiledStory::Choice *choices, const CompiledStory::Node &node) {
+	if (node.automatic) {
+		return;
+	}
+	for (const CompiledStory::Choice *choice = choices + node.firstChoice; choice != choices + node.firstChoice + node.choiceCount; ++choice) {
+		AppendConsoleChoice(out, *choice);
+	}
+}
+
+// Calls visit(offset, size, name) for each {name} in text, name being a
+// variable as scripts spell them.
+template <class Visit>
+void ForEachPlaceholder(std::string_view text, Visit visit) {
+	for (size_t open = text.find('{'); open != std::string_view::npos; open = text.find('{', open + 1)) {
+		size_t end = open + 1;
+		while (end < text.size() && (isalnum((unsigned char)text[end]) || text[end] == '_')) ++end;
+		if (end == open + 1 || end == text.size() || text[end] != '}' || isdigit((unsigned char)text[open + 1])) {
+			continue;
+		}
+		visit(open, end + 1 - open, text.substr(open + 1, end - open - 1));
+	}
+}
+
+bool Declare(Script &script, std::string_view text) {
+	bool found = false;
+	ForEachPlaceholder(text, [&](size_t, size_t, std::string_view name) {
+		script.Declare(name);
+		found = true;
+	});
+	return found;
+}
+
+void AppendInteger(std::string &out, int64_t value) {
+	char digits[24];
+	out.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+void AddToHash(uint64_t &hash, std::string_view data) {
+	for (unsigned char c : data) {
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+}
+
+}
+
+CompiledStory::CompiledStory(const Story &story, const NodeKinds *plugins) {
+	if (story.size() >= Missing) {
+		throw std::runtime_error("too many nodes");
+	}
+
+	size_t textSize = 0;
+	size_t choiceCount = 0;
+	for (auto &[id, node] : story) {
+		textSize += node->Text.size() + node->Kind.size();
+		if (!node->IsDialogue) {
+			choiceCount += node->Choices.size();
+			for (auto &[nextID, choice] : node->Choices) {
+				textSize += choice.size();
+			}
+		}
+	}
+
+	// Reserved up front: the views below point into it and must not move.
+	text.reserve(textSize);
+	ids.reserve(story.size());
+	nodes.reserve(story.size());
+	choices.reserve(choiceCount);
+	outcomes.resize(choiceCount);
+	kinds.resize(PluginKind);
+
+	auto intern = [&](const std::string &s) {
+		size_t offset = text.size();
+		text += s;
+		return std::string_view(text.data() + offset, s.size());
+	};
+
+	for (auto &[id, node] : story) {
+		ids.push_back(id);
+	}
+
+	// Scripts and weights count towards the hash as well; their source is
+	// kept only for that.
+	std::string scripts;
+	auto compile = [&](size_t id, const std::string &source, auto compileOne) {
+		scripts += std::to_string(id);
+		scripts += ':';
+		scripts += source;
+		scripts += '\n';
+		try {
+			return compileOne(source);
+		} catch (std::runtime_error &e) {
+			throw std::runtime_error("Node " + std::to_string(id) + ": " + e.what());
+		}
+	};
+
+	// Each plugin kind gets a number the first time a node names it.
+	auto kindOf = [&](size_t id, std::string_view name) {
+		for (size_t kind = PluginKind; kind < kinds.size(); ++kind) {
+			if (name == kinds[kind].name) {
+				return uint8_t(kind);
+			}
+		}
+		const StoryNodeKind *plugin = plugins ? plugins->Find(name) : nullptr;
+		if (!plugin) {
+			throw std::runtime_error("Node " + std::to_string(id) + ": no node kind \"" + std::string(name) + "\"");
+		}
+		if (kinds.size() > UINT8_MAX) {
+			throw std::runtime_error("Node " + std::to_string(id) + ": too many node kinds");
+		}
+		kinds.push_back(*plugin);
+		return uint8_t(kinds.size() - 1);
+	};
+
+	for (auto &[id, node] : story) {
+		Node compiled = {};
+		compiled.id = id;
+		compiled.isDialogue = node->IsDialogue;
+		compiled.kind = node->IsDialogue ? DialogueKind : node->IsRandom ? RandomKind : QuestionKind;
+		if (!node->Kind.empty()) {
+			if (compiled.kind != QuestionKind) {
+				throw std::runtime_error("Node " + std::to_string(id) + ": only a question can be of a plugin kind");
+			}
+			std::string_view kind = intern(node->Kind);
+			size_t space = std::min(kind.find(' '), kind.size());
+			compiled.kind = kindOf(id, kind.substr(0, space));
+			compiled.argument = kind.substr(std::min(space + 1, kind.size()));
+			scripts += std::to_string(id);
+			scripts += " kind ";
+			scripts += node->Kind;
+			scripts += '\n';
+		}
+		compiled.automatic = compiled.kind != QuestionKind;
+		compiled.text = intern(node->Text);
+		compiled.templated = Declare(script, node->Text);
+		compiled.firstChoice = choices.size();
+		compiled.effect = Script::None;
+		if (!node->Effect.empty()) {
+			compiled.effect = compile(id, node->Effect, [&](const std::string &source) { return script.CompileEffect(source); });
+		}
+
+		if (node->IsDialogue) {
+			compiled.next = node->NextID == 0 ? End : Find(node->NextID);
+		} else {
+			compiled.next = Missing;
+			for (auto &[nextID, choice] : node->Choices) {
+				uint32_t condition = Script::None;
+				auto source = node->Conditions.find(nextID);
+				if (source != node->Conditions.end() && !source->second.empty()) {
+					if (compiled.automatic) {
+						throw std::runtime_error("Node " + std::to_string(id) + ": only the choices of a question can have conditions");
+					}
+					condition = compile(id, source->second, [&](const std::string &source) { return script.CompileCondition(source); });
+					compiled.conditional = true;
+				}
+				compiled.templated |= Declare(script, choice);
+				choices.push_back({nextID, Find(nextID), intern(choice), condition, 0});
+			}
+			compiled.choiceCount = choices.size() - compiled.firstChoice;
+			if (compiled.kind == RandomKind) {
+				BuildAliasTable(compiled, *node);
+				scripts += std::to_string(id);
+				scripts += " random";
+				for (auto &[nextID, weight] : node->Weights) {
+					scripts += ' ';
+					scripts += std::to_string(nextID);
+					scripts += '=';
+					scripts += std::to_string(weight);
+				}
+				scripts += '\n';
+			}
+		}
+
+		if (node->TimeLimit != 0) {
+			std::string where = "Node " + std::to_string(id) + ": ";
+			if (compiled.kind != QuestionKind) {
+				throw std::runtime_error(where + "only a question can have a time limit");
+			}
+			if (!(node->TimeLimit > 0 && node->TimeLimit * 1000 < UINT32_MAX)) {
+				throw std::runtime_error(where + "a time limit must be a positive number of seconds, under 49 days");
+			}
+			if (!node->Choices.count(node->DefaultChoice)) {
+				throw std::runtime_error(where + "the default choice of a timed question must be one of its choices");
+			}
+			auto condition = node->Conditions.find(node->DefaultChoice);
+			if (condition != node->Conditions.end() && !condition->second.empty()) {
+				throw std::runtime_error(where + "the default choice of a timed question cannot have a condition");
+			}
+			compiled.timeLimit = std::max<uint32_t>(lround(node->TimeLimit * 1000), 1);
+			compiled.defaultChoice = node->DefaultChoice;
+			scripts += std::to_string(id);
+			scripts += " timed ";
+			scripts += std::to_string(compiled.timeLimit);
+			scripts += ' ';
+			scripts += std::to_string(compiled.defaultChoice);
+			scripts += '\n';
+		}
+
+		compiled.dynamic = compiled.conditional || compiled.templated;
+		nodes.push_back(compiled);
+	}
+	script.Link();
+
+	// Choices with conditions are sent one by one, so each has its own
+	// fragments too, after those of the nodes.
+	size_t parts = nodes.size() * Formats;
+	for (const Node &node : nodes) {
+		if (!node.conditional) continue;
+		for (uint32_t i = node.firstChoice; i < node.firstChoice + node.choiceCount; ++i) {
+			choices[i].fragments = parts;
+			parts += 2;
+		}
+	}
+	Render(nodes, choices, own);
+	strings = own.View();
+
+	// The JSON of every node and the scripts hold all of the story that play depends on.
+	hash = 14695981039346656037ull;
+	AddToHash(hash, std::string_view(own.text.data(), own.offsets[nodes.size() * Formats]));
+	AddToHash(hash, scripts);
+}
+
+void CompiledStory::Render(const std::vector<Node> &nodes, const std::vector<Choice> &choices, StringTable::Storage &out) const {
+	out = {};
+
+	// Every part of a node follows the one before, so offsets alone mark them.
+	out.offsets.reserve(nodes.size() * Formats + 1);
+	out.heads.reserve(nodes.size());
+	for (const Node &node : nodes) {
+		out.offsets.push_back(out.text.size());
+		out.heads.push_back(AppendJson(out.text, choices.data(), node));
+		out.offsets.push_back(out.text.size());
+		out.text += node.text;
+		out.text += '\n';
+		out.offsets.push_back(out.text.size());
+		AppendConsoleChoices(out.text, choices.data(), node);
+	}
+	for (const Node &node : nodes) {
+		if (!node.conditional) continue;
+		for (uint32_t i = node.firstChoice; i < node.firstChoice + node.choiceCount; ++i) {
+			out.offsets.push_back(out.text.size());
+			AppendJsonChoice(out.text, choices[i]);
+			out.offsets.push_back(out.text.size());
+			AppendConsoleChoice(out.text, choices[i]);
+		}
+	}
+	out.offsets.push_back(out.text.size());
+
+	out.partSegments.assign(out.offsets.size(), 0);
+	std::vector<bool> templated(out.offsets.size() - 1);
+	for (const Node &node : nodes) {
+		if (!node.templated) continue;
+		size_t part = (&node - nodes.data()) * Formats;
+		std::fill(templated.begin() + part, templated.begin() + part + Formats, true);
+		for (uint32_t i = node.firstChoice; node.conditional && i < node.firstChoice + node.choiceCount; ++i) {
+			templated[choices[i].fragments] = templated[choices[i].fragments + 1] = true;
+		}
+	}
+	for (size_t part = 0; part < templated.size(); ++part) {
+		out.partSegments[part] = out.segments.size();
+		if (templated[part]) {
+			Parse(out, part);
+		}
+	}
+	out.partSegments.back() = out.segments.size();
+}
+
+void CompiledStory::Translate(const Story &translation, StringTable::Storage &out, size_t &untranslated) const {
+	// Views into translation, which outlives them.
+	std::vector<Node> translated = nodes;
+	std::vector<Choice> translatedChoices = choices;
+	untranslated = 0;
+
+	auto check = [&](const Node &node, std::string_view text) {
+		ForEachPlaceholder(text, [&](size_t, size_t, std::string_view name) {
+			if (!node.templated || script.Slot(name) == Script::None) {
+				throw std::runtime_error("Node " + std::to_string(node.id) + ": {" + std::string(name) + "} is not in the story's text here");
+			}
+		});
+	};
+	for (Node &node : translated) {
+		auto it = translation.find(node.id);
+		const Dialogue *dial = it != translation.end() ? it->second.get() : nullptr;
+		if (dial) {
+			node.text = dial->Text;
+			check(node, node.text);
+		} else {
+			++untranslated;
+		}
+
+		for (uint32_t i = node.firstChoice; i < node.firstChoice + node.choiceCount; ++i) {
+			Choice &choice = translatedChoices[i];
+			if (!dial || !dial->Choices.count(choice.id)) {
+				++untranslated;
+				continue;
+			}
+			choice.text = dial->Choices.at(choice.id);
+			check(node, choice.text);
+		}
+	}
+
+	Render(translated, translatedChoices, out);
+}
+
+void CompiledStory::BuildAliasTable(const Node &node, const Dialogue &dial) {
+	size_t n = node.choiceCount;
+	std::vector<double> scaled(n);
+	double total = 0;
+	for (size_t i = 0; i < n; ++i) {
+		auto weight = dial.Weights.find(choices[node.firstChoice + i].id);
+		scaled[i] = weight != dial.Weights.end() ? weight->second : 1;
+		if (!(scaled[i] >= 0) || scaled[i] == HUGE_VAL) {
+			throw std::runtime_error("Node " + std::to_string(node.id) + ": weights must be finite and not negative");
+		}
+		total += scaled[i];
+	}
+	if (n > 0 && !(total > 0)) {
+		throw std::runtime_error("Node " + std::to_string(node.id) + ": no outcome has any weight");
+	}
+
+	// Columns of average weight 1: each one under it is topped up from one over.
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; ++i) {
+		scaled[i] = scaled[i] * n / total;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+	Outcome *table = outcomes.data() + node.firstChoice;
+	while (!small.empty() && !large.empty()) {
+		uint32_t under = small.back(), over = large.back();
+		small.pop_back();
+		large.pop_back();
+		table[under] = {uint32_t(scaled[under] * 4294967296.0), over};
+		scaled[over] -= 1 - scaled[under];
+		(scaled[over] < 1 ? small : large).push_back(over);
+	}
+	// What is left is full, up to rounding.
+	for (uint32_t i : small) table[i] = {UINT32_MAX, i};
+	for (uint32_t i : large) table[i] = {UINT32_MAX, i};
+}
+
+uint32_t CompiledStory::Find(size_t id) const {
+	auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if (it == ids.end() || *it != id) {
+		return Missing;
+	}
+	return it - ids.begin();
+}
+
+bool CompiledStory::Choose(uint32_t node, size_t id, uint32_t &target, uint32_t *taken) const {
+	const Node &from = nodes[node];
+	if (from.isDialogue) {
+		target = from.next;
+		if (taken) *taken = End;
+		return true;
+	}
+
+	// Choices are sorted by ID, as the story's map keeps them.
+	const Choice *begin = ChoicesBegin(from);
+	const Choice *end = ChoicesEnd(from);
+	const Choice *choice = std::lower_bound(begin, end, id, [](const Choice &c, size_t id) { return c.id < id; });
+	if (choice == end || choice->id != id) {
+		return false;
+	}
+
+	target = choice->target;
+	if (taken) *taken = choice - choices.data();
+	return true;
+}
+
+void CompiledStory::Parse(StringTable::Storage &out, size_t part) const {
+	size_t begin = out.offsets[part];
+	size_t literal = begin;
+	std::string_view whole(out.text.data() + begin, out.offsets[part + 1] - begin);
+	ForEachPlaceholder(whole, [&](size_t offset, size_t size, std::string_view name) {
+		if (begin + offset > literal) {
+			out.segments.push_back({uint32_t(literal), uint32_t(begin + offset - literal), Script::None});
+		}
+		out.segments.push_back({uint32_t(begin + offset), uint32_t(size), script.Slot(name)});
+		literal = begin + offset + size;
+	});
+	if (out.offsets[part + 1] > literal) {
+		out.segments.push_back({uint32_t(literal), uint32_t(out.offsets[part + 1] - literal), Script::None});
+	}
+}
+
+void CompiledStory::Expand(const StringTable &strings, size_t part, const int64_t *registers, std::string &out, size_t limit) const {
+	std::string_view whole = strings.Part(part);
+	if (strings.partSegments[part] == strings.partSegments[part + 1]) {
+		out.append(whole.data(), std::min(limit, whole.size()));
+		return;
+	}
+
+	size_t end = strings.offsets[part] + std::min(limit, whole.size());
+	for (uint32_t i = strings.partSegments[part]; i < strings.partSegments[part + 1] && strings.segments[i].offset < end; ++i) {
+		const StringTable::Segment &segment = strings.segments[i];
+		if (segment.slot == Script::None) {
+			out.append(strings.text + segment.offset, std::min<size_t>(segment.size, end - segment.offset));
+		} else {
+			AppendInteger(out, registers[segment.slot]);
+		}
+	}
+}
+
+void CompiledStory::OfferedJson(uint32_t node, int64_t *registers, std::string &out, const StringTable *language) const {
+	const StringTable &strings = In(language);
+	const Node &from = nodes[node];
+	if (!from.conditional) {
+		Expand(strings, node * Formats, registers, out);
+		return;
+	}
+
+	Expand(strings, node * Formats, registers, out, strings.heads[node]);
+	bool first = true;
+	for (const Choice *choice = ChoicesBegin(from); choice != ChoicesEnd(from); ++choice) {
+		if (!Offered(*choice, registers)) continue;
+		if (!first) out += ',';
+		Expand(strings, choice->fragments, registers, out);
+		first = false;
+	}
+	out += "]}";
+}
+
+void CompiledStory::OfferedConsoleText(uint32_t node, const int64_t *registers, std::string &out, const StringTable *language) const {
+	Expand(In(language), node * Formats + 1, registers, out);
+}
+
+void CompiledStory::OfferedConsoleChoices(uint32_t node, int64_t *registers, std::string &out, const StringTable *language) const {
+	const StringTable &strings = In(language);
+	const Node &from = nodes[node];
+	if (!from.conditional) {
+		Expand(strings, node * Formats + 2, registers, out);
+		return;
+	}
+
+	for (const Choice *choice = ChoicesBegin(from); choice != ChoicesEnd(from); ++choice) {
+		if (Offered(*choice, registers)) {
+			Expand(strings, choice->fragments + 1, registers, out);
+		}
+	}
+}
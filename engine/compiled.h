@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nodekinds.h"
+#include "script.h"
+#include "story.h"
+#include "stringtable.h"
+
+// The story as the engine plays it. Nodes are addressed by their position and
+// every link is resolved to a position up front; all text lives in one block.
+// Nothing changes once built, so any number of threads and sessions can read
+// it without locks.
+//
+// What is sent comes from a StringTable: the story's own, or a translation
+// of it (see Translate() and Languages) given as language.
+class CompiledStory {
+public:
+	// Targets that are not a node: NextID 0, and IDs that do not exist.
+	static const uint32_t End = UINT32_MAX;
+	static const uint32_t Missing = UINT32_MAX - 1;
+
+	// What moving on from a node does (see Step()). Past the built-in kinds,
+	// each kind the story names is given the next number (see Kind()).
+	static const uint8_t QuestionKind = 0, DialogueKind = 1, RandomKind = 2, PluginKind = 3;
+
+	struct Choice {
+		size_t id;
+		uint32_t target;
+		std::string_view text;
+		// Script entry, Script::None when always offered.
+		uint32_t condition;
+		// Where its own JSON and console fragments are, on conditional nodes.
+		uint32_t fragments;
+	};
+
+	struct Node {
+		size_t id;
+		uint8_t kind;
+		bool isDialogue;
+		// It goes on by itself, like a dialogue node, and is sent like one:
+		// every kind but questions. Random nodes draw their choice (see
+		// Sample()), plugin ones leave it to their plugin.
+		bool automatic;
+		// Some choice has a condition, so what is offered is worked out per session.
+		bool conditional;
+		// Its text or a choice's has {variable} in it, filled in per session.
+		bool templated;
+		// Either, so it is rendered for each session rather than sent as it is.
+		bool dynamic;
+		uint32_t next;
+		std::string_view text;
+		uint32_t firstChoice;
+		uint32_t choiceCount;
+		// Script effect run on arriving, Script::None if there is none.
+		uint32_t effect;
+		// What follows the name of a plugin kind.
+		std::string_view argument;
+		// A timed question: milliseconds to answer in, 0 if it waits for
+		// good, and the choice taken once they are up.
+		uint32_t timeLimit;
+		size_t defaultChoice;
+	};
+
+	// Throws std::runtime_error naming the node of a script that does not
+	// compile, or of a kind that is not among plugins.
+	explicit CompiledStory(const Story &story, const NodeKinds *plugins = nullptr);
+
+	CompiledStory(const CompiledStory &) = delete;
+	CompiledStory &operator=(const CompiledStory &) = delete;
+
+	size_t Size() const { return nodes.size(); }
+	// Choices of all nodes, numbered by their place in one array.
+	size_t ChoiceCount() const { return choices.size(); }
+	const Choice &ChoiceAt(uint32_t choice) const { return choices[choice]; }
+
+	// Conditions and effects, and the registers a session keeps for them.
+	const Script &Scripts() const { return script; }
+	size_t Registers() const { return script.Registers(); }
+	bool Offered(const Choice &choice, int64_t *registers) const {
+		return choice.condition == Script::None || script.Run(choice.condition, registers) != 0;
+	}
+	const Node &operator[](uint32_t node) const { return nodes[node]; }
+	// The plugin kind a node of kind plays, for kinds from PluginKind on.
+	const StoryNodeKind &Kind(uint8_t kind) const { return kinds[kind]; }
+	const Choice *ChoicesBegin(const Node &node) const { return choices.data() + node.firstChoice; }
+	const Choice *ChoicesEnd(const Node &node) const { return ChoicesBegin(node) + node.choiceCount; }
+
+	// The node's output in each format, rendered when the story was compiled
+	// into one block, so sending a node copies and allocates nothing.
+	// Json: one line, {"ID":..,"Text":..} plus "Choices":[{"NextID":..,"Text":..}]
+	// or "End":true, without the newline.
+	// ConsoleText: the text and a newline. ConsoleChoices: "<id> -> <text>" lines.
+	std::string_view Json(uint32_t node, const StringTable *language = nullptr) const { return In(language).Part(node * Formats); }
+	std::string_view ConsoleText(uint32_t node, const StringTable *language = nullptr) const { return In(language).Part(node * Formats + 1); }
+	std::string_view ConsoleChoices(uint32_t node, const StringTable *language = nullptr) const { return In(language).Part(node * Formats + 2); }
+	// The same for a session, appended to out: only the choices offered for
+	// registers, copied from each choice's own fragment, and {variable} in
+	// text replaced by its value. Templated fragments are lists of spans of
+	// the rendered block and variable slots, so this allocates nothing once
+	// out has room, and costs only the length of what it writes.
+	void OfferedJson(uint32_t node, int64_t *registers, std::string &out, const StringTable *language = nullptr) const;
+	void OfferedConsoleText(uint32_t node, const int64_t *registers, std::string &out, const StringTable *language = nullptr) const;
+	void OfferedConsoleChoices(uint32_t node, int64_t *registers, std::string &out, const StringTable *language = nullptr) const;
+
+	// The story's own text.
+	const StringTable &Strings() const { return strings; }
+	// Where the console output is among the parts of a StringTable: a
+	// node's text and its choices, and a conditional choice's own line.
+	size_t ConsoleTextPart(uint32_t node) const { return node * Formats + 1; }
+	size_t ConsoleChoicesPart(uint32_t node) const { return node * Formats + 2; }
+	size_t ConsoleChoicePart(const Choice &choice) const { return choice.fragments + 1; }
+	// Renders the text of translation, a copy of the story in another
+	// language, into out for the nodes and choices of this one; sets
+	// untranslated to how many texts it lacked, which are taken from this
+	// one. Throws std::runtime_error naming a node whose translation has a
+	// {variable} where the story's text has none, or one it does not know.
+	void Translate(const Story &translation, StringTable::Storage &out, size_t &untranslated) const;
+
+	// FNV-1a of the story's content, so saves from another story, or another
+	// version of this one, are told apart. Translations do not change it.
+	uint64_t Hash() const { return hash; }
+
+	// Position of a node ID, Missing if there is none.
+	uint32_t Find(size_t id) const;
+	uint32_t Start() const { return Find(0); }
+
+	// Sets target to where picking the choice leading to id goes from node,
+	// false if the node offers no such choice. Dialogue nodes ignore id.
+	// Sets taken, if given, to the choice's number, End on dialogue nodes.
+	bool Choose(uint32_t node, size_t id, uint32_t &target, uint32_t *taken = nullptr) const;
+	// The choice a random node's 64 random bits pick, by number. O(1): the
+	// weights are turned into an alias table (Vose) when the story is compiled.
+	uint32_t Sample(const Node &node, uint64_t random) const {
+		uint32_t column = ((random >> 32) * node.choiceCount) >> 32;
+		const Outcome &outcome = outcomes[node.firstChoice + column];
+		return node.firstChoice + (uint32_t(random) < outcome.threshold ? column : outcome.alias);
+	}
+
+private:
+	static const size_t Formats = 3;
+
+	// One column of an alias table: its own choice below threshold (out of
+	// 2^32), the alias above. Kept alongside choices, for random nodes only.
+	struct Outcome {
+		uint32_t threshold;
+		uint32_t alias;
+	};
+
+	void BuildAliasTable(const Node &node, const Dialogue &dial);
+
+	const StringTable &In(const StringTable *language) const { return language ? *language : strings; }
+	// Every part of nodes and their choices, as they read, into out.
+	void Render(const std::vector<Node> &nodes, const std::vector<Choice> &choices, StringTable::Storage &out) const;
+	void Parse(StringTable::Storage &out, size_t part) const;
+	// The first limit bytes of the part, as rendered for registers.
+	void Expand(const StringTable &strings, size_t part, const int64_t *registers, std::string &out, size_t limit = SIZE_MAX) const;
+
+	std::string text;
+	std::vector<size_t> ids;
+	std::vector<Node> nodes;
+	std::vector<Choice> choices;
+	std::vector<Outcome> outcomes;
+	// Indexed by Node::kind, so empty up to PluginKind.
+	std::vector<StoryNodeKind> kinds;
+	StringTable::Storage own;
+	StringTable strings;
+	uint64_t hash;
+	Script script;
+};
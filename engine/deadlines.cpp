@@ -0,0 +1,82 @@
+#include "deadlines.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Earliest on top.
+struct Later {
+	template <typename Entry>
+	bool operator()(const Entry &a, const Entry &b) const { return a.due > b.due; }
+};
+
+}
+
+Deadlines::Deadlines(int64_t resolution) : resolution(resolution) {
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("Cannot create timer: ") + strerror(errno));
+	}
+}
+
+Deadlines::~Deadlines() {
+	close(fd);
+}
+
+int64_t Deadlines::Now() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void Deadlines::Add(uint64_t key, uint64_t arrival, int64_t due) {
+	heap.push_back({due, key, arrival});
+	std::push_heap(heap.begin(), heap.end(), Later());
+	Arm();
+}
+
+Deadlines::Entry Deadlines::Pop() {
+	std::pop_heap(heap.begin(), heap.end(), Later());
+	Entry entry = heap.back();
+	heap.pop_back();
+	return entry;
+}
+
+void Deadlines::Clear() {
+	uint64_t expirations;
+	ssize_t n = read(fd, &expirations, sizeof(expirations));
+	(void)n;
+	armed = INT64_MAX;
+}
+
+void Deadlines::Arm() {
+	if (heap.empty()) {
+		return;
+	}
+	int64_t due = heap.front().due;
+	if (resolution > 0) {
+		due += resolution - 1 - (due + resolution - 1) % resolution;
+	}
+	if (due >= armed) {
+		return;
+	}
+
+	// Absolute, so the time spent getting here is not added on. One already
+	// past fires straight away.
+	armed = due;
+	itimerspec when = {};
+	when.it_value.tv_sec = armed / 1000000000;
+	when.it_value.tv_nsec = armed % 1000000000;
+	if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0) {
+		when.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(fd, TFD_TIMER_ABSTIME, &when, nullptr);
+}
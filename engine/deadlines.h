@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "compiled.h"
+#include "playthrough.h"
+
+// Deadlines of timed questions for one event loop. They wait in a heap with
+// a timerfd armed for the earliest only, so any number of them cost nothing
+// while waiting: the loop watches Fd() with the rest of its descriptors and
+// calls Expire() when it can be read. A deadline is not taken back when
+// the player answers first; it comes due anyway and its arrival (see
+// Turn::arrival) no longer matches, so only those are kept that are still
+// to come within the longest time limit.
+//
+// Each wakeup costs far more than the deadlines it serves, so with many of
+// them the timer goes off at most once per resolution (nanoseconds), for
+// all of those due by then: none is late by more than that, and none early.
+class Deadlines {
+public:
+	explicit Deadlines(int64_t resolution = 0);
+	~Deadlines();
+
+	Deadlines(const Deadlines &) = delete;
+	Deadlines &operator=(const Deadlines &) = delete;
+
+	// Nanoseconds on the monotonic clock, which deadlines are given in.
+	static int64_t Now();
+	static int64_t In(uint32_t milliseconds) { return Now() + int64_t(milliseconds) * 1000000; }
+
+	int Fd() const { return fd; }
+	size_t Size() const { return heap.size(); }
+
+	// key says whose it is, to whoever set it.
+	void Add(uint64_t key, uint64_t arrival, int64_t due);
+	// Calls expired(key, arrival) for each deadline that is due, earliest
+	// first, then arms the timer for the next. Deadlines added meanwhile
+	// that are due already are expired in the same call.
+	template <typename Expired>
+	void Expire(Expired expired) {
+		Clear();
+		int64_t now = Now();
+		while (!heap.empty() && heap.front().due <= now) {
+			Entry entry = Pop();
+			expired(entry.key, entry.arrival);
+		}
+		Arm();
+	}
+
+private:
+	struct Entry {
+		int64_t due;
+		uint64_t key;
+		uint64_t arrival;
+	};
+
+	Entry Pop();
+	void Clear();
+	void Arm();
+
+	std::vector<Entry> heap;
+	int fd;
+	int64_t resolution;
+	// What the timer is set for, INT64_MAX when it is not.
+	int64_t armed = INT64_MAX;
+};
+
+// Gives a turn that moved to a timed question its deadline, under key.
+inline void AddDeadline(Deadlines &deadlines, const CompiledStory &story, uint64_t key, const Turn &turn) {
+	if (turn.result == StepResult::Moved && turn.arrival) {
+		deadlines.Add(key, turn.arrival, Deadlines::In(story[turn.node].timeLimit));
+	}
+}
@@ -1,96 +1,389 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <charconv>
 #include <string>
 #include <iostream>
-#include <fstream>
-#include <nlohmann/json.hpp>
+#include <exception>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
 
-using json = nlohmann::json;
+#include "story.h"
+#include "compiled.h"
+#include "playthrough.h"
+#include "server.h"
+#include "output.h"
+#include "savefile.h"
+#include "optimize.h"
+#include "nodekinds.h"
+#include "languages.h"
+#include "wrap.h"
+#include "terminal.h"
+#include "deadlines.h"
+#include "input.h"
+#include "analytics.h"
 
-struct Dialogue {
-	bool IsDialogue;
+// Nodes go out as their pre-rendered text, straight from the story.
+OutputQueue out;
 
-	size_t ID;
-	size_t NextID;
+// On a terminal they are wrapped to its width, taken anew each time so
+// resizing it works, from breaks found once for each language shown.
+std::map<const StringTable *, std::unique_ptr<ConsoleLayout>> layouts;
 
-	std::string Text;
+size_t TerminalWidth() {
+	winsize size;
+	return ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 ? size.ws_col : 0;
+}
 
-	size_t TotalChoices;
-	std::map<size_t, std::string> Choices;
-};
+ConsoleLayout &Layout(const CompiledStory &story, const Playthrough &play) {
+	std::unique_ptr<ConsoleLayout> &layout = layouts[play.Language()];
+	if (!layout) {
+		layout = std::make_unique<ConsoleLayout>(story, play.Language());
+	}
+	return *layout;
+}
 
+// The console waits on stdin and on the deadline of the timed question it
+// shows, if any.
+struct Console {
+	Deadlines deadlines;
+	Input input{deadlines};
+	// The arrival (see Turn::arrival) timed last and when it runs out, and
+	// the last one that did.
+	uint64_t timed = 0, expired = 0;
+	int64_t due = 0;
+	// The line a choice was typed on also goes on from the text it leads to.
+	bool answered = false;
+
+	Input::Event ReadLine(std::string &line) {
+		Input::Event event = input.ReadLine(line);
+		if (event == Input::Expired) {
+			deadlines.Expire([&](uint64_t, uint64_t arrival) { expired = arrival; });
+		}
+		return event;
+	}
+};
 
-void PrintDialogue(size_t id, std::map<size_t, Dialogue> &story) {
-	std::cout << story[id].Text << std::endl;
+void PrintDialogue(const CompiledStory &story, const Playthrough &play, Console &console) {
+	uint32_t node = play.Current().node;
+	if (size_t width = TerminalWidth()) {
+		Layout(story, play).Text(node, play.State().registers.data(), width, out.Text());
+	} else if (story[node].dynamic) {
+		story.OfferedConsoleText(node, play.State().registers.data(), out.Text(), play.Language());
+	} else {
+		out.Reference(story.ConsoleText(node, play.Language()));
+	}
+	out.Flush(STDOUT_FILENO);
 
-	std::cin.get();
+	std::string line;
+	if (!std::exchange(console.answered, false)) {
+		while (console.ReadLine(line) == Input::Expired) {}
+	}
 }
 
-bool NextDialogue(size_t &id, std::map<size_t, Dialogue> &story) {
-	if (story[id].IsDialogue) {
-		if (story[id].NextID == 0) {
+bool NextDialogue(const CompiledStory &story, Languages &languages, Playthrough &play, Console &console) {
+	uint32_t node = play.Current().node;
+	const CompiledStory::Node &from = story[node];
+
+	if (from.automatic) {
+		return play.Choose(0).result == StepResult::Moved;
+	}
+
+	// A timed question's time counts from when its choices are first shown;
+	// then its default is taken.
+	uint64_t arrival = play.Current().arrival;
+	if (arrival && console.timed != arrival) {
+		console.timed = arrival;
+		console.due = Deadlines::In(from.timeLimit);
+		console.deadlines.Add(0, arrival, console.due);
+	}
+
+	bool show = true;
+	while (true) {
+		if (arrival && console.expired == arrival) {
+			out.Text() += "Time is up.\n";
+			return play.Choose(from.defaultChoice).result == StepResult::Moved;
+		}
+
+		if (show) {
+			if (size_t width = TerminalWidth()) {
+				Layout(story, play).Choices(node, play.State().registers.data(), width, out.Text());
+			} else if (from.dynamic) {
+				story.OfferedConsoleChoices(node, play.State().registers.data(), out.Text(), play.Language());
+			} else {
+				out.Reference(story.ConsoleChoices(node, play.Language()));
+			}
+			if (arrival) {
+				int64_t left = std::max<int64_t>(console.due - Deadlines::Now(), 0);
+				out.Text() += '(';
+				AppendNumber(out.Text(), (left + 999999999) / 1000000000);
+				out.Text() += " s)\n";
+			}
+			out.Flush(STDOUT_FILENO);
+		}
+
+		// A word to a line; blank lines and deadlines of questions already
+		// answered are waited through.
+		std::string line;
+		Input::Event event = console.ReadLine(line);
+		if (event == Input::Closed) {
 			return false;
 		}
+		size_t begin = line.find_first_not_of(" \t");
+		show = event == Input::Line && begin != std::string::npos;
+		if (!show) {
+			continue;
+		}
+		std::string word = line.substr(begin, line.find_first_of(" \t", begin) - begin);
+		console.answered = true;
 
-		id = story[id].NextID;
-	} else {
-		while (true) {
-			for (auto [nextId, text] : story[id].Choices) {
-				std::cout << nextId << " -> " << text << std::endl;
+		// "l<code>" shows the story in another language from here on, and
+		// "l" in its own, starting again from this node.
+		if (word[0] == 'l') {
+			const StringTable *language = word.size() > 1 ? languages.Find(word.substr(1)) : nullptr;
+			if (language || word.size() == 1) {
+				play.SetLanguage(language);
+				return true;
 			}
+			continue;
+		}
+
+		// "b" goes back a step, "b<n>" n steps; anything else is a choice.
+		bool back = word[0] == 'b';
+		size_t number = back ? 1 : SIZE_MAX;
+		const char *first = word.data() + back;
+		auto [last, error] = std::from_chars(first, word.data() + word.size(), number);
+		if ((error != std::errc() && first != word.data() + word.size()) || last != word.data() + word.size()) {
+			continue;
+		}
+
+		StepResult result = back ? play.Back(number).result : play.Choose(number).result;
+		if (result != StepResult::NotAChoice && result != StepResult::NoHistory) {
+			return result == StepResult::Moved;
+		}
+	}
+}
+
+// Plays without waiting on anyone: every node reached is written as a line
+// of JSON, nodes other than questions go on by themselves (random ones
+// drawing from the seed, so a seed and input replay a run), and each question takes the
+// next line of input as its choice. Time limits do not apply here, for
+// the same reason. Output is only flushed before reading, or once there is
+// a lot of it, as a story of random nodes may never ask.
+void PlayBatch(const CompiledStory &story, Playthrough &play) {
+	std::string line;
 
-			size_t choice;
-			std::cin >> choice;
+	while (true) {
+		uint32_t node = play.Current().node;
+		if (story[node].dynamic) {
+			story.OfferedJson(node, play.State().registers.data(), out.Text(), play.Language());
+		} else {
+			out.Reference(story.Json(node, play.Language()));
+		}
+		out.Text() += '\n';
 
-			if(story[id].Choices.find(choice) != story[id].Choices.end()) {
-				id = choice;
-				break;
+		StepResult result;
+		if (story[node].automatic) {
+			if (out.Pending() > (1 << 16) && !out.Flush(STDOUT_FILENO)) {
+				return;
 			}
+			result = play.Choose(0).result;
+		} else {
+			do {
+				out.Flush(STDOUT_FILENO);
+				if (!std::getline(std::cin, line)) {
+					return;
+				}
+
+				size_t choice = SIZE_MAX;
+				std::from_chars(line.data(), line.data() + line.size(), choice);
+				result = play.Choose(choice).result;
+				if (result == StepResult::NotAChoice) {
+					out.Text() += "{\"Error\":\"not a choice\"}\n";
+				}
+			} while (result == StepResult::NotAChoice);
+		}
+
+		if (result == StepResult::MissingNode) {
+			out.Text() += "{\"Error\":\"missing node\"}\n";
+		}
+		if (result != StepResult::Moved) {
+			break;
 		}
 	}
 
-	return true;
+	out.Flush(STDOUT_FILENO);
+}
+
+// The console keeps its one playthrough in this slot and goes on from it
+// when started again.
+const uint64_t ConsoleSlot = 0;
+
+void Autosave(const CompiledStory &story, SaveFile *saves, const Playthrough &play) {
+	if (saves) {
+		std::string record;
+		EncodeSession(story, play.State(), record);
+		saves->Checkpoint(ConsoleSlot, record);
+	}
 }
 
 int main(int argc, char **argv) {
 	std::string filename = "story.json";
+	std::string saveFilename;
+	SaveFile::Durability durability = SaveFile::Interval;
+	std::string socketPath;
+	int port = 0;
+	bool batch = false;
+	bool terminal = false;
+	bool optimize = false;
+	uint64_t seed = NewSeed();
+	std::vector<std::string> plugins;
+	std::string languageCode;
+	std::string analyticsFilename;
+	int analyticsInterval = 10;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	int arg = 1;
 
-	if (argc == 2) {
-		filename = argv[1];
+	for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+		if (strcmp(argv[arg], "-b") == 0) {
+			batch = true;
+		} else if (strcmp(argv[arg], "-t") == 0) {
+			terminal = true;
+		} else if (strcmp(argv[arg], "-O") == 0) {
+			optimize = true;
+		} else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+			seed = strtoull(argv[++arg], nullptr, 10);
+		} else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+			languageCode = argv[++arg];
+		} else if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc) {
+			plugins.push_back(argv[++arg]);
+		} else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+			socketPath = argv[++arg];
+		} else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc) {
+			port = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+			threads = std::max(1, atoi(argv[++arg]));
+		} else if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc) {
+			analyticsFilename = argv[++arg];
+		} else if (strcmp(argv[arg], "-A") == 0 && arg + 1 < argc) {
+			analyticsInterval = std::max(1, atoi(argv[++arg]));
+		} else if (strcmp(argv[arg], "-S") == 0 && arg + 1 < argc) {
+			saveFilename = argv[++arg];
+		} else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+			++arg;
+			if (strcmp(argv[arg], "lazy") == 0) durability = SaveFile::Lazy;
+			else if (strcmp(argv[arg], "always") == 0) durability = SaveFile::Always;
+			else if (strcmp(argv[arg], "interval") != 0) break;
+		} else {
+			break;
+		}
+	}
+	if (argc - arg > 1 || (arg < argc && argv[arg][0] == '-') || batch + terminal + !socketPath.empty() + !!port > 1) {
+		fprintf(stderr, "Usage: %s [-b | -t | -s socket | -p port] [-O] [-r seed] [-k plugin.so]... [-l language] [-j threads] [-S savefile [-d lazy|interval|always]] [-a analytics [-A seconds]] [story.json]\n", argv[0]);
+		return 2;
 	}
+	if (arg < argc) {
+		filename = argv[arg];
+	}
+
+	try {
+		NodeKinds kinds;
+		for (const std::string &plugin : plugins) {
+			kinds.Load(plugin);
+		}
+
+		Story source;
+		LoadStory(filename, source);
+		// Saves only fit the story played the same way, optimised or not.
+		if (optimize) {
+			OptimizeStory(source);
+		}
+		CompiledStory story(source, &kinds);
+		source.clear();
+
+		// Translations sit next to the story: story.fr.strings for story.json.
+		std::string base = filename;
+		if (base.size() > 5 && base.compare(base.size() - 5, 5, ".json") == 0) {
+			base.resize(base.size() - 5);
+		}
+		Languages languages(story, base);
+		const StringTable *language = nullptr;
+		if (!languageCode.empty() && !(language = languages.Find(languageCode))) {
+			throw std::runtime_error("No string table " + base + "." + languageCode + ".strings that fits the story");
+		}
 
-	std::ifstream inputFile(filename);
+		std::unique_ptr<SaveFile> saves;
+		if (!saveFilename.empty()) {
+			saves = std::make_unique<SaveFile>(saveFilename, durability);
+		}
 
-	json data = json::parse(inputFile);
+		// Visits and choices over every session, snapshotted for story_analytics.
+		std::unique_ptr<Analytics> analytics;
+		if (!analyticsFilename.empty()) {
+			analytics = std::make_unique<Analytics>(story);
+			analytics->SaveEvery(analyticsFilename, std::chrono::seconds(analyticsInterval));
+			analytics->Attach();
+		}
 
-	std::map<size_t, Dialogue> story;
+		if (!socketPath.empty()) {
+			int fd = ListenUnix(socketPath);
+			RunServer(story, fd, Protocol::Lines, threads, saves.get(), &languages, analytics.get());
+			close(fd);
+			unlink(socketPath.c_str());
+			return 0;
+		}
+		if (port) {
+			int fd = ListenLocal(port);
+			RunServer(story, fd, Protocol::Http, threads, saves.get(), &languages, analytics.get());
+			close(fd);
+			return 0;
+		}
 
-	for (size_t i = 0;; ++i) {
-		auto element = data[i];
+		if (story.Start() == CompiledStory::Missing) {
+			throw std::runtime_error("The story has no node 0");
+		}
 
-		if (element == nullptr) break;
+		if (batch) {
+			Playthrough play = Play(story, seed);
+			play.SetLanguage(language);
+			PlayBatch(story, play);
+			return 0;
+		}
 
-		story[i].ID = element["ID"];
-		story[i].Text = element["Text"];
+		// A save from another version of the story is started over.
+		Session resumed;
+		std::string record;
+		Playthrough play = saves && saves->Restore(ConsoleSlot, record) && DecodeSession(story, record, resumed)
+			? Play(story, std::move(resumed))
+			: Play(story, seed);
+		play.SetLanguage(language);
 
-		if(element["IsDialogue"]) {
-			story[i].IsDialogue = true;
-			story[i].NextID = element["NextID"];
+		if (terminal) {
+			Autosave(story, saves.get(), play);
+			PlayInTerminal(story, play, [&] { Autosave(story, saves.get(), play); });
 		} else {
-			story[i].IsDialogue = false;
-			story[i].TotalChoices = element["TotalChoices"];
-			for(size_t j = 0; j < story[i].TotalChoices; ++j) {
-				size_t nextID = element["Choices"][std::to_string(j)]["NextID"];
-				std::string text = element["Choices"][std::to_string(j)]["Text"];
-				story[i].Choices[nextID] = text;
-			}
+			Console console;
+			do {
+				PrintDialogue(story, play, console);
+				Autosave(story, saves.get(), play);
+			} while (NextDialogue(story, languages, play, console));
 		}
-	}
 
-	size_t id = 0;
-	do {
-		PrintDialogue(id, story);
-	} while (NextDialogue(id, story));
+		if (saves && play.Current().result == StepResult::TheEnd) {
+			saves->Checkpoint(ConsoleSlot, {});
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+		return 1;
+	}
 
-	std::cout << std::endl << "THE END" << std::endl;
+	out.Text() += "\nTHE END\n";
+	out.Flush(STDOUT_FILENO);
 }
@@ -0,0 +1,47 @@
+#include "history.h"
+
+#include <algorithm>
+
+void History::Push(uint32_t node, uint32_t mark) {
+	// The jump skips as far as the parent's does twice over when the two
+	// jumps are the same length, else only to the parent, which keeps every
+	// jump a power-of-two-ish run and any ancestor O(log n) away.
+	uint32_t jump = head;
+	uint32_t parentJump = JumpOf(head);
+	if (head != None && DepthOf(head) - DepthOf(parentJump) == DepthOf(parentJump) - DepthOf(JumpOf(parentJump))) {
+		jump = JumpOf(parentJump);
+	}
+
+	if (entries.empty()) {
+		entries.reserve(32);
+	}
+	entries.push_back({node, head, jump, DepthOf(head) + 1, mark});
+	head = entries.size() - 1;
+}
+
+bool History::Back(size_t steps, uint32_t &node, uint32_t &mark) {
+	if (steps == 0 || steps > Depth()) {
+		return false;
+	}
+
+	// The entry of the node steps back is the one at that depth.
+	uint32_t target = Depth() - steps + 1;
+	uint32_t entry = head;
+	while (entries[entry].depth > target) {
+		uint32_t jump = entries[entry].jump;
+		entry = DepthOf(jump) >= target ? jump : entries[entry].parent;
+	}
+
+	node = entries[entry].node;
+	mark = entries[entry].mark;
+	head = entries[entry].parent;
+	return true;
+}
+
+void History::Path(std::vector<uint32_t> &path) const {
+	path.clear();
+	for (uint32_t entry = head; entry != None; entry = entries[entry].parent) {
+		path.push_back(entries[entry].node);
+	}
+	std::reverse(path.begin(), path.end());
+}
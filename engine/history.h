@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// The nodes a session stood on before the current one, as a persistent
+// list: each step adds an entry pointing at the one before it, and going
+// back only moves the head, so whatever was played since stays shared with
+// the branch taken next. Entries also keep a jump pointer (Myers' skew
+// binary scheme), so going back any number of steps takes O(log n).
+// 20 bytes per step, never a copy of the session.
+class History {
+public:
+	static const uint32_t None = UINT32_MAX;
+
+	// Steps that can be taken back from where the head is.
+	size_t Depth() const { return head == None ? 0 : entries[head].depth; }
+	// Entries kept, on every branch, and the memory they take.
+	size_t Entries() const { return entries.size(); }
+	size_t Bytes() const { return entries.capacity() * sizeof(Entry); }
+
+	// Records node as the one stepped away from, with a mark the host
+	// gets back on returning to it (Session keeps its undo log's head there).
+	void Push(uint32_t node, uint32_t mark = None);
+	// Goes back steps nodes and sets node and mark to those of the one it
+	// arrives at, false (and nothing changes) if the history is not that deep.
+	bool Back(size_t steps, uint32_t &node, uint32_t &mark);
+
+	// The nodes from the first step to the head, oldest first.
+	void Path(std::vector<uint32_t> &path) const;
+	void Clear() {
+		entries.clear();
+		head = None;
+	}
+
+private:
+	struct Entry {
+		uint32_t node;
+		uint32_t parent;
+		uint32_t jump;
+		uint32_t depth;
+		uint32_t mark;
+	};
+
+	uint32_t DepthOf(uint32_t entry) const { return entry == None ? 0 : entries[entry].depth; }
+	uint32_t JumpOf(uint32_t entry) const { return entry == None ? None : entries[entry].jump; }
+
+	std::vector<Entry> entries;
+	uint32_t head = None;
+};
@@ -0,0 +1,451 @@
+#include "http.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+const size_t MaxHead = 16 << 10;
+
+struct Answer {
+	int status;
+	std::string_view body;
+	size_t created = SIZE_MAX;
+	// Bodies made for the answer live in a buffer the next one reuses.
+	bool copy = false;
+};
+
+const char *Reason(int status) {
+	switch (status) {
+	case 200: return "OK";
+	case 201: return "Created";
+	case 204: return "No Content";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 409: return "Conflict";
+	case 411: return "Length Required";
+	case 431: return "Request Header Fields Too Large";
+	case 500: return "Internal Server Error";
+	case 501: return "Not Implemented";
+	default: return "Error";
+	}
+}
+
+// Error bodies are literals, so they are referenced like node text.
+Answer Failure(int status, std::string_view body) {
+	return {status, body};
+}
+
+void Respond(OutputQueue &out, const Answer &answer, bool close) {
+	std::string &text = out.Text();
+	text += "HTTP/1.1 ";
+	AppendNumber(text, answer.status);
+	text += ' ';
+	text += Reason(answer.status);
+	text += "\r\n";
+
+	if (answer.status != 204) {
+		text += "Content-Type: application/json\r\nContent-Length: ";
+		AppendNumber(text, answer.body.size());
+		text += "\r\n";
+	}
+	if (answer.created != SIZE_MAX) {
+		text += "Location: /sessions/";
+		AppendNumber(text, answer.created);
+		text += "\r\n";
+	}
+	if (close) {
+		text += "Connection: close\r\n";
+	}
+	text += "\r\n";
+
+	if (answer.copy) {
+		text += answer.body;
+	} else {
+		out.Reference(answer.body);
+	}
+}
+
+// Nodes that depend on the session (conditions, variables in text) are put
+// together for it, and the caller holds its shard lock.
+Answer NodeAnswer(const CompiledStory &story, const Playthrough &play, int status, size_t created = SIZE_MAX) {
+	uint32_t node = play.Current().node;
+	if (!story[node].dynamic) {
+		return {status, story.Json(node, play.Language()), created};
+	}
+
+	thread_local std::string body;
+	body.clear();
+	story.OfferedJson(node, play.State().registers.data(), body, play.Language());
+	return {status, body, created, true};
+}
+
+// The answer for a session just made at node, shown in language.
+Answer Created(const CompiledStory &story, SessionTable &sessions, Deadlines &deadlines, size_t id, uint32_t node,
+	const StringTable *language = nullptr) {
+	Answer answer = {201, story.Json(node, language), id};
+	if (story[node].dynamic || story[node].timeLimit) {
+		sessions.With(id, [&](Playthrough &play) {
+			if (story[node].dynamic) answer = NodeAnswer(story, play, 201, id);
+			AddDeadline(deadlines, story, id, play.Current());
+		});
+	}
+	return answer;
+}
+
+// Takes the next path segment off path as a number.
+bool Segment(std::string_view &path, size_t &value) {
+	if (path.empty() || path.front() != '/') {
+		return false;
+	}
+	path.remove_prefix(1);
+
+	auto [end, error] = std::from_chars(path.data(), path.data() + path.size(), value);
+	if (error != std::errc() || end == path.data()) {
+		return false;
+	}
+	path.remove_prefix(end - path.data());
+	return true;
+}
+
+// The value of name in a query of name=value pairs joined by '&', empty
+// if it has none.
+std::string_view Parameter(std::string_view query, std::string_view name) {
+	while (!query.empty()) {
+		size_t end = std::min(query.find('&'), query.size());
+		std::string_view pair = query.substr(0, end);
+		if (pair.size() > name.size() && pair.substr(0, name.size()) == name && pair[name.size()] == '=') {
+			return pair.substr(name.size() + 1);
+		}
+		query.remove_prefix(std::min(end + 1, query.size()));
+	}
+	return {};
+}
+
+// The language code names, none for the story's own; false if there is no such language.
+bool FindLanguage(Languages *languages, std::string_view code, const StringTable *&language) {
+	language = nullptr;
+	return code.empty() || (languages && (language = languages->Find(code)));
+}
+
+Answer Restore(const CompiledStory &story, SessionTable &sessions, Deadlines &deadlines, SaveFile *saves, std::string_view method,
+	std::string_view path) {
+	size_t slot;
+	if (!Segment(path, slot) || !path.empty()) {
+		return Failure(404, "{\"Error\":\"not found\"}");
+	}
+	if (method != "POST") {
+		return Failure(405, "{\"Error\":\"method not allowed\"}");
+	}
+	if (!saves) {
+		return Failure(501, "{\"Error\":\"saving is off\"}");
+	}
+
+	thread_local std::string record;
+	Session session;
+	if (!saves->Restore(slot, record)) {
+		return Failure(404, "{\"Error\":\"no save\"}");
+	}
+	if (!DecodeSession(story, record, session)) {
+		return Failure(409, "{\"Error\":\"save does not fit the story\"}");
+	}
+
+	uint32_t node;
+	size_t id = sessions.Resume(story, std::move(session), node);
+	return Created(story, sessions, deadlines, id, node);
+}
+
+Answer Save(const CompiledStory &story, SessionTable &sessions, SaveFile *saves, size_t id, std::string_view path) {
+	size_t slot;
+	if (!Segment(path, slot) || !path.empty()) {
+		return Failure(404, "{\"Error\":\"not found\"}");
+	}
+	if (!saves) {
+		return Failure(501, "{\"Error\":\"saving is off\"}");
+	}
+
+	// Encoded under the shard lock, written to the file outside it.
+	thread_local std::string record;
+	if (!sessions.With(id, [&](Playthrough &play) { EncodeSession(story, play.State(), record); })) {
+		return Failure(404, "{\"Error\":\"no such session\"}");
+	}
+	try {
+		saves->Checkpoint(slot, record);
+	} catch (std::runtime_error &) {
+		return Failure(500, "{\"Error\":\"cannot save\"}");
+	}
+	return {204, {}};
+}
+
+// What all the sessions have seen between them, for analytics.
+Answer Coverage(const CompiledStory &story, SessionTable &sessions) {
+	Bitset anyVisited(story.Size()), allVisited(story.Size());
+	Bitset anyChosen(story.ChoiceCount()), allChosen(story.ChoiceCount());
+	size_t count = 0;
+	sessions.ForEach([&](const Playthrough &play) {
+		const Session &session = play.State();
+		anyVisited |= session.visited;
+		anyChosen |= session.chosen;
+		if (count++ == 0) {
+			allVisited = session.visited;
+			allChosen = session.chosen;
+		} else {
+			allVisited &= session.visited;
+			allChosen &= session.chosen;
+		}
+	});
+
+	thread_local std::string body;
+	body = "{\"Sessions\":";
+	AppendNumber(body, count);
+	body += ",\"Nodes\":";
+	AppendNumber(body, story.Size());
+	body += ",\"VisitedByAny\":";
+	AppendNumber(body, anyVisited.Count());
+	body += ",\"VisitedByAll\":";
+	AppendNumber(body, allVisited.Count());
+	body += ",\"Choices\":";
+	AppendNumber(body, story.ChoiceCount());
+	body += ",\"ChosenByAny\":";
+	AppendNumber(body, anyChosen.Count());
+	body += ",\"ChosenByAll\":";
+	AppendNumber(body, allChosen.Count());
+	body += '}';
+	return {200, body, SIZE_MAX, true};
+}
+
+Answer Route(const CompiledStory &story, SessionTable &sessions, Deadlines &deadlines, SaveFile *saves, Languages *languages,
+	std::string_view method, std::string_view path) {
+	static const std::string_view prefix = "/sessions";
+	static const std::string_view savesPrefix = "/saves";
+
+	size_t mark = path.find('?');
+	std::string_view query = mark == std::string_view::npos ? std::string_view() : path.substr(mark + 1);
+	path = path.substr(0, mark);
+	if (path == "/coverage") {
+		if (method != "GET") return Failure(405, "{\"Error\":\"method not allowed\"}");
+		return Coverage(story, sessions);
+	}
+	if (path.substr(0, savesPrefix.size()) == savesPrefix) {
+		return Restore(story, sessions, deadlines, saves, method, path.substr(savesPrefix.size()));
+	}
+	if (path.substr(0, prefix.size()) != prefix) {
+		return Failure(404, "{\"Error\":\"not found\"}");
+	}
+	path.remove_prefix(prefix.size());
+
+	if (path.empty() || path == "/") {
+		if (method != "POST") return Failure(405, "{\"Error\":\"method not allowed\"}");
+
+		// ?seed=<n> replays the random draws of an earlier session.
+		size_t seed = 0;
+		std::string_view given = Parameter(query, "seed");
+		auto [end, error] = std::from_chars(given.data(), given.data() + given.size(), seed);
+		if (given.empty() || error != std::errc() || end != given.data() + given.size()) {
+			seed = NewSeed();
+		}
+		const StringTable *language;
+		if (!FindLanguage(languages, Parameter(query, "language"), language)) {
+			return Failure(404, "{\"Error\":\"no such language\"}");
+		}
+
+		uint32_t node;
+		size_t id = sessions.Start(story, seed, node);
+		if (language) {
+			sessions.With(id, [&](Playthrough &play) { play.SetLanguage(language); });
+		}
+		return Created(story, sessions, deadlines, id, node, language);
+	}
+
+	size_t id;
+	if (!Segment(path, id)) {
+		return Failure(404, "{\"Error\":\"not found\"}");
+	}
+
+	if (path.empty()) {
+		if (method == "GET") {
+			Answer answer = {200, {}};
+			if (!sessions.With(id, [&](Playthrough &play) { answer = NodeAnswer(story, play, 200); })) {
+				return Failure(404, "{\"Error\":\"no such session\"}");
+			}
+			return answer;
+		}
+		if (method == "DELETE") {
+			if (!sessions.End(id)) {
+				return Failure(404, "{\"Error\":\"no such session\"}");
+			}
+			return {204, {}};
+		}
+		return Failure(405, "{\"Error\":\"method not allowed\"}");
+	}
+
+	if (path == "/progress") {
+		if (method != "GET") return Failure(405, "{\"Error\":\"method not allowed\"}");
+
+		thread_local std::string body;
+		body.clear();
+		if (!sessions.With(id, [&](Playthrough &play) { AppendProgress(body, story, play.State()); })) {
+			return Failure(404, "{\"Error\":\"no such session\"}");
+		}
+		return {200, body, SIZE_MAX, true};
+	}
+
+	if (path == "/language" || path.substr(0, 10) == "/language/") {
+		if (method != "POST") return Failure(405, "{\"Error\":\"method not allowed\"}");
+
+		const StringTable *language;
+		if (!FindLanguage(languages, path.substr(std::min<size_t>(10, path.size())), language)) {
+			return Failure(404, "{\"Error\":\"no such language\"}");
+		}
+		Answer answer = {200, {}};
+		if (!sessions.With(id, [&](Playthrough &play) {
+			play.SetLanguage(language);
+			answer = NodeAnswer(story, play, 200);
+		})) {
+			return Failure(404, "{\"Error\":\"no such session\"}");
+		}
+		return answer;
+	}
+
+	bool back = path.substr(0, 5) == "/back";
+	bool next = path.substr(0, 5) == "/next";
+	bool save = path.substr(0, 5) == "/save";
+	if (!back && !next && !save) {
+		return Failure(404, "{\"Error\":\"not found\"}");
+	}
+	if (method != "POST") {
+		return Failure(405, "{\"Error\":\"method not allowed\"}");
+	}
+	if (save) {
+		return Save(story, sessions, saves, id, path.substr(5));
+	}
+
+	// The segment after /next is the choice, after /back the steps.
+	size_t choice = 0;
+	path.remove_prefix(5);
+	bool chosen = Segment(path, choice);
+	if (!path.empty()) {
+		return Failure(404, "{\"Error\":\"not found\"}");
+	}
+
+	Answer answer = {200, {}};
+	bool found = sessions.With(id, [&](Playthrough &play) {
+		const CompiledStory::Node &node = story[play.Current().node];
+		if (!back && !chosen && !node.automatic) {
+			answer = Failure(409, "{\"Error\":\"not a choice\"}");
+			return;
+		}
+
+		const Turn &turn = back ? play.Back(chosen ? choice : 1) : play.Choose(choice);
+		AddDeadline(deadlines, story, id, turn);
+		switch (turn.result) {
+		case StepResult::Moved: answer = NodeAnswer(story, play, 200); break;
+		case StepResult::TheEnd: answer = Failure(409, "{\"Error\":\"the end\"}"); break;
+		case StepResult::NotAChoice: answer = Failure(409, "{\"Error\":\"not a choice\"}"); break;
+		case StepResult::MissingNode: answer = Failure(409, "{\"Error\":\"missing node\"}"); break;
+		case StepResult::NoHistory: answer = Failure(409, "{\"Error\":\"no history\"}"); break;
+		}
+	});
+	if (!found) {
+		return Failure(404, "{\"Error\":\"no such session\"}");
+	}
+	return answer;
+}
+
+bool HeaderIs(std::string_view line, const char *name, std::string_view &value) {
+	size_t length = strlen(name);
+	if (line.size() <= length || line[length] != ':' || strncasecmp(line.data(), name, length) != 0) {
+		return false;
+	}
+
+	value = line.substr(length + 1);
+	while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+	while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+	return true;
+}
+
+bool Equals(std::string_view a, const char *b) {
+	return a.size() == strlen(b) && strncasecmp(a.data(), b, a.size()) == 0;
+}
+
+}
+
+size_t HandleHttp(const CompiledStory &story, SessionTable &sessions, Deadlines &deadlines, SaveFile *saves, Languages *languages,
+	const char *data, size_t size, OutputQueue &out, bool &close) {
+	std::string_view input(data, size);
+	size_t used = 0;
+
+	while (!close) {
+		std::string_view rest = input.substr(used);
+		size_t headEnd = rest.find("\r\n\r\n");
+		if (headEnd == std::string_view::npos) {
+			if (rest.size() > MaxHead) {
+				close = true;
+				Respond(out, Failure(431, "{\"Error\":\"header too large\"}"), true);
+			}
+			break;
+		}
+
+		std::string_view head = rest.substr(0, headEnd);
+		size_t lineEnd = head.find("\r\n");
+		std::string_view requestLine = head.substr(0, lineEnd);
+		head = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + 2);
+
+		// METHOD SP target SP HTTP/1.x
+		size_t space = requestLine.find(' ');
+		size_t lastSpace = requestLine.rfind(' ');
+		if (space == std::string_view::npos || lastSpace == space || requestLine.substr(lastSpace + 1, 7) != "HTTP/1.") {
+			close = true;
+			Respond(out, Failure(400, "{\"Error\":\"bad request\"}"), true);
+			break;
+		}
+		std::string_view method = requestLine.substr(0, space);
+		std::string_view target = requestLine.substr(space + 1, lastSpace - space - 1);
+		bool keepAlive = requestLine.substr(lastSpace + 1) != "HTTP/1.0";
+
+		size_t bodySize = 0;
+		int unsupported = 0;
+		while (!head.empty()) {
+			lineEnd = head.find("\r\n");
+			std::string_view line = head.substr(0, lineEnd);
+			head = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + 2);
+
+			std::string_view value;
+			if (HeaderIs(line, "Content-Length", value)) {
+				auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), bodySize);
+				if (error != std::errc() || end != value.data() + value.size() || bodySize > MaxHead) {
+					unsupported = 400;
+				}
+			} else if (HeaderIs(line, "Transfer-Encoding", value)) {
+				unsupported = 411;
+			} else if (HeaderIs(line, "Connection", value)) {
+				if (Equals(value, "close")) keepAlive = false;
+				if (Equals(value, "keep-alive")) keepAlive = true;
+			}
+		}
+
+		// Without a plain length the next request cannot be found.
+		if (unsupported) {
+			close = true;
+			Respond(out, Failure(unsupported, "{\"Error\":\"unsupported body\"}"), true);
+			break;
+		}
+
+		size_t requestSize = headEnd + 4 + bodySize;
+		if (rest.size() < requestSize) {
+			break;
+		}
+		used += requestSize;
+
+		close = !keepAlive;
+		Respond(out, Route(story, sessions, deadlines, saves, languages, method, target), close);
+	}
+
+	return used;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "compiled.h"
+#include "deadlines.h"
+#include "languages.h"
+#include "output.h"
+#include "playthrough.h"
+#include "savefile.h"
+
+// A minimal HTTP/1.1 front end for RunServer(): keep-alive by default,
+// pipelined requests answered in order, no chunked bodies. Node answers are
+// the node's JSON (see CompiledStory::Json()), sent straight from the story.
+//   POST   /sessions                  start a session: 201, Location: /sessions/<id>
+//   POST   /sessions?seed=<n>         the same, drawing at random nodes from seed n
+//   POST   /sessions?language=<code>  the same, shown in that language (see
+//                                     Languages); both may be given, joined by &
+//   GET    /sessions/<id>             current node
+//   POST   /sessions/<id>/next        go on from a node that is not a question
+//   POST   /sessions/<id>/next/<id>   choose the choice leading to <id>
+//   POST   /sessions/<id>/back        go back a step
+//   POST   /sessions/<id>/back/<n>    go back n steps
+//   DELETE /sessions/<id>             end the session: 204
+//   GET    /sessions/<id>/progress    see AppendProgress()
+//   POST   /sessions/<id>/language/<code> show the session in that language
+//                                     from now on: 200 and the node in it
+//   POST   /sessions/<id>/language    the same, in the story's own
+//   GET    /coverage                  the nodes and choices seen by any and by
+//                                     all of the sessions, and how many there are
+//   POST   /sessions/<id>/save/<slot> save the session in the slot: 204
+//   POST   /saves/<slot>              start a session from the save: 201, as above
+// Failures answer 4xx with {"Error":"<reason>"}, or 501 on saves without
+// a save file.
+// A timed question's node has "TimeLimit" (seconds) and "DefaultChoice".
+// Once the time is up without an answer, counted from when the request
+// that came to it was answered, the default is taken as if chosen, and the
+// next GET shows where it led.
+
+// Answers the complete requests at the front of data into out and returns
+// the bytes they took. Sets close once the connection should end after the
+// answers, and nothing more is read from it. Sessions that come to a timed
+// question get their deadline in deadlines, keyed by session ID.
+size_t HandleHttp(const CompiledStory &story, SessionTable &sessions, Deadlines &deadlines, SaveFile *saves, Languages *languages,
+	const char *data, size_t size, OutputQueue &out, bool &close);
@@ -0,0 +1,83 @@
+#include "input.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+Input::Input(Deadlines &deadlines, int fd) : deadlines(deadlines), fd(fd) {
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0) {
+		throw std::runtime_error(std::string("Cannot create epoll: ") + strerror(errno));
+	}
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = &deadlines;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, deadlines.Fd(), &event);
+	event.data.ptr = this;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		file = errno == EPERM;
+	}
+}
+
+Input::~Input() {
+	close(epollFd);
+}
+
+Input::Event Input::Wait() {
+	// fd is left blocking, as it is shared with whoever started us; only
+	// one read follows each time it is ready.
+	if (file) {
+		return Readable;
+	}
+
+	epoll_event events[2];
+	int n = epoll_wait(epollFd, events, 2, -1);
+	if (n < 0) {
+		return Interrupted;
+	}
+	for (int i = 0; i < n; ++i) {
+		if (events[i].data.ptr == &deadlines) {
+			return Expired;
+		}
+	}
+	return Readable;
+}
+
+Input::Event Input::ReadLine(std::string &line) {
+	while (true) {
+		size_t end = pending.find('\n');
+		if (end != std::string::npos) {
+			line.assign(pending, 0, end);
+			pending.erase(0, end + 1);
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			return Line;
+		}
+
+		Event event = Wait();
+		if (event == Expired) {
+			return Expired;
+		}
+		if (event == Interrupted) {
+			continue;
+		}
+
+		char buffer[4096];
+		ssize_t n = read(fd, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			if (pending.empty()) {
+				return Closed;
+			}
+			line = std::move(pending);
+			pending.clear();
+			return Line;
+		}
+		pending.append(buffer, n);
+	}
+}
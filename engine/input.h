@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+#include "deadlines.h"
+
+// The player's input and the deadlines of a front end in one epoll, so a
+// key or line, a deadline coming due, or the end of input wakes it,
+// whichever comes first, and nothing spins in between. Input from a file,
+// which epoll does not take, is always ready.
+class Input {
+public:
+	enum Event { Readable, Line, Closed, Expired, Interrupted };
+
+	explicit Input(Deadlines &deadlines, int fd = 0);
+	~Input();
+
+	Input(const Input &) = delete;
+	Input &operator=(const Input &) = delete;
+
+	int Fd() const { return fd; }
+
+	// Readable once fd can be read without blocking, Expired once deadlines
+	// are due (call Deadlines::Expire()), or Interrupted by a signal.
+	Event Wait();
+	// A whole line, without its newline, or what is left at the end; then
+	// Closed. Expired as above; signals are waited through.
+	Event ReadLine(std::string &line);
+
+private:
+	Deadlines &deadlines;
+	int fd;
+	int epollFd;
+	bool file = false;
+	// Read past the last line handed out.
+	std::string pending;
+};
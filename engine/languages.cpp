@@ -0,0 +1,153 @@
+#include "languages.h"
+#include "writer.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const uint64_t Magic = 0x3153474e49525453ull; // "STRINGS1"
+
+struct Header {
+	uint64_t magic;
+	uint64_t hash;
+	uint64_t parts;
+	uint64_t nodes;
+	uint64_t segments;
+};
+
+template <class T>
+void WriteArray(FileWriter &out, const T *data, size_t count) {
+	out.Write(reinterpret_cast<const char *>(data), count * sizeof(T));
+}
+
+// Everything a table holds points into the story and into its own text.
+bool Fits(const CompiledStory &story, const Header &header, const StringTable &table, size_t textSize) {
+	for (size_t part = 0; part < table.parts; ++part) {
+		if (table.offsets[part] > table.offsets[part + 1] || table.partSegments[part] > table.partSegments[part + 1]) {
+			return false;
+		}
+	}
+	if (table.offsets[table.parts] != textSize || table.partSegments[table.parts] != header.segments) {
+		return false;
+	}
+	for (size_t i = 0; i < header.segments; ++i) {
+		const StringTable::Segment &segment = table.segments[i];
+		if (segment.offset > textSize || segment.size > textSize - segment.offset
+			|| (segment.slot != Script::None && segment.slot >= story.Scripts().Variables())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ValidCode(std::string_view code) {
+	if (code.empty()) {
+		return false;
+	}
+	for (char c : code) {
+		if (!isalnum((unsigned char)c) && c != '-' && c != '_') {
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+Languages::Languages(const CompiledStory &story, std::string base) : story(story), base(std::move(base)) {}
+
+Languages::~Languages() {
+	for (auto &[code, mapped] : loaded) {
+		if (mapped) {
+			munmap(mapped->data, mapped->size);
+		}
+	}
+}
+
+const StringTable *Languages::Find(std::string_view code) {
+	if (!ValidCode(code)) {
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = loaded.find(code);
+	if (it == loaded.end()) {
+		auto mapped = std::make_unique<Mapped>();
+		if (!Map(base + "." + std::string(code) + ".strings", *mapped)) {
+			mapped.reset();
+		}
+		it = loaded.emplace(std::string(code), std::move(mapped)).first;
+	}
+	return it->second ? &it->second->table : nullptr;
+}
+
+bool Languages::Map(const std::string &filename, Mapped &mapped) {
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) < 0 || size_t(info.st_size) < sizeof(Header)) {
+		close(fd);
+		return false;
+	}
+	mapped.size = info.st_size;
+	mapped.data = mmap(nullptr, mapped.size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped.data == MAP_FAILED) {
+		return false;
+	}
+
+	const char *data = static_cast<const char *>(mapped.data);
+	Header header;
+	memcpy(&header, data, sizeof(header));
+	// Each array is checked against what is left, so sizes cannot overflow.
+	size_t left = mapped.size - sizeof(header);
+	auto take = [&](uint64_t count, size_t size) {
+		if (count > left / size) {
+			return false;
+		}
+		left -= count * size;
+		return true;
+	};
+	bool fits = header.magic == Magic && header.hash == story.Hash()
+		&& header.parts == story.Strings().parts && header.nodes == story.Size()
+		&& take(header.parts + 1, sizeof(uint64_t)) && take(header.parts + 1, sizeof(uint32_t))
+		&& take(header.nodes, sizeof(uint32_t)) && take(header.segments, sizeof(StringTable::Segment));
+	if (fits) {
+		StringTable &table = mapped.table;
+		const char *at = data + sizeof(header);
+		table.parts = header.parts;
+		table.offsets = reinterpret_cast<const uint64_t *>(at);
+		at += (header.parts + 1) * sizeof(uint64_t);
+		table.partSegments = reinterpret_cast<const uint32_t *>(at);
+		at += (header.parts + 1) * sizeof(uint32_t);
+		table.heads = reinterpret_cast<const uint32_t *>(at);
+		at += header.nodes * sizeof(uint32_t);
+		table.segments = reinterpret_cast<const StringTable::Segment *>(at);
+		at += header.segments * sizeof(StringTable::Segment);
+		table.text = at;
+		fits = Fits(story, header, table, left);
+	}
+	if (!fits) {
+		munmap(mapped.data, mapped.size);
+	}
+	return fits;
+}
+
+void SaveStrings(const std::string &filename, const CompiledStory &story, const StringTable::Storage &strings) {
+	Header header = {Magic, story.Hash(), strings.offsets.size() - 1, strings.heads.size(), strings.segments.size()};
+	FileWriter out(filename);
+	WriteArray(out, &header, 1);
+	WriteArray(out, strings.offsets.data(), strings.offsets.size());
+	WriteArray(out, strings.partSegments.data(), strings.partSegments.size());
+	WriteArray(out, strings.heads.data(), strings.heads.size());
+	WriteArray(out, strings.segments.data(), strings.segments.size());
+	out.Write(strings.text);
+	out.Commit();
+}
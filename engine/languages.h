@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "compiled.h"
+#include "stringtable.h"
+
+// Translations of a story, each a string table file (see
+// CompiledStory::Translate()) named <base>.<code>.strings, base being the
+// story's file name without .json. A table is mapped the first time it is
+// asked for, and only the pages that are read get loaded, so hosting many
+// languages costs the graph once and each the text that is played in it.
+// Switching a session to another language is just pointing it at another
+// table.
+//
+// Files are, in native byte order:
+//   u64 magic, u64 story hash, u64 parts, u64 nodes, u64 segments,
+//   u64 offsets[parts + 1], u32 partSegments[parts + 1], u32 heads[nodes],
+//   segments (u32 offset, size, slot each), text
+class Languages {
+public:
+	Languages(const CompiledStory &story, std::string base);
+	~Languages();
+
+	Languages(const Languages &) = delete;
+	Languages &operator=(const Languages &) = delete;
+
+	// Null if there is no table for code, or it does not fit the story.
+	// Codes are letters, digits, '-' and '_'. Any thread may ask.
+	const StringTable *Find(std::string_view code);
+
+private:
+	struct Mapped {
+		void *data;
+		size_t size;
+		StringTable table;
+	};
+
+	bool Map(const std::string &filename, Mapped &mapped);
+
+	const CompiledStory &story;
+	std::string base;
+	std::mutex lock;
+	// Codes without a table are kept as well, so they are only looked for once.
+	std::map<std::string, std::unique_ptr<Mapped>, std::less<>> loaded;
+};
+
+// Writes strings, built by story.Translate(), as a table file Languages can
+// map. Throws std::runtime_error if it cannot.
+void SaveStrings(const std::string &filename, const CompiledStory &story, const StringTable::Storage &strings);
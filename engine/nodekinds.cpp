@@ -0,0 +1,51 @@
+#include "nodekinds.h"
+
+#include <dlfcn.h>
+
+#include <stdexcept>
+
+NodeKinds::~NodeKinds() {
+	for (void *library : libraries) {
+		dlclose(library);
+	}
+}
+
+void NodeKinds::Add(const StoryNodeKind &kind) {
+	for (StoryNodeKind &existing : kinds) {
+		if (std::string_view(existing.name) == kind.name) {
+			existing = kind;
+			return;
+		}
+	}
+	kinds.push_back(kind);
+}
+
+void NodeKinds::Load(const std::string &filename) {
+	void *library = dlopen(filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!library) {
+		throw std::runtime_error(dlerror());
+	}
+	libraries.push_back(library);
+
+	auto list = reinterpret_cast<StoryNodeKindsFunction>(dlsym(library, "story_node_kinds"));
+	if (!list) {
+		throw std::runtime_error(filename + ": not a node kind plugin");
+	}
+
+	// Asked again with room for all if there are more than fit.
+	std::vector<StoryNodeKind> loaded(16);
+	int count = list(STORY_KIND_ABI, loaded.data(), loaded.size());
+	if (count > int(loaded.size())) {
+		loaded.resize(count);
+		count = list(STORY_KIND_ABI, loaded.data(), loaded.size());
+	}
+	if (count < 0 || count > int(loaded.size())) {
+		throw std::runtime_error(filename + ": plugin of another ABI version");
+	}
+	for (int i = 0; i < count; ++i) {
+		if (!loaded[i].name || !loaded[i].next) {
+			throw std::runtime_error(filename + ": kind without a name or next");
+		}
+		Add(loaded[i]);
+	}
+}
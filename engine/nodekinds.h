@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "storykind.h"
+
+// The node kinds a story may name in a node's "Kind" (see storykind.h),
+// added by the program itself or loaded from plugins. Stories look them up
+// once, when compiled (see CompiledStory), and play them through their own
+// table; the registry is only needed until then.
+class NodeKinds {
+public:
+	NodeKinds() = default;
+	~NodeKinds();
+
+	NodeKinds(const NodeKinds &) = delete;
+	NodeKinds &operator=(const NodeKinds &) = delete;
+
+	// A kind of the same name as one added before replaces it.
+	void Add(const StoryNodeKind &kind);
+	// Adds the kinds of a plugin, which stays loaded until this is gone.
+	// Throws std::runtime_error if it cannot be loaded or is of another ABI.
+	void Load(const std::string &filename);
+
+	// Null if there is no such kind.
+	const StoryNodeKind *Find(std::string_view name) const {
+		for (const StoryNodeKind &kind : kinds) {
+			if (name == kind.name) {
+				return &kind;
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	std::vector<StoryNodeKind> kinds;
+	std::vector<void *> libraries;
+};
@@ -0,0 +1,289 @@
+#include "optimize.h"
+
+#include <deque>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+#include "script.h"
+
+namespace {
+
+size_t Edges(const Story &story) {
+	size_t edges = 0;
+	for (auto &[id, dial] : story) {
+		edges += Targets(*dial).size();
+	}
+	return edges;
+}
+
+// What is known on leaving a node, once its effect has run.
+Script::Values Leaving(const Dialogue &dial, Script::Values known) {
+	if (!dial.Effect.empty()) {
+		Script::FoldEffect(dial.Effect, known);
+	}
+	return known;
+}
+
+// False only if the choice's condition is known not to hold.
+bool MayOffer(const Dialogue &dial, size_t nextID, const Script::Values &leaving) {
+	auto condition = dial.Conditions.find(nextID);
+	int64_t value;
+	return condition == dial.Conditions.end() || !Script::FoldCondition(condition->second, leaving, value) || value != 0;
+}
+
+// The variables known on arriving at each node that can be reached from
+// node 0 through choices that may be offered.
+std::map<size_t, Script::Values> Propagate(const Story &story) {
+	// Compiling everything once checks it and finds every variable, all
+	// known to start at 0.
+	Script all;
+	for (auto &[id, dial] : story) {
+		try {
+			if (!dial->Effect.empty()) {
+				all.CompileEffect(dial->Effect);
+			}
+			for (auto &[nextID, condition] : dial->Conditions) {
+				all.CompileCondition(condition);
+			}
+		} catch (std::runtime_error &e) {
+			throw std::runtime_error("Node " + std::to_string(id) + ": " + e.what());
+		}
+	}
+	Script::Values start;
+	for (size_t slot = 0; slot < all.Variables(); ++slot) {
+		start.emplace(all.VariableName(slot), 0);
+	}
+
+	std::map<size_t, Script::Values> arriving;
+	std::deque<size_t> work;
+	std::set<size_t> queued;
+	auto reach = [&](size_t id, const Script::Values &known) {
+		if (!story.count(id)) {
+			return;
+		}
+
+		// Only what every way in agrees on stays known, so a node is only
+		// looked at again when that shrinks.
+		auto [it, added] = arriving.try_emplace(id, known);
+		bool changed = added;
+		for (auto value = it->second.begin(); !added && value != it->second.end();) {
+			auto other = known.find(value->first);
+			if (other == known.end() || other->second != value->second) {
+				value = it->second.erase(value);
+				changed = true;
+			} else {
+				++value;
+			}
+		}
+		if (changed && queued.insert(id).second) {
+			work.push_back(id);
+		}
+	};
+
+	reach(0, start);
+	while (!work.empty()) {
+		size_t id = work.front();
+		work.pop_front();
+		queued.erase(id);
+
+		const Dialogue &dial = *story.at(id);
+		Script::Values leaving = Leaving(dial, arriving[id]);
+		if (dial.IsDialogue) {
+			if (dial.NextID != 0) {
+				reach(dial.NextID, leaving);
+			}
+			continue;
+		}
+		for (auto &[nextID, text] : dial.Choices) {
+			if (MayOffer(dial, nextID, leaving)) {
+				reach(nextID, leaving);
+			}
+		}
+	}
+
+	return arriving;
+}
+
+size_t RemoveUnreachable(Story &story) {
+	std::set<size_t> reached;
+	std::vector<size_t> work;
+	if (story.count(0)) {
+		reached.insert(0);
+		work.push_back(0);
+	}
+	while (!work.empty()) {
+		size_t id = work.back();
+		work.pop_back();
+		for (size_t target : Targets(*story.at(id))) {
+			if (story.count(target) && reached.insert(target).second) {
+				work.push_back(target);
+			}
+		}
+	}
+
+	size_t removed = 0;
+	for (auto it = story.begin(); it != story.end();) {
+		if (reached.count(it->first)) {
+			++it;
+		} else {
+			it = story.erase(it);
+			++removed;
+		}
+	}
+	return removed;
+}
+
+// Points every way into a dialogue node without text or effect at where it
+// leads instead. One that ends the story is kept, as a choice leading to 0
+// goes to node 0.
+void SkipEmpty(Story &story) {
+	auto empty = [&](size_t id) {
+		auto it = story.find(id);
+		return id != 0 && it != story.end() && it->second->IsDialogue && it->second->Text.empty() && it->second->Effect.empty();
+	};
+	// A loop of them stops anywhere on it.
+	auto through = [&](size_t id) {
+		for (size_t steps = 0; empty(id) && story.at(id)->NextID != 0 && steps < story.size(); ++steps) {
+			id = story.at(id)->NextID;
+		}
+		return id;
+	};
+
+	for (auto &[id, node] : story) {
+		const Dialogue &dial = *node;
+		if (dial.IsDialogue) {
+			size_t next = through(dial.NextID);
+			if (next != dial.NextID) {
+				EditNode(story, id).NextID = next;
+			}
+			continue;
+		}
+
+		// A plugin picks its choice by its place among them, so they stay
+		// as they are. A choice already leading where another would now is
+		// left alone.
+		if (!dial.Kind.empty()) {
+			continue;
+		}
+		std::vector<std::pair<size_t, size_t>> moves;
+		for (auto &[nextID, text] : dial.Choices) {
+			size_t next = through(nextID);
+			if (next != nextID && !dial.Choices.count(next)) {
+				moves.emplace_back(nextID, next);
+			}
+		}
+		for (auto [from, to] : moves) {
+			Dialogue &edited = EditNode(story, id);
+			edited.Choices[to] = std::move(edited.Choices[from]);
+			edited.Choices.erase(from);
+			auto condition = edited.Conditions.find(from);
+			if (condition != edited.Conditions.end()) {
+				edited.Conditions[to] = std::move(condition->second);
+				edited.Conditions.erase(from);
+			}
+			auto weight = edited.Weights.find(from);
+			if (weight != edited.Weights.end()) {
+				edited.Weights[to] = weight->second;
+				edited.Weights.erase(from);
+			}
+			if (edited.DefaultChoice == from) {
+				edited.DefaultChoice = to;
+			}
+		}
+	}
+}
+
+// Folds each dialogue node whose only way in is the one before it into
+// that one; texts are only joined when joinText is set.
+size_t JoinChains(Story &story, bool joinText) {
+	std::map<size_t, size_t> incoming;
+	for (auto &[id, dial] : story) {
+		for (size_t target : Targets(*dial)) {
+			++incoming[target];
+		}
+	}
+
+	size_t joined = 0;
+	for (auto &[id, node] : story) {
+		while (node->IsDialogue && node->NextID != 0 && node->NextID != id) {
+			auto next = story.find(node->NextID);
+			if (next == story.end() || !next->second->IsDialogue || incoming[next->first] != 1 || (!joinText && !next->second->Text.empty())) {
+				break;
+			}
+			// The effect would run before a {variable} in this text is filled in.
+			if (!next->second->Effect.empty() && node->Text.find('{') != std::string::npos) {
+				break;
+			}
+
+			std::shared_ptr<Dialogue> folded = next->second;
+			story.erase(next);
+			Dialogue &dial = EditNode(story, id);
+			if (dial.Text.empty() || folded->Text.empty()) {
+				dial.Text += folded->Text;
+			} else {
+				dial.Text += '\n' + folded->Text;
+			}
+			if (!dial.Effect.empty() && !folded->Effect.empty()) {
+				dial.Effect += "; ";
+			}
+			dial.Effect += folded->Effect;
+			dial.NextID = folded->NextID;
+			++joined;
+		}
+	}
+	return joined;
+}
+
+}
+
+OptimizeReport OptimizeStory(Story &story, bool joinText) {
+	OptimizeReport report;
+	report.nodesBefore = story.size();
+	report.edgesBefore = Edges(story);
+
+	std::map<size_t, Script::Values> arriving = Propagate(story);
+
+	for (auto it = story.begin(); it != story.end();) {
+		auto reached = arriving.find(it->first);
+		if (reached == arriving.end()) {
+			it = story.erase(it);
+			++report.unreachable;
+			continue;
+		}
+
+		const Dialogue &dial = *it->second;
+		std::vector<std::pair<size_t, bool>> folded;
+		if (!dial.IsDialogue && !dial.Conditions.empty()) {
+			Script::Values leaving = Leaving(dial, reached->second);
+			for (auto &[nextID, condition] : dial.Conditions) {
+				int64_t value;
+				if (Script::FoldCondition(condition, leaving, value)) {
+					folded.emplace_back(nextID, value != 0);
+				}
+			}
+		}
+		for (auto [nextID, offered] : folded) {
+			Dialogue &edited = EditNode(story, it->first);
+			edited.Conditions.erase(nextID);
+			if (offered) {
+				++report.alwaysOffered;
+			} else {
+				edited.Choices.erase(nextID);
+				edited.TotalChoices = edited.Choices.size();
+				++report.neverOffered;
+			}
+		}
+		++it;
+	}
+
+	SkipEmpty(story);
+	report.skipped = RemoveUnreachable(story);
+	report.joined = JoinChains(story, joinText);
+
+	report.nodesAfter = story.size();
+	report.edgesAfter = Edges(story);
+	return report;
+}
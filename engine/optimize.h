@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "story.h"
+
+struct OptimizeReport {
+	size_t nodesBefore = 0, nodesAfter = 0;
+	size_t edgesBefore = 0, edgesAfter = 0;
+	// Conditions that always hold, so the choice is always offered, and
+	// that never do, so it is dropped.
+	size_t alwaysOffered = 0, neverOffered = 0;
+	size_t unreachable = 0;
+	// Dialogue nodes folded into the one before them or skipped over.
+	size_t joined = 0, skipped = 0;
+};
+
+// Rewrites story into one that plays the same for less.
+//
+// Which variables hold a known value on arriving at each node is worked
+// out from node 0 over the graph (constant propagation: a variable is known
+// where every way in agrees on it). Conditions that come to a constant
+// there are dropped, or their choice is, and nodes left unreachable go.
+// Dialogue nodes with neither text nor effect are skipped over, and one
+// whose only way in is the dialogue node before it is folded into that
+// node when it has no text, or always when joinText is set, which joins
+// the two texts with a newline and so shows them as one step.
+//
+// Throws std::runtime_error naming the node of a script that does not
+// compile.
+OptimizeReport OptimizeStory(Story &story, bool joinText = false);
@@ -0,0 +1,88 @@
+#include "output.h"
+
+#include <errno.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+void OutputQueue::Reference(std::string_view text) {
+	if (text.empty()) {
+		return;
+	}
+
+	Seal();
+	pieces.push_back({text.data(), 0, text.size()});
+	pending += text.size();
+}
+
+void OutputQueue::Seal() {
+	if (owned.size() > sealed) {
+		pieces.push_back({nullptr, sealed, owned.size() - sealed});
+		pending += owned.size() - sealed;
+		sealed = owned.size();
+	}
+}
+
+void OutputQueue::Compact() {
+	size_t sent = owned.size();
+	for (size_t i = first; i < pieces.size(); ++i) {
+		if (!pieces[i].data) {
+			sent = pieces[i].offset;
+			break;
+		}
+	}
+
+	owned.erase(0, sent);
+	sealed -= sent;
+	pieces.erase(pieces.begin(), pieces.begin() + first);
+	first = 0;
+	for (Piece &piece : pieces) {
+		if (!piece.data) piece.offset -= sent;
+	}
+}
+
+bool OutputQueue::Flush(int fd) {
+	Seal();
+
+	while (first < pieces.size()) {
+		// As many pieces per call as the kernel takes (IOV_MAX).
+		iovec iov[1024];
+		int count = 0;
+		for (size_t i = first; i < pieces.size() && count < 1024; ++i, ++count) {
+			const Piece &piece = pieces[i];
+			iov[count].iov_base = (void *)(piece.data ? piece.data : owned.data() + piece.offset);
+			iov[count].iov_len = piece.size;
+		}
+
+		ssize_t n = writev(fd, iov, count);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN) return false;
+
+			// A peer that keeps up only just would otherwise never let the
+			// queue empty, and it would grow without end.
+			if (first > pieces.size() / 2) Compact();
+			return true;
+		}
+
+		pending -= n;
+		while (n > 0) {
+			Piece &piece = pieces[first];
+			size_t used = std::min((size_t)n, piece.size);
+			if (piece.data) {
+				piece.data += used;
+			} else {
+				piece.offset += used;
+			}
+			piece.size -= used;
+			n -= used;
+			if (piece.size == 0) ++first;
+		}
+	}
+
+	pieces.clear();
+	owned.clear();
+	sealed = 0;
+	first = 0;
+	return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bytes waiting to go out on a socket or stream. What is built per answer
+// is copied into the queue; text that outlives it, like the story's
+// pre-rendered nodes, is only referenced and goes out with writev from
+// where it lives.
+class OutputQueue {
+public:
+	// Append to this; it is sent in order with what is referenced.
+	std::string &Text() { return owned; }
+	void Reference(std::string_view text);
+
+	size_t Pending() const { return pending + owned.size() - sealed; }
+
+	// Writes as much as fd takes. False on errors other than a full non-blocking fd.
+	bool Flush(int fd);
+
+private:
+	// data is null for owned text, which is found by offset: owned may move.
+	struct Piece {
+		const char *data;
+		size_t offset;
+		size_t size;
+	};
+
+	void Seal();
+	void Compact();
+
+	std::string owned;
+	size_t sealed = 0;
+	std::vector<Piece> pieces;
+	size_t first = 0;
+	size_t pending = 0;
+};
+
+inline void AppendNumber(std::string &out, size_t value) {
+	char digits[24];
+	out.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+}
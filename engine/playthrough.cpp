@@ -0,0 +1,121 @@
+#include "playthrough.h"
+
+#include <cstddef>
+#include <new>
+
+namespace {
+
+// Frames come and go with sessions and are all one of a few sizes, so freed
+// ones are kept in per-size lists and handed out again. A frame freed on
+// another thread than the one that made it joins that thread's lists.
+class FramePool {
+public:
+	void *Allocate(size_t size) {
+		size_t sizeClass = (size + Granule - 1) / Granule;
+		if (sizeClass >= Classes) {
+			return ::operator new(size);
+		}
+
+		if (Block *block = free[sizeClass]) {
+			free[sizeClass] = block->next;
+			return block;
+		}
+
+		size_t bytes = sizeClass * Granule;
+		if (left < bytes) {
+			// Chunks are never given back; their frames are reused instead.
+			chunk = static_cast<char *>(::operator new(ChunkSize));
+			left = ChunkSize;
+		}
+		void *frame = chunk;
+		chunk += bytes;
+		left -= bytes;
+		return frame;
+	}
+
+	void Release(void *frame, size_t size) {
+		size_t sizeClass = (size + Granule - 1) / Granule;
+		if (sizeClass >= Classes) {
+			::operator delete(frame);
+			return;
+		}
+
+		Block *block = static_cast<Block *>(frame);
+		block->next = free[sizeClass];
+		free[sizeClass] = block;
+	}
+
+private:
+	static const size_t Granule = alignof(std::max_align_t);
+	static const size_t Classes = 1024 / Granule;
+	static const size_t ChunkSize = 256 << 10;
+
+	struct Block {
+		Block *next;
+	};
+
+	Block *free[Classes] = {};
+	char *chunk = nullptr;
+	size_t left = 0;
+};
+
+thread_local FramePool pool;
+
+// Only arrivals at timed questions take a number, so untimed play never
+// touches it.
+std::atomic<uint64_t> arrivals{1};
+
+}
+
+void *Playthrough::promise_type::operator new(size_t size) {
+	return pool.Allocate(size);
+}
+
+void Playthrough::promise_type::operator delete(void *frame, size_t size) {
+	pool.Release(frame, size);
+}
+
+Playthrough Play(const CompiledStory &story, Session session) {
+	Turn turn = {StepResult::Moved, session.node, 0};
+
+	while (true) {
+		if (turn.result == StepResult::Moved) {
+			turn.arrival = story[turn.node].timeLimit ? arrivals.fetch_add(1, std::memory_order_relaxed) : 0;
+		}
+		Reply reply = co_yield turn;
+		turn.result = reply.back ? StepBack(session, reply.choice) : Step(story, session, reply.choice);
+		turn.node = session.node;
+	}
+}
+
+size_t SessionTable::Add(Playthrough play, uint32_t &node) {
+	size_t shardIndex = next.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+	Shard &shard = shards[shardIndex];
+	std::lock_guard<std::mutex> lock(shard.lock);
+
+	size_t index;
+	if (!shard.free.empty()) {
+		index = shard.free.back();
+		shard.free.pop_back();
+	} else {
+		index = shard.sessions.size();
+		shard.sessions.emplace_back();
+	}
+
+	shard.sessions[index] = std::move(play);
+	node = shard.sessions[index].Current().node;
+	return index * ShardCount + shardIndex;
+}
+
+bool SessionTable::End(size_t id) {
+	Shard &shard = shards[id % ShardCount];
+	size_t index = id / ShardCount;
+	std::lock_guard<std::mutex> lock(shard.lock);
+	if (index >= shard.sessions.size() || !shard.sessions[index]) {
+		return false;
+	}
+
+	shard.sessions[index] = Playthrough();
+	shard.free.push_back(index);
+	return true;
+}
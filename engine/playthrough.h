@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <coroutine>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "compiled.h"
+#include "session.h"
+
+// What a playthrough hands out each time it stops: how the last answer went
+// and the node it stands on now.
+struct Turn {
+	StepResult result;
+	uint32_t node;
+	// Numbers each arrival at a timed question, never the same twice in a
+	// process, so a deadline set on arriving can tell whether the player is
+	// still there; 0 on other nodes.
+	uint64_t arrival;
+};
+
+// What it is resumed with: a choice (ignored on nodes that go on by
+// themselves), or going back that many steps.
+struct Reply {
+	bool back;
+	size_t choice;
+};
+
+// One player's way through the story as a coroutine. It yields a Turn at
+// every node and waits for the Reply, so whoever holds it, a console loop
+// or a server's event loop, drives it one answer at a time and any number
+// of them share a thread. Frames come from a per-thread pool.
+class Playthrough {
+public:
+	struct promise_type {
+		Turn turn;
+		Reply reply;
+		const Session *session;
+		const StringTable *language = nullptr;
+
+		promise_type(const CompiledStory &, Session &session) : session(&session) {}
+
+		Playthrough get_return_object() {
+			return Playthrough(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		// Runs up to the first node straight away.
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { throw; }
+
+		struct Answer {
+			promise_type &promise;
+			bool await_ready() noexcept { return false; }
+			void await_suspend(std::coroutine_handle<>) noexcept {}
+			Reply await_resume() noexcept { return promise.reply; }
+		};
+		Answer yield_value(Turn turn) {
+			this->turn = turn;
+			return {*this};
+		}
+
+		static void *operator new(size_t size);
+		static void operator delete(void *frame, size_t size);
+	};
+
+	Playthrough() = default;
+	Playthrough(Playthrough &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+	Playthrough &operator=(Playthrough &&other) noexcept {
+		std::swap(handle, other.handle);
+		return *this;
+	}
+	~Playthrough() {
+		if (handle) handle.destroy();
+	}
+
+	explicit operator bool() const { return bool(handle); }
+
+	const Turn &Current() const { return handle.promise().turn; }
+	// Where it stands, for saving.
+	const Session &State() const { return *handle.promise().session; }
+	// What it is shown in, null for the story's own text (see Languages).
+	const StringTable *Language() const { return handle.promise().language; }
+	void SetLanguage(const StringTable *language) { handle.promise().language = language; }
+	const Turn &Answer(Reply reply) {
+		handle.promise().reply = reply;
+		handle.resume();
+		return Current();
+	}
+	const Turn &Choose(size_t choice) { return Answer({false, choice}); }
+	const Turn &Back(size_t steps = 1) { return Answer({true, steps}); }
+
+private:
+	explicit Playthrough(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+// Goes on from session, which must stand on a node of the story. It never
+// finishes on its own: the end of the story is a turn like any other, and
+// going back from it is allowed. Dropping the Playthrough ends it.
+Playthrough Play(const CompiledStory &story, Session session);
+
+// Starts at node 0, which the story must have.
+inline Playthrough Play(const CompiledStory &story, uint64_t seed = 0) {
+	Session session;
+	StartSession(story, session, seed);
+	return Play(story, std::move(session));
+}
+
+// Playthroughs any thread can reach by ID, for front ends where a session
+// outlives the connection that started it. Split into shards with a lock
+// each so threads rarely wait on one another.
+class SessionTable {
+public:
+	// Starts a playthrough, returns its ID and sets node to where it stands.
+	size_t Start(const CompiledStory &story, uint64_t seed, uint32_t &node) { return Add(Play(story, seed), node); }
+	// The same for a playthrough going on from a restored session.
+	size_t Resume(const CompiledStory &story, Session session, uint32_t &node) {
+		return Add(Play(story, std::move(session)), node);
+	}
+	// Runs update on the playthrough under its shard's lock, false if there is none.
+	template <typename Update>
+	bool With(size_t id, Update update) {
+		Shard &shard = shards[id % ShardCount];
+		size_t index = id / ShardCount;
+		std::lock_guard<std::mutex> lock(shard.lock);
+		if (index >= shard.sessions.size() || !shard.sessions[index]) {
+			return false;
+		}
+		update(shard.sessions[index]);
+		return true;
+	}
+	bool End(size_t id);
+	// Runs visit on every playthrough, one shard locked at a time.
+	template <typename Visit>
+	void ForEach(Visit visit) {
+		for (Shard &shard : shards) {
+			std::lock_guard<std::mutex> lock(shard.lock);
+			for (const Playthrough &play : shard.sessions) {
+				if (play) visit(play);
+			}
+		}
+	}
+
+private:
+	static const size_t ShardCount = 64;
+
+	size_t Add(Playthrough play, uint32_t &node);
+
+	struct alignas(64) Shard {
+		std::mutex lock;
+		std::vector<Playthrough> sessions;
+		std::vector<uint32_t> free;
+	};
+
+	Shard shards[ShardCount];
+	std::atomic<size_t> next{0};
+};
@@ -0,0 +1,256 @@
+#include "savefile.h"
+#include "writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace {
+
+const char Magic[8] = {'S', 'T', 'S', 'V', 1, 0, 0, 0};
+const size_t HeaderSize = 16;
+
+// The file is mapped once over this much address space and grows inside
+// it, so the mapping never moves while other threads copy into it or sync it.
+const size_t Reserve = size_t(1) << 40;
+
+uint32_t Checksum(uint64_t slot, std::string_view state) {
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < 8; ++i) {
+		hash = (hash ^ (uint8_t)(slot >> (i * 8))) * 16777619u;
+	}
+	for (unsigned char c : state) {
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash;
+}
+
+std::runtime_error Error(const std::string &what, const std::string &filename) {
+	return std::runtime_error(what + " " + filename + ": " + strerror(errno));
+}
+
+}
+
+SaveFile::SaveFile(const std::string &filename, Durability durability, int interval)
+	: filename(filename), durability(durability), interval(interval) {
+	Map();
+	Scan();
+
+	if (records > 2 * slots.size() && end > (1 << 20)) {
+		Compact();
+	}
+
+	if (durability != Lazy) {
+		syncer = std::thread(&SaveFile::Run, this);
+	}
+}
+
+SaveFile::~SaveFile() {
+	if (syncer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		syncer.join();
+	}
+
+	// Leaves no zeros for the next open to scan past.
+	munmap(data, Reserve);
+	if (ftruncate(fd, end) < 0) {
+		// Harmless: Scan() cuts them off as well.
+	}
+	close(fd);
+}
+
+void SaveFile::Map() {
+	fd = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		throw Error("Cannot open", filename);
+	}
+
+	struct stat info;
+	fstat(fd, &info);
+	capacity = info.st_size;
+	if (capacity == 0) {
+		if (pwrite(fd, Magic, sizeof(Magic), 0) != sizeof(Magic)) {
+			int error = errno;
+			close(fd);
+			errno = error;
+			throw Error("Cannot write", filename);
+		}
+		capacity = sizeof(Magic);
+	}
+
+	void *mapping = mmap(nullptr, Reserve, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+	if (mapping == MAP_FAILED) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		throw Error("Cannot map", filename);
+	}
+	data = static_cast<char *>(mapping);
+
+	if (capacity < sizeof(Magic) || memcmp(data, Magic, sizeof(Magic)) != 0) {
+		munmap(data, Reserve);
+		close(fd);
+		throw std::runtime_error(filename + " is not a save file");
+	}
+}
+
+void SaveFile::Scan() {
+	end = sizeof(Magic);
+	records = 0;
+	slots.clear();
+
+	while (end + HeaderSize <= capacity) {
+		uint32_t size, checksum;
+		uint64_t slot;
+		memcpy(&size, data + end, 4);
+		memcpy(&checksum, data + end + 4, 4);
+		memcpy(&slot, data + end + 8, 8);
+
+		if (end + HeaderSize + size > capacity || checksum != Checksum(slot, std::string_view(data + end + HeaderSize, size))) {
+			break;
+		}
+
+		if (size) {
+			slots[slot] = end;
+		} else {
+			slots.erase(slot);
+		}
+		++records;
+		end += HeaderSize + size;
+	}
+
+	// Whatever follows is zeros or a record torn by a crash. Cut off, so
+	// the file grows back with zeros after the next record.
+	if (end < capacity) {
+		if (ftruncate(fd, end) < 0) {
+			throw Error("Cannot truncate", filename);
+		}
+		capacity = end;
+	}
+	syncedEnd = end;
+}
+
+void SaveFile::Compact() {
+	FileWriter out(filename);
+	out.Write(Magic, sizeof(Magic));
+	for (auto &[slot, offset] : slots) {
+		uint32_t size;
+		memcpy(&size, data + offset, 4);
+		out.Write(data + offset, HeaderSize + size);
+	}
+	out.Commit();
+
+	munmap(data, Reserve);
+	close(fd);
+	Map();
+	Scan();
+}
+
+void SaveFile::Grow(size_t needed) {
+	size_t grown = std::max(needed, std::max(capacity * 2, size_t(1) << 20));
+	if (grown > Reserve || ftruncate(fd, grown) < 0) {
+		throw Error("Cannot grow", filename);
+	}
+	capacity = grown;
+}
+
+void SaveFile::Checkpoint(uint64_t slot, std::string_view state) {
+	uint32_t size = state.size();
+	uint32_t checksum = Checksum(slot, state);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (syncError) {
+		errno = syncError;
+		throw Error("Cannot sync", filename);
+	}
+	if (end + HeaderSize + size > capacity) {
+		Grow(end + HeaderSize + size);
+	}
+
+	char *record = data + end;
+	memcpy(record, &size, 4);
+	memcpy(record + 4, &checksum, 4);
+	memcpy(record + 8, &slot, 8);
+	memcpy(record + HeaderSize, state.data(), size);
+
+	if (size) {
+		slots[slot] = end;
+	} else {
+		slots.erase(slot);
+	}
+	++records;
+	end += HeaderSize + size;
+
+	if (durability == Always) {
+		size_t mine = end;
+		wake.notify_one();
+		synced.wait(lock, [&]() { return syncedEnd >= mine || stopping; });
+		if (syncError) {
+			errno = syncError;
+			throw Error("Cannot sync", filename);
+		}
+	}
+}
+
+bool SaveFile::Restore(uint64_t slot, std::string &state) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = slots.find(slot);
+	if (it == slots.end()) {
+		return false;
+	}
+
+	uint32_t size;
+	memcpy(&size, data + it->second, 4);
+	state.assign(data + it->second + HeaderSize, size);
+	return true;
+}
+
+size_t SaveFile::Slots() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return slots.size();
+}
+
+size_t SaveFile::Size() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return end;
+}
+
+void SaveFile::Run() {
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		if (durability == Interval) {
+			wake.wait_for(lock, std::chrono::milliseconds(interval), [this]() { return stopping; });
+		} else {
+			wake.wait(lock, [this]() { return stopping || end > syncedEnd; });
+		}
+
+		size_t from = syncedEnd & ~(pageSize - 1);
+		size_t to = end;
+		if (to > syncedEnd) {
+			// Copies into later pages go on meanwhile; they make the next batch.
+			lock.unlock();
+			int error = msync(data + from, to - from, MS_SYNC) < 0 ? errno : 0;
+			lock.lock();
+			if (error) syncError = error;
+			syncedEnd = to;
+			synced.notify_all();
+		}
+
+		if (stopping) {
+			return;
+		}
+	}
+}
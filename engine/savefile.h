@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+// Save states for any number of slots, kept in one append-only file that is
+// mapped into memory. Records are [u32 size][u32 checksum][u64 slot][state]
+// and the newest record of a slot is its save; an empty state erases it.
+//
+// Checkpoint() is a copy into the mapping and never waits on the disk
+// unless asked to. A background thread syncs what was appended since it
+// last looked (group commit), as durability says:
+//   Lazy      never; the kernel writes pages back in its own time
+//   Interval  every interval milliseconds
+//   Always    Checkpoint() returns once its record is synced, and all the
+//             checkpoints waiting at once share one sync
+// Opening cuts off a record torn by a crash, and rewrites the file without
+// the records that were overwritten once those make up most of it.
+// Errors throw std::runtime_error.
+class SaveFile {
+public:
+	enum Durability { Lazy, Interval, Always };
+
+	explicit SaveFile(const std::string &filename, Durability durability = Interval, int interval = 100);
+	~SaveFile();
+
+	SaveFile(const SaveFile &) = delete;
+	SaveFile &operator=(const SaveFile &) = delete;
+
+	void Checkpoint(uint64_t slot, std::string_view state);
+	// False if the slot holds no save.
+	bool Restore(uint64_t slot, std::string &state);
+
+	size_t Slots();
+	size_t Size();
+
+private:
+	void Map();
+	void Scan();
+	void Compact();
+	void Grow(size_t needed);
+	void Run();
+
+	std::string filename;
+	Durability durability;
+	int interval;
+	int fd = -1;
+	char *data = nullptr;
+	size_t capacity = 0;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable synced;
+	size_t end = 0;
+	size_t syncedEnd = 0;
+	size_t records = 0;
+	bool stopping = false;
+	int syncError = 0;
+	std::unordered_map<uint64_t, size_t> slots;
+	std::thread syncer;
+};
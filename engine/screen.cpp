@@ -0,0 +1,167 @@
+#include "screen.h"
+#include "output.h"
+#include "wrap.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+const Screen::Cell Screen::Blank = {{' '}, 1, Normal};
+
+bool Screen::Cell::operator==(const Cell &other) const {
+	return size == other.size && style == other.style && memcmp(text, other.text, size) == 0;
+}
+
+Screen::Screen(size_t rows, size_t columns) {
+	Resize(rows, columns);
+}
+
+void Screen::Resize(size_t rows, size_t columns) {
+	this->rows = rows;
+	this->columns = columns;
+	shown.assign(rows * columns, Blank);
+	whole = true;
+	cursorRow = SIZE_MAX;
+	cursorColumn = 0;
+	style = Normal;
+	Clear();
+}
+
+void Screen::Clear() {
+	next.assign(rows * columns, Blank);
+}
+
+size_t Screen::Put(size_t row, size_t column, std::string_view text, Style style) {
+	if (row >= rows) {
+		return column;
+	}
+
+	Cell *line = next.data() + row * columns;
+	for (size_t at = 0; at < text.size() && column < columns;) {
+		uint32_t width;
+		size_t end = NextCluster(text, at, width);
+		if (width == 0) {
+			at = end;
+			continue;
+		}
+		if (column + width > columns) {
+			break;
+		}
+
+		// Half a wide character is blanked, not left over.
+		if (line[column].size == 0) {
+			line[column - 1] = Blank;
+		}
+		if (column + width < columns && line[column + width].size == 0) {
+			line[column + width] = Blank;
+		}
+
+		// Marks past what a cell holds are dropped, at a character's end.
+		Cell &cell = line[column];
+		size_t size = std::min(end - at, sizeof(cell.text));
+		while (size < end - at && (text[at + size] & 0xC0) == 0x80) {
+			--size;
+		}
+		memcpy(cell.text, text.data() + at, size);
+		cell.size = size;
+		cell.style = style;
+		if (width == 2) {
+			line[column + 1] = {{}, 0, style};
+		}
+		column += width;
+		at = end;
+	}
+	return column;
+}
+
+void Screen::Render(std::string &out) {
+	if (whole) {
+		out += "\x1b[m\x1b[H\x1b[2J";
+		std::fill(shown.begin(), shown.end(), Blank);
+		cursorRow = cursorColumn = 0;
+		style = Normal;
+		whole = false;
+	}
+
+	for (size_t row = 0; row < rows; ++row) {
+		const Cell *want = next.data() + row * columns;
+		Cell *have = shown.data() + row * columns;
+		// From last on the row is blank.
+		size_t last = columns;
+		while (last > 0 && want[last - 1] == Blank) {
+			--last;
+		}
+
+		for (size_t column = 0; column < columns; ++column) {
+			if (want[column] == have[column]) {
+				continue;
+			}
+			if (column >= last) {
+				MoveTo(row, column, out);
+				SetStyle(Normal, out);
+				out += "\x1b[K";
+				std::fill(have + column, have + columns, Blank);
+				break;
+			}
+
+			// A wide character is written from its first column.
+			if (want[column].size == 0) {
+				--column;
+			}
+			MoveTo(row, column, out);
+			SetStyle(want[column].style, out);
+			out.append(want[column].text, want[column].size);
+			size_t width = column + 1 < columns && want[column + 1].size == 0 ? 2 : 1;
+			std::copy(want + column, want + column + width, have + column);
+			column += width - 1;
+			cursorColumn += width;
+			// Past the last column terminals differ on where the cursor is.
+			if (cursorColumn >= columns) {
+				cursorRow = SIZE_MAX;
+			}
+		}
+	}
+}
+
+void Screen::MoveTo(size_t row, size_t column, std::string &out) {
+	if (row == cursorRow && column == cursorColumn) {
+		return;
+	}
+
+	if (row == cursorRow && column > cursorColumn) {
+		// A few plain cells already there cost less written again than a move.
+		const Cell *between = shown.data() + row * columns;
+		bool plain = column - cursorColumn < 4;
+		for (size_t i = cursorColumn; plain && i < column; ++i) {
+			plain = between[i].size == 1 && between[i].style == style;
+		}
+		if (plain) {
+			for (size_t i = cursorColumn; i < column; ++i) {
+				out += between[i].text[0];
+			}
+		} else {
+			out += "\x1b[";
+			AppendNumber(out, column - cursorColumn);
+			out += 'C';
+		}
+	} else if (column == 0 && cursorRow != SIZE_MAX && row == cursorRow + 1) {
+		out += "\r\n";
+	} else {
+		out += "\x1b[";
+		AppendNumber(out, row + 1);
+		if (column > 0) {
+			out += ';';
+			AppendNumber(out, column + 1);
+		}
+		out += 'H';
+	}
+	cursorRow = row;
+	cursorColumn = column;
+}
+
+void Screen::SetStyle(uint8_t style, std::string &out) {
+	if (style != this->style) {
+		out += style == Reverse ? "\x1b[7m" : "\x1b[m";
+		this->style = style;
+	}
+}
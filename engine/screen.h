@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What a terminal shows, kept off screen: each frame is drawn into it whole,
+// then Render() appends only the escape sequences and text that take the
+// terminal from the frame before to this one. Moving the cursor is skipped
+// where rewriting the few cells in between is shorter, and rows that end
+// blank are cleared to the end in one sequence.
+class Screen {
+public:
+	enum Style : uint8_t { Normal, Reverse };
+
+	Screen(size_t rows, size_t columns);
+
+	size_t Rows() const { return rows; }
+	size_t Columns() const { return columns; }
+
+	// The terminal is now that size and holds who knows what, so the next
+	// frame is sent whole. Clear() follows.
+	void Resize(size_t rows, size_t columns);
+	// Blanks the frame being drawn.
+	void Clear();
+	// Draws text from row, column on, up to the right edge, where it is cut.
+	// Newlines and other controls are not drawn. Returns the column after it.
+	size_t Put(size_t row, size_t column, std::string_view text, Style style = Normal);
+
+	// Appends what brings the terminal to the frame drawn since the last call.
+	void Render(std::string &out);
+
+private:
+	struct Cell {
+		// One character and the marks on it; none on the column a wide
+		// character covers after its own.
+		char text[14];
+		uint8_t size;
+		uint8_t style;
+
+		bool operator==(const Cell &other) const;
+	};
+	static const Cell Blank;
+
+	void MoveTo(size_t row, size_t column, std::string &out);
+	void SetStyle(uint8_t style, std::string &out);
+
+	size_t rows, columns;
+	std::vector<Cell> shown;
+	std::vector<Cell> next;
+	bool whole;
+	// Where the terminal's cursor is; row is SIZE_MAX once that is not known.
+	size_t cursorRow, cursorColumn;
+	uint8_t style;
+};
@@ -0,0 +1,583 @@
+#include "script.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+enum Op : uint8_t {
+	Move, Load, Neg, Not, Bool,
+	Add, Sub, Mul, Div, Mod, Eq, Ne, Lt, Le, Gt, Ge,
+	AddK, SubK, MulK, DivK, ModK, EqK, NeK, LtK, LeK, GtK, GeK,
+	Jump, JumpIfFalse, JumpIfTrue, Return, ReturnK, Stop,
+};
+
+// Each register-register operator from Add to Ge has a form with a
+// constant b, AddK to GeK, in the same order.
+bool DIsRegister(uint8_t op) { return op < Jump; }
+bool AIsRegister(uint8_t op) { return op != Load && op != Jump && op != ReturnK && op != Stop; }
+bool BIsRegister(uint8_t op) { return op >= Add && op <= Ge; }
+
+// Scratch registers are numbered from here while compiling, and moved past
+// the variables by Link() once all of those are known.
+const uint16_t Scratch = 0x8000;
+
+int64_t Wrap(uint64_t value) {
+	return int64_t(value);
+}
+
+int64_t Divide(int64_t x, int64_t y) {
+	return y == 0 ? 0 : y == -1 ? Wrap(-uint64_t(x)) : x / y;
+}
+
+int64_t Remainder(int64_t x, int64_t y) {
+	return y == 0 || y == -1 ? 0 : x % y;
+}
+
+// What the register-register operators compute, for folding constants.
+int64_t Apply(Op op, int64_t x, int64_t y) {
+	switch (op) {
+	case Add: return Wrap(uint64_t(x) + uint64_t(y));
+	case Sub: return Wrap(uint64_t(x) - uint64_t(y));
+	case Mul: return Wrap(uint64_t(x) * uint64_t(y));
+	case Div: return Divide(x, y);
+	case Mod: return Remainder(x, y);
+	case Eq: return x == y;
+	case Ne: return x != y;
+	case Lt: return x < y;
+	case Le: return x <= y;
+	case Gt: return x > y;
+	case Ge: return x >= y;
+	default: return 0;
+	}
+}
+
+}
+
+// Recursive descent straight to code. Every expression yields a constant or
+// a register; scratch registers are numbered up from the ones in use.
+// Operators on constants are worked out here rather than emitted, and so
+// are variables given in known, which effects then update.
+class ScriptCompiler {
+public:
+	ScriptCompiler(Script &script, std::string_view source, Script::Values *known = nullptr)
+		: script(script), source(source), known(known) {
+		Next();
+	}
+
+	// The value of the code a condition compiled to, if it is a constant.
+	static bool Constant(const Script &script, uint32_t entry, int64_t &value) {
+		const Script::Instruction &first = script.code[entry];
+		if (first.op != ReturnK) {
+			return false;
+		}
+		value = script.constants[first.b];
+		return true;
+	}
+
+	void Condition() {
+		Value value = Expression();
+		Expect(End);
+		if (value.constant) {
+			Emit(ReturnK, 0, 0, Constant(value.k));
+		} else {
+			Emit(Return, 0, value.reg, 0);
+		}
+	}
+
+	void Effect(std::vector<uint16_t> &written) {
+		while (token != End) {
+			if (token != Name) Fail("expected a variable");
+			std::string_view target = name;
+			uint16_t slot = Variable(name);
+			Next();
+
+			Token assign = token;
+			if (assign != Assign && assign != AddAssign && assign != SubAssign) Fail("expected =, += or -=");
+			Next();
+
+			Value value = Expression();
+			Release(value);
+			if (assign == Assign) {
+				Store(slot, value);
+			} else {
+				Operator(assign == AddAssign ? Add : Sub, slot, {false, 0, slot}, value);
+			}
+			if (std::find(written.begin(), written.end(), slot) == written.end()) {
+				written.push_back(slot);
+			}
+			if (known) {
+				Learn(target, assign, value);
+			}
+
+			if (token != Semicolon) break;
+			Next();
+		}
+		Expect(End);
+		Emit(Stop, 0, 0, 0);
+	}
+
+private:
+	enum Token {
+		End, Number, Name, LeftParen, RightParen, Semicolon,
+		Assign, AddAssign, SubAssign,
+		Plus, Minus, Star, Slash, Percent, Bang,
+		Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, AndAnd, OrOr,
+	};
+
+	struct Value {
+		bool constant;
+		int64_t k;
+		uint16_t reg;
+	};
+
+	[[noreturn]] void Fail(const char *what) {
+		throw std::runtime_error(std::string(what) + " at " + std::to_string(start + 1) + " in \"" + std::string(source) + "\"");
+	}
+
+	void Next() {
+		while (position < source.size() && isspace((unsigned char)source[position])) ++position;
+		start = position;
+		if (position == source.size()) {
+			token = End;
+			return;
+		}
+
+		char c = source[position];
+		if (isdigit((unsigned char)c)) {
+			int64_t value = 0;
+			while (position < source.size() && isdigit((unsigned char)source[position])) {
+				int digit = source[position++] - '0';
+				if (value > (INT64_MAX - digit) / 10) Fail("number too large");
+				value = value * 10 + digit;
+			}
+			number = value;
+			token = Number;
+			return;
+		}
+		if (isalpha((unsigned char)c) || c == '_') {
+			while (position < source.size() && (isalnum((unsigned char)source[position]) || source[position] == '_')) ++position;
+			name = source.substr(start, position - start);
+			token = Name;
+			if (name == "true" || name == "false") {
+				number = name == "true";
+				token = Number;
+			}
+			return;
+		}
+
+		// One character, or two when the second one makes another operator.
+		Token one = End, two = End;
+		char second = 0;
+		switch (c) {
+		case '(': one = LeftParen; break;
+		case ')': one = RightParen; break;
+		case ';': one = Semicolon; break;
+		case '*': one = Star; break;
+		case '/': one = Slash; break;
+		case '%': one = Percent; break;
+		case '+': one = Plus; second = '='; two = AddAssign; break;
+		case '-': one = Minus; second = '='; two = SubAssign; break;
+		case '=': one = Assign; second = '='; two = Equal; break;
+		case '!': one = Bang; second = '='; two = NotEqual; break;
+		case '<': one = Less; second = '='; two = LessEqual; break;
+		case '>': one = Greater; second = '='; two = GreaterEqual; break;
+		case '&': second = '&'; two = AndAnd; break;
+		case '|': second = '|'; two = OrOr; break;
+		}
+
+		if (second && position + 1 < source.size() && source[position + 1] == second) {
+			token = two;
+			position += 2;
+		} else if (one != End) {
+			token = one;
+			++position;
+		} else {
+			Fail("unexpected character");
+		}
+	}
+
+	void Expect(Token expected) {
+		if (token != expected) {
+			Fail(expected == End ? "unexpected text" : "expected )");
+		}
+	}
+
+	uint16_t Variable(std::string_view variable) {
+		if (script.Slot(variable) == Script::None && script.variables.size() >= Scratch) Fail("too many variables");
+		return script.Declare(variable);
+	}
+
+	uint16_t Constant(int64_t value) {
+		auto it = script.constantSlots.find(value);
+		if (it != script.constantSlots.end()) {
+			return it->second;
+		}
+		if (script.constants.size() > UINT16_MAX) Fail("too many constants");
+
+		uint16_t slot = script.constants.size();
+		script.constants.push_back(value);
+		script.constantSlots.emplace(value, slot);
+		return slot;
+	}
+
+	void Emit(Op op, uint16_t d, uint16_t a, uint16_t b) {
+		script.code.push_back({op, d, a, b});
+	}
+
+	uint16_t Take() {
+		uint16_t reg = Scratch + temps++;
+		if (temps >= Scratch) Fail("expression too deep");
+		script.temps = std::max<size_t>(script.temps, temps);
+		return reg;
+	}
+
+	// Only counts: whatever an expression took is given back once its
+	// operands are used, before its result is taken.
+	void Release(const Value &value) {
+		if (!value.constant && value.reg >= Scratch) {
+			--temps;
+		}
+	}
+
+	Value InRegister(Value value) {
+		if (!value.constant) {
+			return value;
+		}
+		uint16_t reg = Take();
+		Emit(Load, reg, 0, Constant(value.k));
+		return {false, 0, reg};
+	}
+
+	// d = a op b, with the constant form when b is one.
+	void Operator(Op op, uint16_t d, Value a, Value b) {
+		if (b.constant) {
+			Emit(Op(op + (AddK - Add)), d, a.reg, Constant(b.k));
+		} else {
+			Emit(op, d, a.reg, b.reg);
+		}
+	}
+
+	void Store(uint16_t slot, const Value &value) {
+		// The instruction that made the value can write the variable itself,
+		// unless a jump lands after it and the value has more than one source.
+		Script::Instruction *last = script.code.empty() ? nullptr : &script.code.back();
+		if (value.constant) {
+			Emit(Load, slot, 0, Constant(value.k));
+		} else if (value.reg >= Scratch && last && last->d == value.reg && DIsRegister(last->op) && label != script.code.size()) {
+			last->d = slot;
+		} else {
+			Emit(Move, slot, value.reg, 0);
+		}
+	}
+
+	// The variable is known afterwards only if the value assigned is.
+	void Learn(std::string_view target, Token assign, const Value &value) {
+		auto it = known->find(target);
+		if (value.constant && assign == Assign) {
+			known->insert_or_assign(std::string(target), value.k);
+		} else if (value.constant && it != known->end()) {
+			it->second = Apply(assign == AddAssign ? Add : Sub, it->second, value.k);
+		} else if (it != known->end()) {
+			known->erase(it);
+		}
+	}
+
+	Value Expression() {
+		return Or();
+	}
+
+	// a || b and a && b are 0 or 1, and b is only run when a does not decide.
+	// A constant operand that decides makes the whole a constant and drops
+	// the code of the others; one that does not is left out.
+	Value Logical(Token which, Value (ScriptCompiler::*operand)()) {
+		size_t begin = script.code.size(), beginTemps = temps;
+		Value left = (this->*operand)();
+		if (token != which) {
+			return left;
+		}
+
+		int64_t decides = which == OrOr;
+		bool decided = left.constant && (left.k != 0) == decides;
+		bool emitted = false;
+		uint16_t result = 0;
+		std::vector<size_t> jumps;
+		auto add = [&](Value value) {
+			Release(value);
+			if (!emitted) {
+				result = Take();
+			}
+			Emit(Bool, result, value.reg, 0);
+			emitted = true;
+		};
+		if (!left.constant) {
+			add(left);
+		}
+
+		while (token == which) {
+			Next();
+			size_t jump = script.code.size();
+			if (emitted && !decided) {
+				Emit(which == AndAnd ? JumpIfFalse : JumpIfTrue, 0, result, 0);
+			}
+
+			size_t operandTemps = temps;
+			Value right = (this->*operand)();
+			if (decided) {
+				script.code.resize(jump);
+				temps = operandTemps;
+			} else if (right.constant) {
+				// Constants leave no code, so a jump emitted is the last instruction.
+				script.code.resize(jump);
+				decided = (right.k != 0) == decides;
+			} else {
+				if (emitted) jumps.push_back(jump);
+				add(right);
+			}
+		}
+
+		if (decided || !emitted) {
+			script.code.resize(begin);
+			temps = beginTemps;
+			return {true, decided ? decides : !decides, 0};
+		}
+
+		label = script.code.size();
+		for (size_t jump : jumps) {
+			ptrdiff_t distance = label - jump;
+			if (distance > INT16_MAX) Fail("expression too long");
+			script.code[jump].b = uint16_t(distance);
+		}
+		return {false, 0, result};
+	}
+
+	Value Or() {
+		return Logical(OrOr, &ScriptCompiler::And);
+	}
+
+	Value And() {
+		return Logical(AndAnd, &ScriptCompiler::Comparison);
+	}
+
+	Value Comparison() {
+		Value left = Sum();
+		while (token >= Less && token <= NotEqual) {
+			static const Op ops[] = {Lt, Le, Gt, Ge, Eq, Ne};
+			Op op = ops[token - Less];
+			Next();
+			left = Combine(op, left, Sum());
+		}
+		return left;
+	}
+
+	Value Sum() {
+		Value left = Term();
+		while (token == Plus || token == Minus) {
+			Op op = token == Plus ? Add : Sub;
+			Next();
+			left = Combine(op, left, Term());
+		}
+		return left;
+	}
+
+	Value Term() {
+		Value left = Unary();
+		while (token == Star || token == Slash || token == Percent) {
+			Op op = token == Star ? Mul : token == Slash ? Div : Mod;
+			Next();
+			left = Combine(op, left, Unary());
+		}
+		return left;
+	}
+
+	Value Combine(Op op, Value left, Value right) {
+		if (left.constant && right.constant) {
+			return {true, Apply(op, left.k, right.k), 0};
+		}
+
+		// The left side must be a register: the constant forms take b only.
+		// Instructions read their operands before writing, so the result can
+		// go in a register they came from.
+		left = InRegister(left);
+		Release(right);
+		Release(left);
+		uint16_t result = Take();
+		Operator(op, result, left, right);
+		return {false, 0, result};
+	}
+
+	Value Unary() {
+		if (token == Minus || token == Bang) {
+			Op op = token == Minus ? Neg : Not;
+			Next();
+			Value operand = Unary();
+			if (operand.constant) {
+				return {true, op == Neg ? Wrap(-uint64_t(operand.k)) : !operand.k, 0};
+			}
+			operand = InRegister(operand);
+			Release(operand);
+			uint16_t result = Take();
+			Emit(op, result, operand.reg, 0);
+			return {false, 0, result};
+		}
+		return Primary();
+	}
+
+	Value Primary() {
+		if (token == Number) {
+			int64_t value = number;
+			Next();
+			return {true, value, 0};
+		}
+		if (token == Name) {
+			if (known) {
+				auto it = known->find(name);
+				if (it != known->end()) {
+					Next();
+					return {true, it->second, 0};
+				}
+			}
+			uint16_t slot = Variable(name);
+			Next();
+			return {false, 0, slot};
+		}
+		if (token == LeftParen) {
+			Next();
+			Value value = Expression();
+			Expect(RightParen);
+			Next();
+			return value;
+		}
+		Fail("expected a value");
+	}
+
+	Script &script;
+	std::string_view source;
+	size_t position = 0;
+	size_t start = 0;
+	Token token = End;
+	std::string_view name;
+	int64_t number = 0;
+	Script::Values *known;
+	size_t temps = 0;
+	// Where the last jumps landed.
+	size_t label = SIZE_MAX;
+};
+
+uint32_t Script::CompileCondition(std::string_view source) {
+	uint32_t entry = code.size();
+	ScriptCompiler(*this, source).Condition();
+	return entry;
+}
+
+uint32_t Script::CompileEffect(std::string_view source) {
+	Effect effect = {(uint32_t)code.size(), (uint32_t)writes.size(), 0};
+	std::vector<uint16_t> written;
+	ScriptCompiler(*this, source).Effect(written);
+	writes.insert(writes.end(), written.begin(), written.end());
+	effect.writeCount = written.size();
+	effects.push_back(effect);
+	return effects.size() - 1;
+}
+
+bool Script::FoldCondition(std::string_view source, const Values &known, int64_t &value) {
+	// Conditions only read what is known.
+	Script scratch;
+	ScriptCompiler(scratch, source, const_cast<Values *>(&known)).Condition();
+	return ScriptCompiler::Constant(scratch, 0, value);
+}
+
+void Script::FoldEffect(std::string_view source, Values &known) {
+	Script scratch;
+	std::vector<uint16_t> written;
+	ScriptCompiler(scratch, source, &known).Effect(written);
+}
+
+uint16_t Script::Declare(std::string_view name) {
+	auto it = variables.find(name);
+	if (it != variables.end()) {
+		return it->second;
+	}
+	if (variables.size() >= Scratch) {
+		throw std::runtime_error("too many variables");
+	}
+
+	uint16_t slot = variables.size();
+	variables.emplace(std::string(name), slot);
+	names.emplace_back(name);
+	return slot;
+}
+
+uint32_t Script::Slot(std::string_view name) const {
+	auto it = variables.find(name);
+	return it == variables.end() ? None : it->second;
+}
+
+void Script::Link() {
+	uint16_t base = variables.size();
+	if (base + temps > UINT16_MAX) {
+		throw std::runtime_error("too many variables");
+	}
+
+	auto relocate = [&](uint16_t &reg) {
+		if (reg >= Scratch) reg = reg - Scratch + base;
+	};
+	for (Instruction &instruction : code) {
+		if (DIsRegister(instruction.op)) relocate(instruction.d);
+		if (AIsRegister(instruction.op)) relocate(instruction.a);
+		if (BIsRegister(instruction.op)) relocate(instruction.b);
+	}
+}
+
+int64_t Script::Run(uint32_t entry, int64_t *r) const {
+	static void *const handlers[] = {
+		&&move, &&load, &&neg, &&not_, &&bool_,
+		&&add, &&sub, &&mul, &&div, &&mod, &&eq, &&ne, &&lt, &&le, &&gt, &&ge,
+		&&addK, &&subK, &&mulK, &&divK, &&modK, &&eqK, &&neK, &&ltK, &&leK, &&gtK, &&geK,
+		&&jump, &&jumpIfFalse, &&jumpIfTrue, &&return_, &&returnK, &&stop,
+	};
+	const Instruction *ip = code.data() + entry;
+	const int64_t *k = constants.data();
+
+#define DISPATCH() goto *handlers[ip->op]
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+#define ARITHMETIC(label, b, expression) \
+	label: { int64_t x = r[ip->a], y = b; (void)x; (void)y; r[ip->d] = (expression); NEXT(); }
+#define OPERATOR(label, labelK, expression) \
+	ARITHMETIC(label, r[ip->b], expression) \
+	ARITHMETIC(labelK, k[ip->b], expression)
+
+	DISPATCH();
+
+move: r[ip->d] = r[ip->a]; NEXT();
+load: r[ip->d] = k[ip->b]; NEXT();
+neg: r[ip->d] = Wrap(-uint64_t(r[ip->a])); NEXT();
+not_: r[ip->d] = !r[ip->a]; NEXT();
+bool_: r[ip->d] = r[ip->a] != 0; NEXT();
+
+	OPERATOR(add, addK, Wrap(uint64_t(x) + uint64_t(y)))
+	OPERATOR(sub, subK, Wrap(uint64_t(x) - uint64_t(y)))
+	OPERATOR(mul, mulK, Wrap(uint64_t(x) * uint64_t(y)))
+	OPERATOR(div, divK, Divide(x, y))
+	OPERATOR(mod, modK, Remainder(x, y))
+	OPERATOR(eq, eqK, x == y)
+	OPERATOR(ne, neK, x != y)
+	OPERATOR(lt, ltK, x < y)
+	OPERATOR(le, leK, x <= y)
+	OPERATOR(gt, gtK, x > y)
+	OPERATOR(ge, geK, x >= y)
+
+jump: ip += int16_t(ip->b); DISPATCH();
+jumpIfFalse: ip += r[ip->a] == 0 ? int16_t(ip->b) : 1; DISPATCH();
+jumpIfTrue: ip += r[ip->a] != 0 ? int16_t(ip->b) : 1; DISPATCH();
+return_: return r[ip->a];
+returnK: return k[ip->b];
+stop: return 0;
+
+#undef OPERATOR
+#undef ARITHMETIC
+#undef NEXT
+#undef DISPATCH
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Story state for writers: integer variables, effects that change them on
+// arriving at a node, and conditions that decide which choices are offered.
+//   effect     x = <expr>; y += <expr>; z -= <expr>
+//   condition  <expr>, true unless 0
+//   <expr>     integers, true, false, variables, ( ), and as in C
+//              ! - (unary)  * / %  + -  < <= > >=  == !=  &&  ||
+// Variables start at 0; x / 0 and x % 0 are 0 and arithmetic wraps.
+//
+// Everything a story has is compiled into one block of register code when
+// the story is, with operators on constants worked out then. Variables are resolved to register slots up front, and
+// after them come the scratch registers expressions need, so a session's
+// registers are one array of Registers() values. Run() dispatches with
+// computed gotos, one indirect jump per instruction.
+class Script {
+public:
+	static const uint32_t None = UINT32_MAX;
+
+	struct Instruction {
+		uint8_t op;
+		uint16_t d;
+		uint16_t a;
+		// A register, a constant, or a jump's signed distance.
+		uint16_t b;
+	};
+
+	struct Effect {
+		uint32_t entry;
+		// The variables it may assign, so a session can note them to undo.
+		uint32_t firstWrite;
+		uint32_t writeCount;
+	};
+
+	// Both return what Run() and Writes() take, and throw std::runtime_error
+	// naming the first error in source. Link() once everything is compiled.
+	uint32_t CompileCondition(std::string_view source);
+	uint32_t CompileEffect(std::string_view source);
+	// The slot of a variable, which Declare() makes if need be, before Link().
+	uint16_t Declare(std::string_view name);
+	uint32_t Slot(std::string_view name) const;
+	void Link();
+
+	size_t Registers() const { return variables.size() + temps; }
+	size_t Variables() const { return variables.size(); }
+	const std::string &VariableName(size_t slot) const { return names[slot]; }
+	size_t Instructions() const { return code.size(); }
+
+	// Variables known to hold a value, for working out scripts ahead of play.
+	typedef std::map<std::string, int64_t, std::less<>> Values;
+	// True, setting value, if source comes to a constant when the variables
+	// in known have those values. Throws like CompileCondition().
+	static bool FoldCondition(std::string_view source, const Values &known, int64_t &value);
+	// Applies an effect to known: assigned variables stay known only when
+	// what they are given is.
+	static void FoldEffect(std::string_view source, Values &known);
+
+	// The condition's value, or 0 once an effect has run.
+	int64_t Run(uint32_t entry, int64_t *registers) const;
+	int64_t RunEffect(uint32_t effect, int64_t *registers) const { return Run(effects[effect].entry, registers); }
+	const uint16_t *WritesBegin(uint32_t effect) const { return writes.data() + effects[effect].firstWrite; }
+	const uint16_t *WritesEnd(uint32_t effect) const { return WritesBegin(effect) + effects[effect].writeCount; }
+
+private:
+	friend class ScriptCompiler;
+
+	std::vector<Instruction> code;
+	std::vector<int64_t> constants;
+	std::map<int64_t, uint16_t> constantSlots;
+	std::map<std::string, uint16_t, std::less<>> variables;
+	std::vector<std::string> names;
+	std::vector<Effect> effects;
+	std::vector<uint16_t> writes;
+	size_t temps = 0;
+};
@@ -0,0 +1,521 @@
+#include "server.h"
+#include "playthrough.h"
+#include "http.h"
+#include "output.h"
+#include "deadlines.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// A peer that sends faster than it reads is not read from until it catches up.
+const size_t MaxPending = 1 << 20;
+
+// Time limits are in whole milliseconds; deadlines due in the same one are
+// acted on together.
+const int64_t DeadlineResolution = 1000000;
+
+struct Connection {
+	int fd;
+	size_t slot;
+	// Names it to its sessions' deadlines, which may outlive it.
+	uint32_t serial;
+	uint32_t events = 0;
+	bool closing = false;
+	std::string in;
+	OutputQueue out;
+
+	// Line protocol sessions live and die with their connection.
+	std::vector<Playthrough> sessions;
+	std::vector<uint32_t> freeSessions;
+};
+
+bool ParseNumber(std::string_view &line, size_t &value) {
+	while (!line.empty() && line.front() == ' ') line.remove_prefix(1);
+	auto [end, error] = std::from_chars(line.data(), line.data() + line.size(), value);
+	if (error != std::errc() || end == line.data()) {
+		return false;
+	}
+	line.remove_prefix(end - line.data());
+	return true;
+}
+
+void Answer(std::string &out, size_t id, const char *text) {
+	AppendNumber(out, id);
+	out += ' ';
+	out += text;
+	out += '\n';
+}
+
+// Nodes that depend on the session (conditions, variables in text) are put
+// together for it.
+void AnswerNode(OutputQueue &out, size_t id, const CompiledStory &story, const Playthrough &play) {
+	uint32_t node = play.Current().node;
+	AppendNumber(out.Text(), id);
+	out.Text() += ' ';
+	if (story[node].dynamic) {
+		story.OfferedJson(node, play.State().registers.data(), out.Text(), play.Language());
+	} else {
+		out.Reference(story.Json(node, play.Language()));
+	}
+	out.Text() += '\n';
+}
+
+void AnswerStep(OutputQueue &out, size_t id, const CompiledStory &story, const Playthrough &play, StepResult result) {
+	switch (result) {
+	case StepResult::Moved: AnswerNode(out, id, story, play); break;
+	case StepResult::TheEnd: Answer(out.Text(), id, "ERR the end"); break;
+	case StepResult::NotAChoice: Answer(out.Text(), id, "ERR not a choice"); break;
+	case StepResult::MissingNode: Answer(out.Text(), id, "ERR missing node"); break;
+	case StepResult::NoHistory: Answer(out.Text(), id, "ERR no history"); break;
+	}
+}
+
+// Deadlines of line protocol sessions are keyed by connection and session.
+uint64_t SessionKey(const Connection &conn, uint32_t id) {
+	return uint64_t(conn.serial) << 32 | id;
+}
+
+// Slot numbers belong to the clients; the line protocol and HTTP share them.
+// False if the save file cannot take it, which fails only this request.
+bool Save(const CompiledStory &story, SaveFile &saves, uint64_t slot, const Playthrough &play) {
+	thread_local std::string record;
+	EncodeSession(story, play.State(), record);
+	try {
+		saves.Checkpoint(slot, record);
+	} catch (std::runtime_error &) {
+		return false;
+	}
+	return true;
+}
+
+void Handle(const CompiledStory &story, SaveFile *saves, Languages *languages, Deadlines &deadlines, Connection &conn,
+	std::string_view line) {
+	std::string &out = conn.out.Text();
+	if (line.empty()) {
+		out += "- ERR empty request\n";
+		return;
+	}
+
+	char command = line.front();
+	line.remove_prefix(1);
+
+	Session restored;
+	if (command == 'R') {
+		size_t slot;
+		thread_local std::string record;
+		if (!ParseNumber(line, slot)) {
+			out += "- ERR bad request\n";
+			return;
+		}
+		if (!saves) {
+			out += "- ERR saving is off\n";
+			return;
+		}
+		if (!saves->Restore(slot, record)) {
+			out += "- ERR no save\n";
+			return;
+		}
+		if (!DecodeSession(story, record, restored)) {
+			out += "- ERR save does not fit the story\n";
+			return;
+		}
+	}
+
+	if (command == 'N' || command == 'R') {
+		size_t seed;
+		if (command == 'N' && !ParseNumber(line, seed)) {
+			seed = NewSeed();
+		}
+		uint32_t id;
+		if (!conn.freeSessions.empty()) {
+			id = conn.freeSessions.back();
+			conn.freeSessions.pop_back();
+		} else {
+			id = conn.sessions.size();
+			conn.sessions.emplace_back();
+		}
+
+		conn.sessions[id] = command == 'R' ? Play(story, std::move(restored)) : Play(story, seed);
+		AnswerNode(conn.out, id, story, conn.sessions[id]);
+		AddDeadline(deadlines, story, SessionKey(conn, id), conn.sessions[id].Current());
+		return;
+	}
+
+	size_t id;
+	if (!ParseNumber(line, id)) {
+		out += "- ERR bad request\n";
+		return;
+	}
+	if (id >= conn.sessions.size() || !conn.sessions[id]) {
+		Answer(out, id, "ERR no such session");
+		return;
+	}
+
+	Playthrough &play = conn.sessions[id];
+	Turn turn;
+	switch (command) {
+	case 'G':
+		AnswerNode(conn.out, id, story, play);
+		return;
+	case 'C': {
+		size_t choice = 0;
+		const CompiledStory::Node &node = story[play.Current().node];
+		if (!ParseNumber(line, choice) && !node.automatic) {
+			Answer(out, id, "ERR bad request");
+			return;
+		}
+		turn = play.Choose(choice);
+		break;
+	}
+	case 'B': {
+		size_t steps = 1;
+		ParseNumber(line, steps);
+		turn = play.Back(steps);
+		break;
+	}
+	case 'L': {
+		while (!line.empty() && line.front() == ' ') line.remove_prefix(1);
+		const StringTable *language = nullptr;
+		if (!line.empty() && !(languages && (language = languages->Find(line)))) {
+			Answer(out, id, "ERR no such language");
+			return;
+		}
+		play.SetLanguage(language);
+		AnswerNode(conn.out, id, story, play);
+		return;
+	}
+	case 'P':
+		AppendNumber(out, id);
+		out += ' ';
+		AppendProgress(out, story, play.State());
+		out += '\n';
+		return;
+	case 'S': {
+		size_t slot;
+		if (!ParseNumber(line, slot)) {
+			Answer(out, id, "ERR bad request");
+		} else if (!saves) {
+			Answer(out, id, "ERR saving is off");
+		} else {
+			Answer(out, id, Save(story, *saves, slot, play) ? "SAVED" : "ERR cannot save");
+		}
+		return;
+	}
+	case 'Q':
+		play = Playthrough();
+		conn.freeSessions.push_back(id);
+		Answer(out, id, "BYE");
+		return;
+	default:
+		Answer(out, id, "ERR bad request");
+		return;
+	}
+
+	AnswerStep(conn.out, id, story, play, turn.result);
+	AddDeadline(deadlines, story, SessionKey(conn, id), turn);
+}
+
+// Answers the complete lines at the front of conn.in, returns the bytes they took.
+size_t HandleLines(const CompiledStory &story, SaveFile *saves, Languages *languages, Deadlines &deadlines, Connection &conn) {
+	size_t start = 0;
+	size_t end;
+	while ((end = conn.in.find('\n', start)) != std::string::npos) {
+		std::string_view line(conn.in.data() + start, end - start);
+		if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+		Handle(story, saves, languages, deadlines, conn, line);
+		start = end + 1;
+	}
+	return start;
+}
+
+class Worker {
+public:
+	Worker(const CompiledStory &story, SessionTable &sessions, SaveFile *saves, Languages *languages, Analytics *analytics, Protocol protocol,
+		int listenFd, int stopFd)
+		: story(story), sessions(sessions), saves(saves), languages(languages), analytics(analytics), protocol(protocol), listenFd(listenFd) {
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (epollFd < 0) {
+			throw std::runtime_error(std::string("Cannot create epoll: ") + strerror(errno));
+		}
+
+		// Only one worker wakes up per new connection.
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.ptr = &this->listenFd;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+		// Never read, so it wakes every worker for good once written.
+		event.events = EPOLLIN;
+		event.data.ptr = &stopping;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &event);
+
+		event.data.ptr = &deadlines;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, deadlines.Fd(), &event);
+	}
+
+	~Worker() {
+		for (auto &conn : connections) {
+			close(conn->fd);
+		}
+		close(epollFd);
+	}
+
+	void Run() {
+		if (analytics) {
+			analytics->Attach();
+		}
+		epoll_event events[256];
+		while (!stopping) {
+			int n = epoll_wait(epollFd, events, 256, -1);
+			for (int i = 0; i < n; ++i) {
+				void *ptr = events[i].data.ptr;
+				if (ptr == &listenFd) {
+					Accept();
+				} else if (ptr == &stopping) {
+					stopping = true;
+				} else if (ptr == &deadlines) {
+					deadlines.Expire([&](uint64_t key, uint64_t arrival) { Expired(key, arrival); });
+				} else {
+					Serve(*static_cast<Connection *>(ptr), events[i].events);
+				}
+			}
+		}
+	}
+
+private:
+	void Accept() {
+		int fd;
+		while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+			// Answers are small and pipelined; they should not wait for more.
+			// Fails harmlessly on Unix sockets.
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+			auto conn = std::make_unique<Connection>();
+			conn->fd = fd;
+			conn->slot = connections.size();
+			conn->serial = nextSerial++;
+			if (protocol == Protocol::Lines) {
+				serials[conn->serial] = conn.get();
+			}
+			Watch(*conn, EPOLLIN);
+			connections.push_back(std::move(conn));
+		}
+	}
+
+	void Watch(Connection &conn, uint32_t events) {
+		if (conn.events == events) {
+			return;
+		}
+
+		epoll_event event = {};
+		event.events = events;
+		event.data.ptr = &conn;
+		epoll_ctl(epollFd, conn.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn.fd, &event);
+		conn.events = events;
+	}
+
+	void Serve(Connection &conn, uint32_t events) {
+		if (events & EPOLLERR) {
+			Drop(conn);
+			return;
+		}
+
+		// A hangup may still leave requests to read; read() then reports it.
+		if ((events & (EPOLLIN | EPOLLHUP)) && !conn.closing) {
+			char buffer[1 << 16];
+			ssize_t n;
+			while ((n = read(conn.fd, buffer, sizeof(buffer))) > 0) {
+				conn.in.append(buffer, n);
+				if (conn.in.size() > MaxPending) break;
+			}
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+				Drop(conn);
+				return;
+			}
+
+			size_t used = protocol == Protocol::Http
+				? HandleHttp(story, sessions, deadlines, saves, languages, conn.in.data(), conn.in.size(), conn.out, conn.closing)
+				: HandleLines(story, saves, languages, deadlines, conn);
+			conn.in.erase(0, used);
+
+			if (conn.in.size() > MaxPending) {
+				// No request is that long.
+				Drop(conn);
+				return;
+			}
+		}
+
+		if (!conn.out.Flush(conn.fd)) {
+			Drop(conn);
+			return;
+		}
+
+		size_t pending = conn.out.Pending();
+		if (conn.closing && pending == 0) {
+			Drop(conn);
+			return;
+		}
+
+		uint32_t wanted = pending > MaxPending || conn.closing ? 0u : EPOLLIN;
+		if (pending) wanted |= EPOLLOUT;
+		Watch(conn, wanted);
+	}
+
+	void Drop(Connection &conn) {
+		close(conn.fd);
+		serials.erase(conn.serial);
+
+		size_t slot = conn.slot;
+		std::swap(connections[slot], connections.back());
+		connections[slot]->slot = slot;
+		connections.pop_back();
+	}
+
+	// A timed question's time is up: its default is taken if the session is
+	// still there. Line protocol connections are told unasked; HTTP clients
+	// see it on their next request.
+	void Expired(uint64_t key, uint64_t arrival) {
+		if (protocol == Protocol::Http) {
+			sessions.With(key, [&](Playthrough &play) {
+				if (play.Current().arrival == arrival) {
+					AddDeadline(deadlines, story, key, play.Choose(story[play.Current().node].defaultChoice));
+				}
+			});
+			return;
+		}
+
+		auto found = serials.find(uint32_t(key >> 32));
+		uint32_t id = uint32_t(key);
+		if (found == serials.end()) {
+			return;
+		}
+		Connection &conn = *found->second;
+		if (id >= conn.sessions.size() || !conn.sessions[id] || conn.sessions[id].Current().arrival != arrival) {
+			return;
+		}
+
+		Playthrough &play = conn.sessions[id];
+		Answer(conn.out.Text(), id, "TIMEOUT");
+		const Turn &turn = play.Choose(story[play.Current().node].defaultChoice);
+		AnswerStep(conn.out, id, story, play, turn.result);
+		AddDeadline(deadlines, story, key, turn);
+		Serve(conn, 0);
+	}
+
+	const CompiledStory &story;
+	SessionTable &sessions;
+	SaveFile *saves;
+	Languages *languages;
+	Analytics *analytics;
+	Protocol protocol;
+	int listenFd;
+	int epollFd;
+	bool stopping = false;
+	std::vector<std::unique_ptr<Connection>> connections;
+	Deadlines deadlines{DeadlineResolution};
+	uint32_t nextSerial = 0;
+	std::unordered_map<uint32_t, Connection *> serials;
+};
+
+}
+
+int ListenUnix(const std::string &path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		throw std::runtime_error("Socket path too long: " + path);
+	}
+	memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("Cannot create socket: ") + strerror(errno));
+	}
+
+	// A socket left behind by a server that did not shut down cleanly.
+	unlink(path.c_str());
+	if (bind(fd, (sockaddr *)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+		int error = errno;
+		close(fd);
+		throw std::runtime_error("Cannot listen on " + path + ": " + strerror(error));
+	}
+	return fd;
+}
+
+int ListenLocal(int port) {
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("Cannot create socket: ") + strerror(errno));
+	}
+
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (sockaddr *)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+		int error = errno;
+		close(fd);
+		throw std::runtime_error("Cannot listen on port " + std::to_string(port) + ": " + strerror(error));
+	}
+	return fd;
+}
+
+void RunServer(const CompiledStory &story, int listenFd, Protocol protocol, int threads, SaveFile *saves, Languages *languages,
+	Analytics *analytics) {
+	if (story.Start() == CompiledStory::Missing) {
+		throw std::runtime_error("The story has no node 0");
+	}
+
+	// Workers inherit the mask, so the signals only ever reach sigwait below.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	// A peer gone mid-answer is seen as a write error instead.
+	signal(SIGPIPE, SIG_IGN);
+
+	SessionTable sessions;
+	int stopFd = eventfd(0, EFD_CLOEXEC);
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> running;
+	for (int i = 0; i < threads; ++i) {
+		workers.push_back(std::make_unique<Worker>(story, sessions, saves, languages, analytics, protocol, listenFd, stopFd));
+	}
+	for (auto &worker : workers) {
+		running.emplace_back(&Worker::Run, worker.get());
+	}
+
+	int caught;
+	sigwait(&signals, &caught);
+
+	uint64_t one = 1;
+	ssize_t written = write(stopFd, &one, sizeof(one));
+	(void)written;
+	for (auto &thread : running) {
+		thread.join();
+	}
+
+	workers.clear();
+	close(stopFd);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+#include "analytics.h"
+#include "compiled.h"
+#include "languages.h"
+#include "savefile.h"
+
+enum class Protocol { Lines, Http };
+
+// Listening sockets for RunServer(): a Unix stream socket at path, replacing
+// one left behind, or TCP on the loopback interface only.
+int ListenUnix(const std::string &path);
+int ListenLocal(int port);
+
+// Serves sessions on listenFd until SIGINT or SIGTERM, with one epoll loop
+// per worker thread; the story is shared read-only and needs no locks.
+// Http is described in http.h. Workers count into analytics, if given, a
+// shard each.
+//
+// Lines: sessions belong to the connection that started them, so workers
+// share nothing writable at all. One request per line, each answered in
+// order by one line:
+//   N [seed]          start a session, drawing at random nodes from seed
+//                     (from a new one each time if not given)
+//   G <session>       current node
+//   C <session> <id>  choose the choice leading to id (any id, or none, on
+//                     nodes that go on by themselves)
+//   B <session> [n]   go back a step, or n
+//   L <session> [code] show the session in that language from now on, or
+//                     in the story's own without one (see Languages)
+//   Q <session>       end the session
+//   P <session>       progress, see AppendProgress()
+//   S <session> <slot> save the session in the slot
+//   R <slot>          start a session from the save in the slot
+// Answers are "<session> <node JSON>" (see CompiledStory::Json()),
+// "<session> <progress JSON>", "<session> BYE", "<session> SAVED", or "<session> ERR <reason>";
+// "- ERR <reason>" when there is no session to name.
+// Without saves, S and R fail; without languages, L does for any code.
+//
+// A timed question's node has "TimeLimit" (seconds) and "DefaultChoice".
+// Once the time is up without an answer, counted from the answer that
+// showed it, the default is taken as if chosen and the connection is sent,
+// unasked, "<session> TIMEOUT" and then the answer to that choice. A C
+// crossing it on the way is taken on the node the default led to. Each
+// worker keeps the deadlines of its sessions (see Deadlines).
+void RunServer(const CompiledStory &story, int listenFd, Protocol protocol, int threads, SaveFile *saves = nullptr, Languages *languages = nullptr,
+	Analytics *analytics = nullptr);
@@ -0,0 +1,303 @@
+#include "session.h"
+
+#include "output.h"
+#include "analytics.h"
+
+#include <string.h>
+
+#include <array>
+#include <random>
+
+namespace {
+
+const uint8_t StateVersion = 3;
+
+void PutVarint(std::string &out, uint64_t value) {
+	while (value >= 0x80) {
+		out += char(value | 0x80);
+		value >>= 7;
+	}
+	out += char(value);
+}
+
+// The bytes of bits up to the last one set.
+void PutBits(std::string &out, const Bitset &bits) {
+	size_t words = bits.Words();
+	while (words > 0 && bits.Data()[words - 1] == 0) --words;
+	size_t bytes = words * 8;
+	const char *data = reinterpret_cast<const char *>(bits.Data());
+	while (bytes > 0 && data[bytes - 1] == 0) --bytes;
+	PutVarint(out, bytes);
+	out.append(data, bytes);
+}
+
+bool GetVarint(std::string_view &in, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (in.empty()) {
+			return false;
+		}
+		uint8_t byte = in.front();
+		in.remove_prefix(1);
+		value |= uint64_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool GetBits(std::string_view &in, Bitset &bits, size_t size) {
+	uint64_t bytes;
+	bits.Resize(size);
+	if (!GetVarint(in, bytes) || bytes > in.size() || bytes > bits.Words() * 8) {
+		return false;
+	}
+	memcpy(bits.Data(), in.data(), bytes);
+	in.remove_prefix(bytes);
+	return true;
+}
+
+// Runs the node's effect, logging what it may overwrite first.
+void Enter(const CompiledStory &story, Session &session, uint32_t node) {
+	uint32_t effect = story[node].effect;
+	if (effect == Script::None) {
+		return;
+	}
+
+	const Script &script = story.Scripts();
+	for (const uint16_t *slot = script.WritesBegin(effect); slot != script.WritesEnd(effect); ++slot) {
+		session.changes.push_back({*slot, session.lastChange, session.registers[*slot]});
+		session.lastChange = session.changes.size() - 1;
+	}
+	script.RunEffect(effect, session.registers.data());
+}
+
+// SplitMix64: the draw counter's place in the seed's sequence.
+uint64_t Random(const CompiledStory &story, const Session &session) {
+	uint64_t z = session.seed + uint64_t(session.registers[story.Registers()] + 1) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+void CountDraw(const CompiledStory &story, Session &session) {
+	uint32_t slot = story.Registers();
+	session.changes.push_back({slot, session.lastChange, session.registers[slot]});
+	session.lastChange = session.changes.size() - 1;
+	++session.registers[slot];
+}
+
+// How each kind of node picks the choice taken from it: sets taken to its
+// number, or to End for the way on from a dialogue node. choice is what the
+// player chose, if anything.
+typedef StepResult (*Pick)(const CompiledStory &story, Session &session, size_t choice, uint32_t &taken);
+
+StepResult PickAnswer(const CompiledStory &story, Session &session, size_t choice, uint32_t &taken) {
+	uint32_t target;
+	if (!story.Choose(session.node, choice, target, &taken) || !story.Offered(story.ChoiceAt(taken), session.registers.data())) {
+		return StepResult::NotAChoice;
+	}
+	return StepResult::Moved;
+}
+
+StepResult PickNext(const CompiledStory &, Session &, size_t, uint32_t &taken) {
+	taken = CompiledStory::End;
+	return StepResult::Moved;
+}
+
+// Drawn again the same if this step is taken back.
+StepResult PickDrawn(const CompiledStory &story, Session &session, size_t, uint32_t &taken) {
+	const CompiledStory::Node &from = story[session.node];
+	if (from.choiceCount == 0) {
+		return StepResult::TheEnd;
+	}
+	taken = story.Sample(from, Random(story, session));
+	return StepResult::Moved;
+}
+
+StepResult PickPlugin(const CompiledStory &story, Session &session, size_t, uint32_t &taken) {
+	const CompiledStory::Node &from = story[session.node];
+	const StoryNodeKind &kind = story.Kind(from.kind);
+	StoryNodeCall call = {from.id, from.argument.data(), from.argument.size(), from.choiceCount, Random(story, session)};
+	uint32_t picked = kind.next(kind.state, &call);
+	if (picked >= from.choiceCount) {
+		return StepResult::TheEnd;
+	}
+	taken = from.firstChoice + picked;
+	return StepResult::Moved;
+}
+
+// Indexed by CompiledStory::Node::kind, one entry for every value it can take.
+const std::array<Pick, 256> picks = [] {
+	std::array<Pick, 256> picks;
+	picks.fill(PickPlugin);
+	picks[CompiledStory::QuestionKind] = PickAnswer;
+	picks[CompiledStory::DialogueKind] = PickNext;
+	picks[CompiledStory::RandomKind] = PickDrawn;
+	return picks;
+}();
+
+// Random nodes and plugin ones are given a draw each time they are left.
+bool Draws(const CompiledStory::Node &node) {
+	return node.kind >= CompiledStory::RandomKind;
+}
+
+void Reset(const CompiledStory &story, Session &session) {
+	session.history.Clear();
+	session.registers.assign(story.Registers() + 1, 0);
+	session.changes.clear();
+	session.lastChange = History::None;
+}
+
+}
+
+void StartSession(const CompiledStory &story, Session &session, uint64_t seed) {
+	session.node = story.Start();
+	session.seed = seed;
+	Reset(story, session);
+	session.visited.Resize(story.Size());
+	session.chosen.Resize(story.ChoiceCount());
+	if (session.node != CompiledStory::Missing) {
+		session.visited.Set(session.node);
+		Analytics::Arrived(session.node);
+		Enter(story, session, session.node);
+	}
+}
+
+uint64_t NewSeed() {
+	thread_local std::mt19937_64 seeds(std::random_device{}());
+	return seeds();
+}
+
+StepResult Step(const CompiledStory &story, Session &session, size_t choice) {
+	const CompiledStory::Node &from = story[session.node];
+	uint32_t taken;
+	StepResult picked = picks[from.kind](story, session, choice, taken);
+	if (picked != StepResult::Moved) {
+		return picked;
+	}
+	uint32_t target = taken == CompiledStory::End ? from.next : story.ChoiceAt(taken).target;
+	if (target == CompiledStory::End) {
+		return StepResult::TheEnd;
+	}
+	if (target == CompiledStory::Missing) {
+		return StepResult::MissingNode;
+	}
+
+	session.history.Push(session.node, session.lastChange);
+	if (Draws(from)) {
+		CountDraw(story, session);
+	}
+	session.node = target;
+	session.visited.Set(target);
+	Analytics::Arrived(target);
+	if (taken != CompiledStory::End) {
+		session.chosen.Set(taken);
+		Analytics::Taken(taken);
+	}
+	Enter(story, session, target);
+	return StepResult::Moved;
+}
+
+StepResult StepBack(Session &session, size_t steps) {
+	uint32_t mark;
+	if (!session.history.Back(steps, session.node, mark)) {
+		return StepResult::NoHistory;
+	}
+
+	// The mark is on the log's way back from its head, where the branch left off.
+	while (session.lastChange != mark) {
+		const Session::Change &change = session.changes[session.lastChange];
+		session.registers[change.slot] = change.value;
+		session.lastChange = change.previous;
+	}
+	return StepResult::Moved;
+}
+
+void EncodeSession(const CompiledStory &story, const Session &session, std::string &out) {
+	out.clear();
+	out += char(StateVersion);
+	uint64_t hash = story.Hash();
+	out.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
+	PutVarint(out, session.node);
+
+	thread_local std::vector<uint32_t> path;
+	session.history.Path(path);
+	PutVarint(out, path.size());
+	for (uint32_t node : path) {
+		PutVarint(out, node);
+	}
+
+	PutBits(out, session.visited);
+	PutBits(out, session.chosen);
+	PutVarint(out, session.seed);
+}
+
+bool DecodeSession(const CompiledStory &story, std::string_view record, Session &session) {
+	uint64_t hash;
+	if (record.size() < 1 + sizeof(hash) || uint8_t(record[0]) == 0 || uint8_t(record[0]) > StateVersion) {
+		return false;
+	}
+	uint8_t version = record[0];
+	memcpy(&hash, record.data() + 1, sizeof(hash));
+	if (hash != story.Hash()) {
+		return false;
+	}
+	record.remove_prefix(1 + sizeof(hash));
+
+	Session decoded;
+	Reset(story, decoded);
+	uint64_t node, depth;
+	// Every step takes a byte at least.
+	if (!GetVarint(record, node) || node >= story.Size() || !GetVarint(record, depth) || depth > record.size()) {
+		return false;
+	}
+	for (size_t i = 0; i <= depth; ++i) {
+		uint64_t step = node;
+		if (i < depth && (!GetVarint(record, step) || step >= story.Size())) {
+			return false;
+		}
+		if (i > 0) {
+			decoded.history.Push(decoded.node, decoded.lastChange);
+			if (Draws(story[decoded.node])) {
+				CountDraw(story, decoded);
+			}
+		}
+		decoded.node = step;
+		Enter(story, decoded, step);
+	}
+
+	if (!GetBits(record, decoded.visited, story.Size())) {
+		return false;
+	}
+	// Version 1 had no chosen bits.
+	if (version == 1) {
+		decoded.chosen.Resize(story.ChoiceCount());
+	} else if (!GetBits(record, decoded.chosen, story.ChoiceCount())) {
+		return false;
+	}
+	if (version >= 3 && !GetVarint(record, decoded.seed)) {
+		return false;
+	}
+	if (!record.empty()) {
+		return false;
+	}
+
+	session = std::move(decoded);
+	return true;
+}
+
+void AppendProgress(std::string &out, const CompiledStory &story, const Session &session) {
+	out += "{\"Nodes\":";
+	AppendNumber(out, story.Size());
+	out += ",\"Visited\":";
+	AppendNumber(out, session.visited.Count());
+	out += ",\"Choices\":";
+	AppendNumber(out, story.ChoiceCount());
+	out += ",\"Chosen\":";
+	AppendNumber(out, session.chosen.Count());
+	out += ",\"Seed\":";
+	AppendNumber(out, session.seed);
+	out += '}';
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitset.h"
+#include "history.h"
+#include "compiled.h"
+
+// Where one playthrough stands, every node before it so it can go back
+// (see History), and a bit for every node it has been to and every choice
+// it has taken, by position (see CompiledStory::ChoiceCount()):
+// (nodes + choices)/8 bytes.
+//
+// Stories with scripts also give it registers (see Script). Effects log
+// the values they overwrite, as a persistent list like the history whose
+// entries mark where the log stood, so going back undoes them.
+//
+// Random nodes, and plugin ones for their plugin, draw from the seed and the
+// number of draws so far, which is kept in one more register past the
+// story's, so the same seed and answers play the same, going back and on
+// again included.
+struct Session {
+	struct Change {
+		uint32_t slot;
+		uint32_t previous;
+		int64_t value;
+	};
+
+	uint32_t node = CompiledStory::Missing;
+	History history;
+	Bitset visited;
+	Bitset chosen;
+	// Conditions work in the scratch registers past the variables even when
+	// only looking at a session.
+	mutable std::vector<int64_t> registers;
+	std::vector<Change> changes;
+	uint32_t lastChange = History::None;
+	uint64_t seed = 0;
+};
+
+enum class StepResult { Moved, TheEnd, NotAChoice, MissingNode, NoHistory };
+
+void StartSession(const CompiledStory &story, Session &session, uint64_t seed = 0);
+// A seed for a session that was given none, different every time.
+uint64_t NewSeed();
+// Moves on from the current node and runs the effect of the one it arrives
+// at; choice is the ID an offered choice leads to and is ignored on nodes
+// that go on by themselves. Only Moved changes the session.
+StepResult Step(const CompiledStory &story, Session &session, size_t choice);
+// Returns to the node steps back, NoHistory if the session has not come
+// that far, and undoes the effects since. The nodes and choices seen on the
+// way stay seen.
+StepResult StepBack(Session &session, size_t steps = 1);
+
+// {"Nodes":..,"Visited":..,"Choices":..,"Chosen":..,"Seed":..}: how much
+// of the story the session has seen, for completion and achievements, and
+// the seed to play it again with.
+void AppendProgress(std::string &out, const CompiledStory &story, const Session &session);
+
+// Save states: a versioned binary record of a few dozen bytes plus the
+// visited bits, tied to the story through its hash:
+//   u8 version, u64 story hash, varint node,
+//   varint depth, varint node per step back (oldest first, the branch
+//   the session is on only),
+//   varint byte count, visited node bits up to the last one set,
+//   varint byte count, chosen choice bits likewise (since version 2),
+//   varint seed (since version 3).
+// Registers are not saved: decoding plays the effects along the path
+// again, which gives back the undo log as well.
+void EncodeSession(const CompiledStory &story, const Session &session, std::string &out);
+// False if the record is damaged, of another version, or of another story.
+bool DecodeSession(const CompiledStory &story, std::string_view record, Session &session);
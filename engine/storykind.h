@@ -0,0 +1,54 @@
+/* Node kinds from plugins: the C interface a shared library implements to
+ * add kinds of node the engine does not know itself. A node of such a kind
+ * is a question the story answers for the player, like a random node: its
+ * plugin picks one of its choices each time a session moves on from it.
+ *
+ * A story names the kind in a node's "Kind", optionally followed by a space
+ * and an argument, "clock 8 20" say, which the plugin is given as it is.
+ *
+ * The library exports story_node_kinds(), which the engine calls once on
+ * loading it with STORY_KIND_ABI. It fills in up to capacity kinds and
+ * returns how many it has, or -1 if it does not speak that version. Names
+ * and states must stay valid while the library is loaded; next may be
+ * called from several threads at once.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STORY_KIND_ABI 1
+
+/* Returned by next to end the story there; so is any choice out of range. */
+#define STORY_KIND_END UINT32_MAX
+
+typedef struct StoryNodeCall {
+	/* The node's ID. */
+	uint64_t id;
+	/* What follows the name in its "Kind", not terminated. */
+	const char *argument;
+	size_t argument_size;
+	/* Its choices, numbered from 0 in the order of the IDs they lead to. */
+	uint32_t choice_count;
+	/* 64 bits drawn from the session's seed, the same each time the session
+	 * comes this way again. */
+	uint64_t random;
+} StoryNodeCall;
+
+typedef struct StoryNodeKind {
+	const char *name;
+	/* Returns the number of the choice taken, or STORY_KIND_END. */
+	uint32_t (*next)(void *state, const StoryNodeCall *call);
+	void *state;
+} StoryNodeKind;
+
+typedef int (*StoryNodeKindsFunction)(uint32_t abi, StoryNodeKind *kinds, int capacity);
+int story_node_kinds(uint32_t abi, StoryNodeKind *kinds, int capacity);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The text of a compiled story in one language: every part it renders (see
+// CompiledStory::Json()) in one block found by offsets, the bytes of each
+// node's JSON before its choices, and for parts with {variable} in them the
+// segments they are filled in from. A table only points: into its Storage,
+// or into a mapped file (see Languages), which must outlive it.
+struct StringTable {
+	// A span of the block, or a variable when slot is not Script::None.
+	struct Segment {
+		uint32_t offset;
+		uint32_t size;
+		uint32_t slot;
+	};
+
+	// What a table is built into.
+	struct Storage {
+		std::string text;
+		std::vector<uint64_t> offsets;
+		std::vector<uint32_t> partSegments;
+		std::vector<Segment> segments;
+		std::vector<uint32_t> heads;
+
+		StringTable View() const {
+			return {text.data(), offsets.data(), partSegments.data(), segments.data(), heads.data(), offsets.size() - 1};
+		}
+	};
+
+	const char *text;
+	// One more than parts, the last being where the block ends.
+	const uint64_t *offsets;
+	// The segments of a part run up to those of the next one; none for
+	// parts without variables. One more than parts as well.
+	const uint32_t *partSegments;
+	const Segment *segments;
+	// One per node.
+	const uint32_t *heads;
+	size_t parts;
+
+	std::string_view Part(size_t part) const {
+		return std::string_view(text + offsets[part], offsets[part + 1] - offsets[part]);
+	}
+};
@@ -0,0 +1,334 @@
+#include "terminal.h"
+#include "deadlines.h"
+#include "input.h"
+#include "output.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+namespace {
+
+volatile sig_atomic_t resized = 0;
+
+void OnResize(int) {
+	resized = 1;
+}
+
+void WriteAll(std::string_view data) {
+	while (!data.empty()) {
+		ssize_t n = write(STDOUT_FILENO, data.data(), data.size());
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return;
+		data.remove_prefix(n);
+	}
+}
+
+// The terminal in raw mode on its alternate screen, with the cursor hidden,
+// for as long as this lives. Resizing interrupts reads rather than being
+// restarted, so the screen is drawn again.
+class RawMode {
+public:
+	RawMode() {
+		if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || tcgetattr(STDIN_FILENO, &saved) < 0) {
+			throw std::runtime_error("the terminal front end needs a terminal");
+		}
+		termios raw = saved;
+		cfmakeraw(&raw);
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+		struct sigaction action = {};
+		action.sa_handler = OnResize;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGWINCH, &action, &previous);
+		WriteAll("\x1b[?1049h\x1b[?25l");
+	}
+
+	~RawMode() {
+		WriteAll("\x1b[m\x1b[?25h\x1b[?1049l");
+		sigaction(SIGWINCH, &previous, nullptr);
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+	}
+
+	RawMode(const RawMode &) = delete;
+	RawMode &operator=(const RawMode &) = delete;
+
+private:
+	termios saved;
+	struct sigaction previous;
+};
+
+void TerminalSize(size_t &rows, size_t &columns) {
+	winsize size = {};
+	ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
+	rows = std::max<size_t>(size.ws_row, 2);
+	columns = std::max<size_t>(size.ws_col, 8);
+}
+
+enum class Key { Up, Down, Enter, Back, Quit, TimeUp };
+
+// Every key that has come in, so keys sent together over a slow link are
+// all handled before the screen is drawn again. None if a resize came first.
+void ReadKeys(std::vector<Key> &keys) {
+	char input[64];
+	ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+	if (n < 0 && errno == EINTR) {
+		return;
+	}
+	if (n <= 0) {
+		keys.push_back(Key::Quit);
+		return;
+	}
+	// An escape sequence may come in pieces.
+	if (input[n - 1] == '\x1b' || (n >= 2 && input[n - 2] == '\x1b')) {
+		pollfd in = {STDIN_FILENO, POLLIN, 0};
+		ssize_t more;
+		if (poll(&in, 1, 50) > 0 && (more = read(STDIN_FILENO, input + n, sizeof(input) - n)) > 0) {
+			n += more;
+		}
+	}
+
+	for (ssize_t i = 0; i < n; ++i) {
+		if (input[i] == '\x1b' && i + 1 < n && (input[i + 1] == '[' || input[i + 1] == 'O')) {
+			// Parameters, then the final byte that says which key.
+			i += 2;
+			while (i < n && input[i] >= 0x30 && input[i] <= 0x3F) ++i;
+			if (i < n && input[i] == 'A') keys.push_back(Key::Up);
+			if (i < n && input[i] == 'B') keys.push_back(Key::Down);
+			continue;
+		}
+		switch (input[i]) {
+		case 'k': keys.push_back(Key::Up); break;
+		case 'j': keys.push_back(Key::Down); break;
+		case '\r': case '\n': case ' ': keys.push_back(Key::Enter); break;
+		case 'b': keys.push_back(Key::Back); break;
+		case 'q': case 3: case 4: keys.push_back(Key::Quit); break;
+		}
+	}
+}
+
+}
+
+void FindOffered(const CompiledStory &story, uint32_t node, int64_t *registers, const StringTable *language,
+	std::string &block, std::vector<OfferedChoice> &offered) {
+	block.clear();
+	offered.clear();
+	const CompiledStory::Node &from = story[node];
+	if (from.automatic) {
+		return;
+	}
+
+	if (from.dynamic) {
+		story.OfferedConsoleChoices(node, registers, block, language);
+	} else {
+		block = story.ConsoleChoices(node, language);
+	}
+	for (const CompiledStory::Choice *choice = story.ChoicesBegin(from); choice != story.ChoicesEnd(from); ++choice) {
+		if (story.Offered(*choice, registers)) {
+			offered.push_back({choice->id, {}});
+		}
+	}
+
+	// The block has a line "<id> -> <text>" for each; a text runs up to
+	// where the next one's line starts.
+	std::string prefix;
+	size_t at = 0;
+	for (size_t i = 0; i < offered.size(); ++i) {
+		prefix.clear();
+		AppendNumber(prefix, offered[i].id);
+		prefix += " -> ";
+		size_t begin = std::min(at + prefix.size(), block.size());
+		size_t end = block.size();
+		if (i + 1 < offered.size()) {
+			prefix = "\n";
+			AppendNumber(prefix, offered[i + 1].id);
+			prefix += " -> ";
+			end = std::min(block.find(prefix, begin), block.size());
+		}
+		at = end + 1;
+		if (end > begin && block[end - 1] == '\n') --end;
+		offered[i].text = std::string_view(block).substr(begin, end - begin);
+	}
+}
+
+void DrawNode(Screen &screen, const CompiledStory &story, ConsoleLayout &layout, uint32_t node, const int64_t *registers,
+	const std::vector<OfferedChoice> &offered, size_t selected, size_t secondsLeft) {
+	screen.Clear();
+	size_t width = screen.Columns();
+
+	// Every line drawn, by its place in body: the text, then each choice
+	// wrapped two columns in, after a blank line, the selected one marked.
+	struct Line {
+		size_t offset;
+		size_t size;
+		size_t choice;
+	};
+	const size_t Text = SIZE_MAX;
+	std::string body;
+	std::vector<Line> lines;
+	auto addLines = [&](size_t from, size_t choice) {
+		for (size_t begin = from; begin < body.size();) {
+			size_t end = std::min(body.find('\n', begin), body.size());
+			lines.push_back({begin, end - begin, choice});
+			begin = end + 1;
+		}
+	};
+	layout.Text(node, registers, width, body);
+	addLines(0, Text);
+
+	std::vector<LineBreak> breaks;
+	size_t selectedLine = SIZE_MAX;
+	for (size_t i = 0; i < offered.size(); ++i) {
+		if (i == 0) {
+			lines.push_back({0, 0, Text});
+		}
+		if (i == selected) {
+			selectedLine = lines.size();
+		}
+		breaks.clear();
+		FindBreaks(offered[i].text, breaks);
+		size_t from = body.size();
+		WrapText(offered[i].text, breaks.data(), breaks.data() + breaks.size(), width - 2, body);
+		addLines(from, i);
+	}
+
+	// What does not fit goes off the top, short of the selected choice.
+	size_t rows = screen.Rows() - 1;
+	size_t first = lines.size() > rows ? lines.size() - rows : 0;
+	first = std::min(first, selectedLine);
+	for (size_t row = 0; row < rows && first + row < lines.size(); ++row) {
+		const Line &line = lines[first + row];
+		std::string_view text(body.data() + line.offset, line.size);
+		if (line.choice == Text) {
+			screen.Put(row, 0, text);
+			continue;
+		}
+		// Only the mark moves with the selection, so moving it sends a few cells.
+		if (line.choice == selected && lines[first + row - 1].choice != line.choice) {
+			screen.Put(row, 0, ">", Screen::Reverse);
+		}
+		screen.Put(row, 2, text);
+	}
+
+	std::string_view keys = story[node].automatic ? "Enter: go on   b: back   q: quit"
+		: offered.empty() ? "b: back   q: quit"
+		: "↑↓: choose   Enter: take   b: back   q: quit";
+	size_t end = screen.Put(screen.Rows() - 1, 0, keys);
+
+	// At the right, so the keys stay put as it counts down.
+	if (secondsLeft) {
+		std::string left;
+		AppendNumber(left, secondsLeft);
+		left += " s";
+		if (end + 3 + left.size() <= width) {
+			screen.Put(screen.Rows() - 1, width - left.size(), left, Screen::Reverse);
+		}
+	}
+}
+
+void PlayInTerminal(const CompiledStory &story, Playthrough &play, const std::function<void()> &stepped) {
+	RawMode raw;
+	ConsoleLayout layout(story, play.Language());
+	size_t rows, columns;
+	TerminalSize(rows, columns);
+	Screen screen(rows, columns);
+	OutputQueue out;
+	std::string block;
+	std::vector<OfferedChoice> offered;
+	std::vector<Key> keys;
+	size_t selected = 0;
+
+	// A timed question runs out at due, and is drawn again each second
+	// until then to count down.
+	enum { TimeUp, Tick };
+	Deadlines deadlines;
+	Input input(deadlines);
+	int64_t due = 0, ticking = 0;
+	auto arrived = [&] {
+		selected = 0;
+		FindOffered(story, play.Current().node, play.State().registers.data(), play.Language(), block, offered);
+		if (uint64_t arrival = play.Current().arrival) {
+			due = Deadlines::In(story[play.Current().node].timeLimit);
+			deadlines.Add(TimeUp, arrival, due);
+		}
+	};
+	arrived();
+
+	while (true) {
+		uint64_t arrival = play.Current().arrival;
+		size_t secondsLeft = 0;
+		if (arrival) {
+			int64_t left = std::max<int64_t>(due - Deadlines::Now(), 0);
+			secondsLeft = (left + 999999999) / 1000000000;
+			int64_t tick = due - int64_t(secondsLeft - 1) * 1000000000;
+			if (secondsLeft > 1 && tick != ticking) {
+				ticking = tick;
+				deadlines.Add(Tick, arrival, tick);
+			}
+		}
+		DrawNode(screen, story, layout, play.Current().node, play.State().registers.data(), offered, selected, secondsLeft);
+		screen.Render(out.Text());
+		if (!out.Flush(STDOUT_FILENO)) {
+			return;
+		}
+
+		keys.clear();
+		Input::Event event = input.Wait();
+		if (event == Input::Readable) {
+			ReadKeys(keys);
+		} else if (event == Input::Expired) {
+			deadlines.Expire([&](uint64_t key, uint64_t expired) {
+				if (key == TimeUp && expired == play.Current().arrival) {
+					keys.push_back(Key::TimeUp);
+				}
+			});
+		}
+		if (resized) {
+			resized = 0;
+			TerminalSize(rows, columns);
+			screen.Resize(rows, columns);
+		}
+		for (Key key : keys) {
+			uint32_t node = play.Current().node;
+			StepResult result = StepResult::NotAChoice;
+			switch (key) {
+			case Key::Up:
+				selected -= selected > 0;
+				break;
+			case Key::Down:
+				selected += selected + 1 < offered.size();
+				break;
+			case Key::Enter:
+				if (story[node].automatic) {
+					result = play.Choose(0).result;
+				} else if (!offered.empty()) {
+					result = play.Choose(offered[selected].id).result;
+				}
+				break;
+			case Key::TimeUp:
+				result = play.Choose(story[node].defaultChoice).result;
+				break;
+			case Key::Back:
+				result = play.Back().result;
+				break;
+			case Key::Quit:
+				return;
+			}
+
+			if (result == StepResult::TheEnd || result == StepResult::MissingNode) {
+				return;
+			}
+			if (result == StepResult::Moved) {
+				stepped();
+				arrived();
+			}
+		}
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compiled.h"
+#include "playthrough.h"
+#include "screen.h"
+#include "wrap.h"
+
+// A choice a node offers, with its text as the console shows it.
+struct OfferedChoice {
+	size_t id;
+	std::string_view text;
+};
+
+// The choices node offers for registers, in order, their text in language
+// pointing into block, which is rendered into.
+void FindOffered(const CompiledStory &story, uint32_t node, int64_t *registers, const StringTable *language,
+	std::string &block, std::vector<OfferedChoice> &offered);
+
+// Draws node the way the terminal front end shows it: its text wrapped to
+// the screen, the choices below with the selected one highlighted, and the
+// keys on the last row, with the seconds left on a timed question, if not
+// 0, at its end. Text taller than the screen shows its end.
+void DrawNode(Screen &screen, const CompiledStory &story, ConsoleLayout &layout, uint32_t node, const int64_t *registers,
+	const std::vector<OfferedChoice> &offered, size_t selected, size_t secondsLeft = 0);
+
+// Plays on the terminal in raw mode, on the alternate screen so nothing
+// scrolls: arrow keys (or j and k) pick a choice, Enter takes it or goes
+// on, b goes back, q leaves. A timed question counts down and takes its
+// default when the time is up. Each key sends only what changed on screen,
+// in one write. stepped is called after every step. Throws
+// std::runtime_error if stdin and stdout are not a terminal.
+void PlayInTerminal(const CompiledStory &story, Playthrough &play, const std::function<void()> &stepped);
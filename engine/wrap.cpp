@@ -0,0 +1,371 @@
+#include "wrap.h"
+
+#include <algorithm>
+
+namespace {
+
+// Line breaking classes of UAX #14, those this tells apart; Start stands for
+// the start of the text or of a line.
+enum Class : uint8_t { AL, BA, BB, BK, CL, CM, CP, CR, EX, GL, HY, ID, IN, IS, LF, NL, NS, NU, OP, PO, PR, QU, SP, SY, WJ, ZW, ZWJ, Start };
+
+const Class Ascii[128] = {
+	CM, CM, CM, CM, CM, CM, CM, CM, CM, BA, LF, BK, BK, CR, CM, CM,
+	CM, CM, CM, CM, CM, CM, CM, CM, CM, CM, CM, CM, CM, CM, CM, CM,
+	SP, EX, QU, AL, PR, PO, AL, QU, OP, CP, AL, PR, IS, HY, IS, SY,
+	NU, NU, NU, NU, NU, NU, NU, NU, NU, NU, IS, IS, AL, AL, AL, EX,
+	AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL,
+	AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, OP, PR, CP, AL, AL,
+	AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL,
+	AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, OP, BA, CL, AL, CM,
+};
+
+struct ClassRange {
+	char32_t first;
+	char32_t last;
+	Class lineClass;
+};
+
+// The rest of the Line_Break property as far as stories need it: Latin and
+// its punctuation, combining marks, general punctuation, and CJK with its
+// punctuation and small kana. Anything else is AL, so scripts broken by
+// dictionary, like Thai, break only at spaces.
+const ClassRange Classes[] = {
+	{0x0080, 0x0084, CM}, {0x0085, 0x0085, NL}, {0x0086, 0x009F, CM}, {0x00A0, 0x00A0, GL},
+	{0x00A1, 0x00A1, OP}, {0x00A2, 0x00A2, PO}, {0x00A3, 0x00A5, PR}, {0x00AB, 0x00AB, QU},
+	{0x00AD, 0x00AD, BA}, {0x00B0, 0x00B0, PO}, {0x00B1, 0x00B1, PR}, {0x00B4, 0x00B4, BB},
+	{0x00BB, 0x00BB, QU}, {0x00BF, 0x00BF, OP},
+	{0x0300, 0x036F, CM}, {0x0483, 0x0489, CM}, {0x0591, 0x05BD, CM}, {0x05BF, 0x05BF, CM},
+	{0x05C1, 0x05C2, CM}, {0x05C4, 0x05C5, CM}, {0x05C7, 0x05C7, CM}, {0x0610, 0x061A, CM},
+	{0x064B, 0x065F, CM}, {0x0670, 0x0670, CM}, {0x06D6, 0x06DC, CM}, {0x06DF, 0x06E4, CM},
+	{0x06E7, 0x06E8, CM}, {0x06EA, 0x06ED, CM}, {0x0900, 0x0903, CM}, {0x093A, 0x093C, CM},
+	{0x093E, 0x094F, CM}, {0x0951, 0x0957, CM}, {0x0962, 0x0963, CM}, {0x0964, 0x0965, BA},
+	{0x1100, 0x115F, ID}, {0x1160, 0x11FF, CM}, {0x1680, 0x1680, BA}, {0x1AB0, 0x1AFF, CM},
+	{0x1DC0, 0x1DFF, CM},
+	{0x2000, 0x2006, BA}, {0x2007, 0x2007, GL}, {0x2008, 0x200A, BA}, {0x200B, 0x200B, ZW},
+	{0x200C, 0x200C, CM}, {0x200D, 0x200D, ZWJ}, {0x200E, 0x200F, CM}, {0x2010, 0x2010, BA},
+	{0x2011, 0x2011, GL}, {0x2012, 0x2014, BA}, {0x2018, 0x2019, QU}, {0x201A, 0x201A, OP},
+	{0x201B, 0x201D, QU}, {0x201E, 0x201E, OP}, {0x201F, 0x201F, QU}, {0x2024, 0x2026, IN},
+	{0x2027, 0x2027, BA}, {0x2028, 0x2029, BK}, {0x202A, 0x202E, CM}, {0x202F, 0x202F, GL},
+	{0x2030, 0x2037, PO}, {0x2039, 0x203A, QU}, {0x203C, 0x203D, NS}, {0x2044, 0x2044, IS},
+	{0x2047, 0x2049, NS}, {0x2060, 0x2060, WJ}, {0x20A0, 0x20CF, PR}, {0x20D0, 0x20F0, CM},
+	{0x2E80, 0x2FFF, ID}, {0x3000, 0x3000, BA}, {0x3001, 0x3002, CL}, {0x3003, 0x3004, ID},
+	{0x3005, 0x3005, NS}, {0x3006, 0x3007, ID}, {0x3008, 0x3008, OP}, {0x3009, 0x3009, CL},
+	{0x300A, 0x300A, OP}, {0x300B, 0x300B, CL}, {0x300C, 0x300C, OP}, {0x300D, 0x300D, CL},
+	{0x300E, 0x300E, OP}, {0x300F, 0x300F, CL}, {0x3010, 0x3010, OP}, {0x3011, 0x3011, CL},
+	{0x3012, 0x3013, ID}, {0x3014, 0x3014, OP}, {0x3015, 0x3015, CL}, {0x3016, 0x3016, OP},
+	{0x3017, 0x3017, CL}, {0x3018, 0x3018, OP}, {0x3019, 0x3019, CL}, {0x301A, 0x301A, OP},
+	{0x301B, 0x301B, CL}, {0x301C, 0x301C, NS}, {0x301D, 0x301D, OP}, {0x301E, 0x301F, CL},
+	{0x3020, 0x3029, ID}, {0x302A, 0x302F, CM}, {0x3030, 0x303A, ID}, {0x303B, 0x303C, NS},
+	{0x303D, 0x3040, ID}, {0x3041, 0x3041, NS}, {0x3042, 0x3042, ID}, {0x3043, 0x3043, NS},
+	{0x3044, 0x3044, ID}, {0x3045, 0x3045, NS}, {0x3046, 0x3046, ID}, {0x3047, 0x3047, NS},
+	{0x3048, 0x3048, ID}, {0x3049, 0x3049, NS}, {0x304A, 0x3062, ID}, {0x3063, 0x3063, NS},
+	{0x3064, 0x3082, ID}, {0x3083, 0x3083, NS}, {0x3084, 0x3084, ID}, {0x3085, 0x3085, NS},
+	{0x3086, 0x3086, ID}, {0x3087, 0x3087, NS}, {0x3088, 0x308D, ID}, {0x308E, 0x308E, NS},
+	{0x308F, 0x3094, ID}, {0x3095, 0x3096, NS}, {0x3097, 0x3098, ID}, {0x3099, 0x309A, CM},
+	{0x309B, 0x309E, NS}, {0x309F, 0x309F, ID}, {0x30A0, 0x30A1, NS}, {0x30A2, 0x30A2, ID},
+	{0x30A3, 0x30A3, NS}, {0x30A4, 0x30A4, ID}, {0x30A5, 0x30A5, NS}, {0x30A6, 0x30A6, ID},
+	{0x30A7, 0x30A7, NS}, {0x30A8, 0x30A8, ID}, {0x30A9, 0x30A9, NS}, {0x30AA, 0x30C2, ID},
+	{0x30C3, 0x30C3, NS}, {0x30C4, 0x30E2, ID}, {0x30E3, 0x30E3, NS}, {0x30E4, 0x30E4, ID},
+	{0x30E5, 0x30E5, NS}, {0x30E6, 0x30E6, ID}, {0x30E7, 0x30E7, NS}, {0x30E8, 0x30ED, ID},
+	{0x30EE, 0x30EE, NS}, {0x30EF, 0x30F4, ID}, {0x30F5, 0x30F6, NS}, {0x30F7, 0x30FA, ID},
+	{0x30FB, 0x30FE, NS}, {0x30FF, 0x4DBF, ID}, {0x4E00, 0xA4CF, ID}, {0xAC00, 0xD7A3, ID},
+	{0xF900, 0xFAFF, ID}, {0xFE00, 0xFE0F, CM}, {0xFE20, 0xFE2F, CM}, {0xFE30, 0xFE4F, ID},
+	{0xFEFF, 0xFEFF, WJ}, {0xFF01, 0xFF01, EX}, {0xFF02, 0xFF07, ID}, {0xFF08, 0xFF08, OP},
+	{0xFF09, 0xFF09, CL}, {0xFF0A, 0xFF0B, ID}, {0xFF0C, 0xFF0C, CL}, {0xFF0D, 0xFF0D, ID},
+	{0xFF0E, 0xFF0E, CL}, {0xFF0F, 0xFF19, ID}, {0xFF1A, 0xFF1B, NS}, {0xFF1C, 0xFF1E, ID},
+	{0xFF1F, 0xFF1F, EX}, {0xFF20, 0xFF3A, ID}, {0xFF3B, 0xFF3B, OP}, {0xFF3C, 0xFF3C, ID},
+	{0xFF3D, 0xFF3D, CL}, {0xFF3E, 0xFF5A, ID}, {0xFF5B, 0xFF5B, OP}, {0xFF5C, 0xFF5C, ID},
+	{0xFF5D, 0xFF5D, CL}, {0xFF5E, 0xFF5E, ID}, {0xFF5F, 0xFF5F, OP}, {0xFF60, 0xFF61, CL},
+	{0xFF62, 0xFF62, OP}, {0xFF63, 0xFF64, CL}, {0xFF65, 0xFF65, NS}, {0xFF66, 0xFFEF, ID},
+	{0x1F000, 0x1FAFF, ID}, {0x20000, 0x3FFFD, ID}, {0xE0001, 0xE007F, CM}, {0xE0100, 0xE01EF, CM},
+};
+
+struct Range {
+	char32_t first;
+	char32_t last;
+};
+
+// Characters that take no column: combining marks, Hangul vowels and
+// finals, and format characters.
+const Range Zero[] = {
+	{0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
+	{0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670},
+	{0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0900, 0x0902},
+	{0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+	{0x0962, 0x0963}, {0x1160, 0x11FF}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F},
+	{0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20F0}, {0x302A, 0x302D}, {0x3099, 0x309A},
+	{0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0001, 0xE007F}, {0xE0100, 0xE01EF},
+};
+
+// East Asian Wide and Fullwidth characters, which take two.
+const Range Wide[] = {
+	{0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+	{0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+	{0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+	{0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+	{0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+	{0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+	{0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+	{0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+	{0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+	{0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E},
+	{0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB},
+	{0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+template <class T, size_t N>
+const T *FindRange(const T (&ranges)[N], char32_t c) {
+	const T *range = std::upper_bound(ranges, ranges + N, c, [](char32_t c, const T &range) { return c < range.first; });
+	return range != ranges && c <= range[-1].last ? range - 1 : nullptr;
+}
+
+Class LineClass(char32_t c) {
+	if (c < 0x80) {
+		return Ascii[c];
+	}
+	const ClassRange *range = FindRange(Classes, c);
+	return range ? range->lineClass : AL;
+}
+
+uint32_t Width(char32_t c) {
+	if (c < 0x7F) {
+		return c >= 0x20;
+	}
+	if (c < 0xA0) {
+		return 0;
+	}
+	if (FindRange(Zero, c)) {
+		return 0;
+	}
+	return FindRange(Wide, c) ? 2 : 1;
+}
+
+// The character at text[i], moving i past it. A byte that does not start
+// a UTF-8 sequence, or one that is cut short, is taken alone as U+FFFD.
+char32_t Decode(std::string_view text, size_t &i) {
+	unsigned char first = text[i++];
+	if (first < 0x80) {
+		return first;
+	}
+	size_t length = first >= 0xF0 ? 3 : first >= 0xE0 ? 2 : first >= 0xC2 ? 1 : 0;
+	if (length == 0 || first >= 0xF5 || text.size() - i < length) {
+		return 0xFFFD;
+	}
+	char32_t c = first & (0x3F >> length);
+	for (size_t n = 0; n < length; ++n) {
+		unsigned char next = text[i + n];
+		if ((next & 0xC0) != 0x80) {
+			return 0xFFFD;
+		}
+		c = (c << 6) | (next & 0x3F);
+	}
+	i += length;
+	return c;
+}
+
+// Runs of spaces longer than this before a break are kept on the line in part.
+const uint32_t MaxTrailing = 0x7FFF;
+
+void AddBreak(std::vector<LineBreak> &breaks, uint32_t end, uint32_t offset, uint32_t spaces, uint32_t column, bool mandatory) {
+	uint32_t kept = offset - end > MaxTrailing ? offset - end - MaxTrailing : 0;
+	breaks.push_back({offset, column, uint16_t(offset - end - kept), uint16_t(spaces - kept), mandatory});
+}
+
+bool Newline(Class lineClass) {
+	return lineClass == BK || lineClass == CR || lineClass == LF || lineClass == NL;
+}
+
+// Whether a line may break between before and after, spaces or not between
+// them, by rules LB11 to LB31 (without those for emoji, regional indicators
+// and numbers past their simplest pairs).
+bool Breakable(Class before, Class after, bool spaces) {
+	if (before == Start || after == WJ) return false;
+	if (after == CL || after == CP || after == EX || after == IS || after == SY) return false;
+	if (before == OP) return false;
+	if (before == QU && after == OP) return false;
+	if ((before == CL || before == CP) && after == NS) return false;
+	if (spaces) return true;
+	if (before == WJ || before == GL) return false;
+	if (after == GL) return before == BA || before == HY;
+	if (before == QU || after == QU) return false;
+	if (after == BA || after == HY || after == NS || after == IN || before == BB) return false;
+	switch (before) {
+	case AL: return !(after == AL || after == NU || after == PR || after == PO || after == OP);
+	case NU: return !(after == AL || after == NU || after == PO || after == PR || after == OP);
+	case PR: return !(after == ID || after == AL || after == NU || after == OP);
+	case PO: return !(after == AL || after == NU || after == OP);
+	case ID: return after != PO;
+	case HY: return after != NU;
+	case IS: return after != AL && after != NU;
+	case SY: return after != NU;
+	case CP: return !(after == AL || after == NU);
+	default: return true;
+	}
+}
+
+}
+
+void FindBreaks(std::string_view text, std::vector<LineBreak> &breaks) {
+	// The class of the last character that is not a space, taking combining
+	// marks as the character they follow (LB9), and whether spaces follow it.
+	Class before = Start;
+	bool spaces = false;
+	bool joined = false;
+	// Where text that is not spaces or a newline last ended, and the spaces since.
+	uint32_t end = 0, trailingSpaces = 0, column = 0;
+
+	for (size_t i = 0; i < text.size();) {
+		uint32_t at = i;
+		char32_t c = Decode(text, i);
+		Class own = LineClass(c);
+		bool mark = own == CM || own == ZWJ;
+		// Marks after spaces, newlines or nothing stand alone, as AL (LB10).
+		bool attached = mark && !spaces && !Newline(before) && before != ZW && before != Start;
+		Class lineClass = mark && !attached ? AL : own;
+
+		if (Newline(before) && !(before == CR && lineClass == LF)) {
+			AddBreak(breaks, end, at, trailingSpaces, column, true);
+			before = Start;
+			spaces = false;
+			end = at;
+			trailingSpaces = 0;
+		} else if (!attached && !joined && !Newline(lineClass) && lineClass != SP && lineClass != ZW
+			&& (before == ZW || Breakable(before, lineClass, spaces))) {
+			AddBreak(breaks, end, at, trailingSpaces, column, false);
+		}
+
+		column += Width(c);
+		joined = own == ZWJ;
+		if (lineClass == SP) {
+			spaces = true;
+		} else if (!attached) {
+			before = lineClass;
+			spaces = false;
+		}
+		if (lineClass == SP) {
+			++trailingSpaces;
+		} else if (!Newline(lineClass)) {
+			end = i;
+			trailingSpaces = 0;
+		}
+	}
+
+	if (Newline(before)) {
+		AddBreak(breaks, end, text.size(), trailingSpaces, column, true);
+	} else if (!text.empty()) {
+		AddBreak(breaks, text.size(), text.size(), 0, column, true);
+	}
+}
+
+void WrapText(std::string_view text, const LineBreak *begin, const LineBreak *end, size_t width, std::string &out) {
+	size_t start = 0;
+	uint32_t startColumn = 0;
+	const LineBreak *fit = nullptr;
+
+	for (const LineBreak *at = begin; at != end; ++at) {
+		if (fit && at->EndColumn() - startColumn > width) {
+			out.append(text.data() + start, fit->End() - start);
+			out += '\n';
+			start = fit->offset;
+			startColumn = fit->column;
+		}
+		fit = at;
+		if (at->mandatory) {
+			out.append(text.data() + start, at->End() - start);
+			// The end of text without a newline keeps to the line it is on.
+			if (at->trailing) {
+				out += '\n';
+			}
+			start = at->offset;
+			startColumn = at->column;
+			fit = nullptr;
+		}
+	}
+}
+
+size_t DisplayWidth(std::string_view text) {
+	size_t width = 0;
+	for (size_t i = 0; i < text.size();) {
+		width += Width(Decode(text, i));
+	}
+	return width;
+}
+
+size_t NextCluster(std::string_view text, size_t at, uint32_t &width) {
+	char32_t c = Decode(text, at);
+	width = Width(c);
+	for (size_t next = at; next < text.size(); at = next) {
+		bool joined = c == 0x200D;
+		c = Decode(text, next);
+		if (!joined && (c < 0x300 || Width(c) != 0)) {
+			break;
+		}
+	}
+	return at;
+}
+
+ConsoleLayout::ConsoleLayout(const CompiledStory &story, const StringTable *language) : story(story), language(language) {
+	const StringTable &strings = language ? *language : story.Strings();
+	partBreaks.assign(strings.parts + 1, 0);
+
+	std::vector<size_t> parts;
+	for (uint32_t node = 0; node < story.Size(); ++node) {
+		if (story[node].templated) continue;
+		parts.push_back(story.ConsoleTextPart(node));
+		parts.push_back(story.ConsoleChoicesPart(node));
+		if (!story[node].conditional) continue;
+		for (const CompiledStory::Choice *choice = story.ChoicesBegin(story[node]); choice != story.ChoicesEnd(story[node]); ++choice) {
+			parts.push_back(story.ConsoleChoicePart(*choice));
+		}
+	}
+	std::sort(parts.begin(), parts.end());
+
+	// Parts without breaks of their own start and end where the next does.
+	size_t next = 0;
+	for (size_t part = 0; part < strings.parts; ++part) {
+		partBreaks[part] = breaks.size();
+		if (next < parts.size() && parts[next] == part) {
+			FindBreaks(strings.Part(part), breaks);
+			++next;
+		}
+	}
+	partBreaks[strings.parts] = breaks.size();
+}
+
+void ConsoleLayout::WrapPart(size_t part, size_t width, std::string &out) const {
+	const StringTable &strings = language ? *language : story.Strings();
+	WrapText(strings.Part(part), breaks.data() + partBreaks[part], breaks.data() + partBreaks[part + 1], width, out);
+}
+
+void ConsoleLayout::WrapRendered(size_t width, std::string &out) {
+	renderedBreaks.clear();
+	FindBreaks(rendered, renderedBreaks);
+	WrapText(rendered, renderedBreaks.data(), renderedBreaks.data() + renderedBreaks.size(), width, out);
+}
+
+void ConsoleLayout::Text(uint32_t node, const int64_t *registers, size_t width, std::string &out) {
+	if (!story[node].templated) {
+		WrapPart(story.ConsoleTextPart(node), width, out);
+		return;
+	}
+	rendered.clear();
+	story.OfferedConsoleText(node, registers, rendered, language);
+	WrapRendered(width, out);
+}
+
+void ConsoleLayout::Choices(uint32_t node, int64_t *registers, size_t width, std::string &out) {
+	const CompiledStory::Node &from = story[node];
+	if (from.templated) {
+		rendered.clear();
+		story.OfferedConsoleChoices(node, registers, rendered, language);
+		WrapRendered(width, out);
+	} else if (from.conditional) {
+		for (const CompiledStory::Choice *choice = story.ChoicesBegin(from); choice != story.ChoicesEnd(from); ++choice) {
+			if (story.Offered(*choice, registers)) {
+				WrapPart(story.ConsoleChoicePart(*choice), width, out);
+			}
+		}
+	} else {
+		WrapPart(story.ConsoleChoicesPart(node), width, out);
+	}
+}
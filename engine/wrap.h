@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compiled.h"
+#include "stringtable.h"
+
+// A place text may be broken into lines (Unicode line breaking, UAX #14),
+// and how wide the text before it is on a terminal: East Asian wide
+// characters take two columns, combining marks none. Columns count from the
+// start of the text, newlines taking none. CJK text may break at nearly
+// every character, so these are kept small.
+struct LineBreak {
+	// Where the next line starts.
+	uint32_t offset;
+	uint32_t column;
+	// The bytes before offset a line ending here leaves out, spaces and
+	// the newline, and the columns of those (the spaces).
+	uint16_t trailing;
+	uint16_t spaces : 15;
+	// After a newline, or the end of the text, which is a break too.
+	uint16_t mandatory : 1;
+
+	uint32_t End() const { return offset - trailing; }
+	uint32_t EndColumn() const { return column - spaces; }
+};
+
+// Appends the breaks of text to breaks, in order. Bytes that are not UTF-8
+// are taken as one column each.
+void FindBreaks(std::string_view text, std::vector<LineBreak> &breaks);
+
+// Appends text, whose breaks are [begin, end), to out in lines of up to
+// width columns, breaking at the last break that fits. A word wider than
+// that is left whole, for the terminal to wrap. Linear in the size of
+// text, and allocates nothing once out has room.
+void WrapText(std::string_view text, const LineBreak *begin, const LineBreak *end, size_t width, std::string &out);
+
+// Columns text takes on a terminal.
+size_t DisplayWidth(std::string_view text);
+// Where the character at text[at] ends, with the marks and joined
+// characters that go in its cell, and how many columns it takes.
+size_t NextCluster(std::string_view text, size_t at, uint32_t &width);
+
+// The console output of a story in one language (see
+// CompiledStory::ConsoleText()) with its breaks found once, when built, so
+// wrapping a node to the terminal is a scan of them. Text with {variable}
+// in it has its breaks found when it is rendered. One per thread.
+class ConsoleLayout {
+public:
+	ConsoleLayout(const CompiledStory &story, const StringTable *language = nullptr);
+
+	ConsoleLayout(const ConsoleLayout &) = delete;
+	ConsoleLayout &operator=(const ConsoleLayout &) = delete;
+
+	// As OfferedConsoleText() and OfferedConsoleChoices(), wrapped to width columns.
+	void Text(uint32_t node, const int64_t *registers, size_t width, std::string &out);
+	void Choices(uint32_t node, int64_t *registers, size_t width, std::string &out);
+
+	// What the breaks take.
+	size_t Bytes() const { return breaks.size() * sizeof(LineBreak) + partBreaks.size() * sizeof(uint32_t); }
+
+private:
+	void WrapPart(size_t part, size_t width, std::string &out) const;
+	void WrapRendered(size_t width, std::string &out);
+
+	const CompiledStory &story;
+	const StringTable *language;
+	// The breaks of a part run up to those of the next one; none for parts
+	// that are not sent to the console or are templated.
+	std::vector<uint32_t> partBreaks;
+	std::vector<LineBreak> breaks;
+	std::string rendered;
+	std::vector<LineBreak> renderedBreaks;
+};
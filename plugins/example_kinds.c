@@ -0,0 +1,117 @@
+/* Node kinds to show what plugins can do (see engine/storykind.h):
+ *
+ *   "dice <n>"          2d6 from the session's draw: the second choice if
+ *                       they come to n or more, else the first
+ *   "clock <from> <to>" the first choice between those hours, local time,
+ *                       the second outside them
+ *   "lookup <key>"      the choice numbered by the value of key, as read
+ *                       when loaded from the file $STORY_LOOKUP of
+ *                       "<key> <value>" lines, which stands in for an
+ *                       outside service; the first choice if it has none
+ *
+ * Build: cc -O2 -shared -fPIC -Iengine plugins/example_kinds.c -o example_kinds.so
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "storykind.h"
+
+#define MAX_ENTRIES 256
+
+struct Entry {
+	char key[64];
+	long value;
+};
+
+static struct Entry entries[MAX_ENTRIES];
+static int entryCount;
+
+/* The argument's numbers, at most count; how many there were. */
+static int Numbers(const StoryNodeCall *call, long *numbers, int count) {
+	char argument[64];
+	size_t size = call->argument_size < sizeof(argument) - 1 ? call->argument_size : sizeof(argument) - 1;
+	memcpy(argument, call->argument, size);
+	argument[size] = '\0';
+
+	int found = 0;
+	char *p = argument, *end;
+	while (found < count) {
+		long number = strtol(p, &end, 10);
+		if (end == p) break;
+		numbers[found++] = number;
+		p = end;
+	}
+	return found;
+}
+
+static uint32_t Pick(const StoryNodeCall *call, uint32_t choice) {
+	return choice < call->choice_count ? choice : STORY_KIND_END;
+}
+
+static uint32_t Dice(void *state, const StoryNodeCall *call) {
+	(void)state;
+	long target;
+	if (Numbers(call, &target, 1) != 1) {
+		return STORY_KIND_END;
+	}
+	long roll = 2 + (call->random >> 32) % 6 + (call->random & 0xffffffff) % 6;
+	return Pick(call, roll >= target);
+}
+
+static uint32_t Clock(void *state, const StoryNodeCall *call) {
+	(void)state;
+	long hours[2];
+	if (Numbers(call, hours, 2) != 2) {
+		return STORY_KIND_END;
+	}
+	time_t now = time(NULL);
+	struct tm local;
+	localtime_r(&now, &local);
+	int within = hours[0] <= hours[1]
+		? local.tm_hour >= hours[0] && local.tm_hour < hours[1]
+		: local.tm_hour >= hours[0] || local.tm_hour < hours[1];
+	return Pick(call, !within);
+}
+
+static uint32_t Lookup(void *state, const StoryNodeCall *call) {
+	(void)state;
+	for (int i = 0; i < entryCount; ++i) {
+		if (strlen(entries[i].key) == call->argument_size && memcmp(entries[i].key, call->argument, call->argument_size) == 0) {
+			return entries[i].value >= 0 ? Pick(call, entries[i].value) : STORY_KIND_END;
+		}
+	}
+	return Pick(call, 0);
+}
+
+static void ReadEntries(void) {
+	const char *filename = getenv("STORY_LOOKUP");
+	FILE *file = filename ? fopen(filename, "r") : NULL;
+	if (!file) {
+		return;
+	}
+	entryCount = 0;
+	while (entryCount < MAX_ENTRIES && fscanf(file, "%63s %ld", entries[entryCount].key, &entries[entryCount].value) == 2) {
+		++entryCount;
+	}
+	fclose(file);
+}
+
+int story_node_kinds(uint32_t abi, StoryNodeKind *kinds, int capacity) {
+	static const StoryNodeKind all[] = {
+		{"dice", Dice, NULL},
+		{"clock", Clock, NULL},
+		{"lookup", Lookup, NULL},
+	};
+	const int count = sizeof(all) / sizeof(all[0]);
+
+	if (abi != STORY_KIND_ABI) {
+		return -1;
+	}
+	if (capacity >= count) {
+		ReadEntries();
+		memcpy(kinds, all, sizeof(all));
+	}
+	return count;
+}
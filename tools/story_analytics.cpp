@@ -0,0 +1,93 @@
+// Writes an analytics snapshot of the engine (story_engine -a, see the
+// engine's analytics.h) as CSV: a row per node with the times it was
+// arrived at, then one per choice with the times it was taken, leading from
+// node to next.
+// Usage: story_analytics <analytics file>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+bool GetVarint(std::string_view &in, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (in.empty()) {
+			return false;
+		}
+		uint8_t byte = in.front();
+		in.remove_prefix(1);
+		value |= uint64_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <analytics file>\n", argv[0]);
+		return 2;
+	}
+
+	std::ifstream file(argv[1], std::ios::binary);
+	if (!file) {
+		fprintf(stderr, "%s: cannot open\n", argv[1]);
+		return 2;
+	}
+	std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	std::string_view in(data);
+
+	uint64_t hash, taken, nodeCount, choiceCount;
+	if (in.size() < 1 + sizeof(hash) || in[0] != 1) {
+		fprintf(stderr, "%s: not an analytics snapshot this tool knows\n", argv[1]);
+		return 2;
+	}
+	memcpy(&hash, in.data() + 1, sizeof(hash));
+	in.remove_prefix(1 + sizeof(hash));
+
+	// Node IDs by position, for the choices that follow.
+	std::string csv = "kind,node,next,count\n";
+	std::vector<uint64_t> ids;
+	bool whole = GetVarint(in, taken) && GetVarint(in, nodeCount) && nodeCount <= in.size();
+	uint64_t id = 0;
+	for (uint64_t i = 0; whole && i < nodeCount; ++i) {
+		uint64_t delta, count;
+		whole = GetVarint(in, delta) && GetVarint(in, count);
+		id += delta;
+		ids.push_back(id);
+		csv += "node," + std::to_string(id) + ",," + std::to_string(count) + '\n';
+	}
+
+	whole = whole && GetVarint(in, choiceCount);
+	uint64_t from = 0;
+	for (uint64_t i = 0; whole && i < choiceCount; ++i) {
+		uint64_t delta, next, count;
+		whole = GetVarint(in, delta) && GetVarint(in, next) && GetVarint(in, count) && (from += delta) < ids.size();
+		if (whole) {
+			csv += "choice," + std::to_string(ids[from]) + ',' + std::to_string(next) + ',' + std::to_string(count) + '\n';
+		}
+	}
+	if (!whole || !in.empty()) {
+		fprintf(stderr, "%s: damaged snapshot\n", argv[1]);
+		return 2;
+	}
+
+	time_t when = taken;
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&when));
+	fprintf(stderr, "story %016llx, taken %s\n", (unsigned long long)hash, stamp);
+	fwrite(csv.data(), 1, csv.size(), stdout);
+	return 0;
+}
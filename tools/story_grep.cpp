@@ -0,0 +1,77 @@
+// Searches node and choice text of a story through its trigram index.
+// Usage: story_grep [-t] <query> [story.json]
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <exception>
+
+#include "search.h"
+#include "journal.h"
+
+namespace {
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// First line of text, cut to fit a terminal line.
+std::string Preview(const std::string &text) {
+	size_t end = std::min(text.find('\n'), (size_t)100);
+	std::string line = text.substr(0, end);
+	if (end < text.size()) line += "...";
+	return line;
+}
+
+}
+
+int main(int argc, char **argv) {
+	bool timings = false;
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "-t") == 0) {
+		timings = true;
+		++arg;
+	}
+	if (arg >= argc || argc - arg > 2) {
+		fprintf(stderr, "Usage: %s [-t] <query> [story.json]\n", argv[0]);
+		return 2;
+	}
+
+	std::string query = argv[arg];
+	std::string filename = arg + 1 < argc ? argv[arg + 1] : "story.json";
+
+	try {
+		auto start = std::chrono::steady_clock::now();
+		Story story;
+		LoadStory(filename, story);
+		ReplayJournal(filename, story);
+		double loadTime = Since(start);
+
+		start = std::chrono::steady_clock::now();
+		SearchIndex index;
+		LoadOrBuildIndex(filename, story, index);
+		double indexTime = Since(start);
+
+		start = std::chrono::steady_clock::now();
+		std::vector<size_t> found = index.Search(query, story);
+		double searchTime = Since(start);
+
+		for (size_t id : found) {
+			const Dialogue &dial = *story.at(id);
+			printf("%zu: %s\n", id, Preview(dial.Text).c_str());
+		}
+
+		if (timings) {
+			fprintf(stderr, "%zu nodes, %zu matches\n", story.size(), found.size());
+			fprintf(stderr, "load %.1f ms, index %.1f ms (%.1f MB), search %.3f ms\n",
+				loadTime, indexTime, index.MemoryUsage() / (1024.0 * 1024.0), searchTime);
+		}
+
+		return found.empty() ? 1 : 0;
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,116 @@
+// Writes an optimised copy of a story (see OptimizeStory()) and reports what
+// was removed, then plays both the way the batch runner does, taking random
+// offered choices, to show what that saves.
+// Usage: story_optimize [-j] [-r runs] story.json optimized.json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <exception>
+#include <random>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "session.h"
+#include "optimize.h"
+
+namespace {
+
+struct Traversal {
+	size_t steps = 0;
+	double seconds = 0;
+};
+
+// Every node reached is rendered as its JSON line. Playthroughs stop at the
+// end or after maxSteps; the same seed takes the same choices in both
+// stories, as the choices offered only differ where nodes were folded.
+Traversal Traverse(const CompiledStory &story, size_t runs, size_t maxSteps) {
+	Traversal traversal;
+	std::mt19937 random(42);
+	std::string line;
+	std::vector<size_t> offered;
+	Session session;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t run = 0; run < runs; ++run) {
+		StartSession(story, session);
+		for (size_t step = 0; step < maxSteps; ++step) {
+			line.clear();
+			story.OfferedJson(session.node, session.registers.data(), line);
+			++traversal.steps;
+
+			const CompiledStory::Node &node = story[session.node];
+			size_t choice = 0;
+			if (!node.automatic) {
+				offered.clear();
+				for (const CompiledStory::Choice *it = story.ChoicesBegin(node); it != story.ChoicesEnd(node); ++it) {
+					if (story.Offered(*it, session.registers.data())) {
+						offered.push_back(it->id);
+					}
+				}
+				if (offered.empty()) {
+					break;
+				}
+				choice = offered[random() % offered.size()];
+			}
+			if (Step(story, session, choice) != StepResult::Moved) {
+				break;
+			}
+		}
+	}
+	traversal.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return traversal;
+}
+
+}
+
+int main(int argc, char **argv) {
+	bool joinText = false;
+	size_t runs = 1000;
+	int arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+		if (strcmp(argv[arg], "-j") == 0) {
+			joinText = true;
+		} else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+			runs = atol(argv[++arg]);
+		} else {
+			break;
+		}
+	}
+	if (argc - arg != 2) {
+		fprintf(stderr, "Usage: %s [-j] [-r runs] story.json optimized.json\n", argv[0]);
+		return 2;
+	}
+
+	std::string filename = argv[arg];
+	try {
+		Story story;
+		LoadStory(filename, story);
+		CompiledStory before(story);
+
+		OptimizeReport report = OptimizeStory(story, joinText);
+		SaveStory(argv[arg + 1], story);
+		CompiledStory after(story);
+
+		printf("nodes: %zu -> %zu (%zu unreachable, %zu skipped, %zu joined)\n",
+			report.nodesBefore, report.nodesAfter, report.unreachable, report.skipped, report.joined);
+		printf("edges: %zu -> %zu\n", report.edgesBefore, report.edgesAfter);
+		printf("conditions: %zu always hold, %zu never do\n", report.alwaysOffered, report.neverOffered);
+
+		if (runs > 0 && before.Start() != CompiledStory::Missing) {
+			const size_t maxSteps = 10000;
+			Traversal slow = Traverse(before, runs, maxSteps);
+			Traversal fast = Traverse(after, runs, maxSteps);
+			printf("%zu playthroughs: %.1f -> %.1f steps, %.2f -> %.2f us each, %.2fx faster\n", runs,
+				double(slow.steps) / runs, double(fast.steps) / runs,
+				slow.seconds * 1e6 / runs, fast.seconds * 1e6 / runs, slow.seconds / fast.seconds);
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,57 @@
+// Lists what leads to a node: the nodes linking to it directly, or with -a
+// every node it can be reached from, nearest first.
+// Usage: story_refs [-a] <id> [story.json]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <exception>
+
+#include "graph.h"
+#include "journal.h"
+
+int main(int argc, char **argv) {
+	bool all = false;
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "-a") == 0) {
+		all = true;
+		++arg;
+	}
+	if (arg >= argc || argc - arg > 2) {
+		fprintf(stderr, "Usage: %s [-a] <id> [story.json]\n", argv[0]);
+		return 2;
+	}
+
+	size_t id = strtoull(argv[arg], nullptr, 10);
+	std::string filename = arg + 1 < argc ? argv[arg + 1] : "story.json";
+
+	try {
+		Story story;
+		LoadStory(filename, story);
+		ReplayJournal(filename, story);
+
+		StoryGraph graph;
+		graph.Build(story);
+
+		if (!all) {
+			for (size_t from : graph.Incoming(id)) {
+				const Dialogue &dial = *story.at(from);
+				if (dial.IsDialogue) {
+					printf("%zu\n", from);
+				} else {
+					printf("%zu: %s\n", from, dial.Choices.at(id).c_str());
+				}
+			}
+			return 0;
+		}
+
+		for (auto [from, distance] : graph.Predecessors(id)) {
+			printf("%zu\t%zu\n", from, distance);
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,71 @@
+// Renumbers a story to dense IDs in play order and writes <story>.idmap.
+// The journal is folded into the rewritten story and removed.
+// Usage: story_renumber [-t] [story.json]
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <exception>
+
+#include "journal.h"
+#include "renumber.h"
+
+namespace {
+
+double Since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+	bool timings = false;
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "-t") == 0) {
+		timings = true;
+		++arg;
+	}
+	if (argc - arg > 1) {
+		fprintf(stderr, "Usage: %s [-t] [story.json]\n", argv[0]);
+		return 2;
+	}
+
+	std::string filename = arg < argc ? argv[arg] : "story.json";
+
+	try {
+		auto start = std::chrono::steady_clock::now();
+		Story story;
+		LoadStory(filename, story);
+		ReplayJournal(filename, story);
+		double loadTime = Since(start);
+
+		start = std::chrono::steady_clock::now();
+		IdMap ids = RenumberStory(story);
+		double renumberTime = Since(start);
+
+		// The map goes first: without it a renumbered story cannot be matched
+		// up with old saves.
+		start = std::chrono::steady_clock::now();
+		SaveIdMap(filename + ".idmap", ids);
+		SaveStory(filename, story);
+		unlink((filename + ".journal").c_str());
+		unlink((filename + ".journal.old").c_str());
+		double saveTime = Since(start);
+
+		size_t changed = 0;
+		for (auto [oldID, newID] : ids) {
+			changed += oldID != newID;
+		}
+		printf("%zu nodes, %zu IDs changed\n", story.size(), changed);
+
+		if (timings) {
+			fprintf(stderr, "load %.2f s, renumber %.2f s, save %.2f s\n", loadTime, renumberTime, saveTime);
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,59 @@
+// Turns a translated copy of a story, the same nodes and choices with other
+// text, into the string table the engine plays that language from (see
+// Languages): story.<code>.strings next to story.json. Text the copy lacks
+// is taken from the story. Plugins are only needed for the kinds' names.
+// Usage: story_translate [-k plugin.so]... story.json <code> translated.json
+
+#include <stdio.h>
+#include <string.h>
+
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "story.h"
+#include "compiled.h"
+#include "languages.h"
+#include "nodekinds.h"
+
+int main(int argc, char **argv) {
+	std::vector<std::string> plugins;
+	int arg = 1;
+
+	for (; arg + 1 < argc && strcmp(argv[arg], "-k") == 0; arg += 2) {
+		plugins.push_back(argv[arg + 1]);
+	}
+	if (argc - arg != 3) {
+		fprintf(stderr, "Usage: %s [-k plugin.so]... story.json <code> translated.json\n", argv[0]);
+		return 2;
+	}
+
+	std::string filename = argv[arg];
+	try {
+		NodeKinds kinds;
+		for (const std::string &plugin : plugins) {
+			kinds.Load(plugin);
+		}
+
+		Story source, translation;
+		LoadStory(filename, source);
+		CompiledStory story(source, &kinds);
+		LoadStory(argv[arg + 2], translation);
+
+		StringTable::Storage strings;
+		size_t untranslated;
+		story.Translate(translation, strings, untranslated);
+
+		std::string base = filename;
+		if (base.size() > 5 && base.compare(base.size() - 5, 5, ".json") == 0) {
+			base.resize(base.size() - 5);
+		}
+		std::string out = base + "." + argv[arg + 1] + ".strings";
+		SaveStrings(out, story, strings);
+
+		printf("%s: %zu bytes of text, %zu texts untranslated\n", out.c_str(), strings.text.size(), untranslated);
+	} catch (std::exception &e) {
+		fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+		return 2;
+	}
+}